@@ -5,9 +5,7 @@
  Language: C
  Data Structures Used: HashMap, Priority Queue, Linked List
  -------- 
- TODO:  fix sorting in display
-        add file saving maybe
-        Add notifications (try, if possible in C)
+ TODO:  Desktop notifications (reminders only print in the terminal for now)
         check if gui is possible in C
 */
 
@@ -15,17 +13,55 @@
 #include<stdio.h>
 #include<stdlib.h>
 #include<string.h>
+#include<strings.h>
 #include<time.h>
+#include<stdint.h>
+#include<unistd.h>
+#include<fcntl.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<dirent.h>
+#include<errno.h>
+#include<limits.h>
+#include<pthread.h>
+#include<signal.h>
+#include<stdarg.h>
+#include<sys/uio.h>
+#include<sys/ioctl.h>
+#ifdef __GLIBC__
+#include<malloc.h>
+#endif
+#ifdef __linux__
+#include<sys/syscall.h>
+#include<linux/perf_event.h>
+#endif
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define HAVE_X86_SIMD 1 //SSE2 / AVX2 adherence kernels, picked at runtime
+#include<immintrin.h>
+#endif
 
 //GLOBAL CONSTANTS AND DEFINITIONS
 #define MAX_NAME 50
 #define MAX_DOSAGE 20 
 #define MAX_INSTRUCTIONS 100
-#define TABLE_SIZE 100 //hash table size (could be made dynamic later)
+#define MAX_DOSE_TIMES 6 //fixed dose times per day in one recurrence rule
+#define EVERY_DAY 0x7f //weekday mask with all seven days (bit 0 = Sunday)
+#define TABLE_SIZE 100 //starting size of the store and priority queue
+#define INITIAL_CAPACITY 128 //starting hash table size, must be a power of two
+#define MAX_LOAD_PERCENT 70 //grow the hash table once it gets this full
+#define SNAPSHOT_FILE "pillpilot.snap" //medicines + schedule are saved here on exit
+#define HISTORY_LOG_PREFIX "pillpilot.wal" //history log segments: pillpilot.wal.000001, ...
+#define WAL_MAX_LATENCY_MS 10 //an event is on disk at most this long (+ one fsync) after it's logged
+#define WAL_SEGMENT_RECORDS 1000000 //start a new segment file after this many records
+#define WAL_COMPACT_SEGMENTS 8 //merge the closed segments once there are this many
+#define WAL_RETENTION_DAYS 0 //compaction drops events older than this (0 = keep everything)
 
 //STRUCTURE DEF
+// Medicine IDs are 64-bit: node prefix in the top bits, a per-node sequence below (see ID ALLOCATOR)
+typedef long long MedicineId;
+
 typedef struct Medicine {
-    int id; // Unique ID
+    MedicineId id; // Unique ID
     char name[MAX_NAME];    // Medicine name
     char dosage[MAX_DOSAGE];    // Dosage info
     char time[6];  // HH:MM format
@@ -34,317 +70,7590 @@ typedef struct Medicine {
     /*priority = hours*60 + minutes, so 08:30 = 8*60+30 = 510 min*/
 } Medicine; 
 
-// HashMap Node - for storing medicines with fast lookup
-typedef struct HashNode {
-    Medicine medicine; // The actual medicine data
-    int isOccupied; // Flag to check if this slot is taken (1=occupied, 0=free)
-} HashNode;
+// Cold part of a medicine - the text, only touched when we print it
+typedef struct MedicineText {
+    char name[MAX_NAME];    // Medicine name
+    char dosage[MAX_DOSAGE];    // Dosage info
+    char time[6];  // HH:MM format
+    char instructions[MAX_INSTRUCTIONS]; // Additional instructions
+} MedicineText;
+
+// When a medicine's doses come round. Either fixed times of day, or every `interval`
+// minutes counted from `start`; both only on the days in `weekdays` and before `end`.
+// A plain medicine is one fixed time, every day, no end
+typedef struct RecurrenceRule {
+    int64_t start;// first dose (interval rules) / no doses before this (0 = no limit)
+    int64_t end;// no doses at or after this (0 = no end)
+    int32_t interval;// minutes between doses, 0 = fixed times of day
+    int16_t times[MAX_DOSE_TIMES];// minutes from midnight, sorted
+    uint8_t timeCount;
+    uint8_t weekdays;// bit per weekday, bit 0 = Sunday
+} RecurrenceRule;
+
+// Medicine Store - struct of arrays. A medicine is a handle (slot index) into these arrays.
+// The hot keys sit in dense parallel arrays so the HashMap and the heap only drag
+// 4-byte ints through the cache; the ~175 bytes of text live in the cold arena.
+#define MED_LIVE 1 // flag bit: slot holds a medicine that hasn't been deleted
+typedef struct MedicineStore {
+    MedicineId* ids;// hot: medicine ID per handle
+    int* priorities;// hot: minutes from midnight per handle
+    unsigned char* flags;// hot: MED_LIVE etc.
+    MedicineText* text;// cold arena, same index as the hot arrays
+    RecurrenceRule* rules;// read when the next dose is worked out
+    int* freeSlots;// handles of deleted medicines, reused before growing
+    int freeCount;
+    int used;// slots handed out so far
+    int count;// live medicines
+    int capacity;
+    int borrowed;// arrays point into a loaded snapshot (copied out before they can grow)
+} MedicineStore;
+
+// HashMap handle values for slots without a medicine
+#define HANDLE_EMPTY (-1)
+#define HANDLE_DELETED (-2) // tombstone - keeps probe chains intact after a delete
+
+// HashMap Node - ID -> store handle, 16 bytes so a probe still walks 4 slots per cache line
+typedef struct HashNode {
+    MedicineId id; // key (copied here so probing never touches the store)
+    int handle; // index into the MedicineStore, or HANDLE_EMPTY / HANDLE_DELETED
+} HashNode;
+
+// HashMap Structure - index from medicine ID to store handle
+typedef struct HashMap {
+    HashNode* table; //heap allocated array of HashNodes, grows when load gets high
+    int capacity;// always a power of two so we can mask instead of modulo
+    int count;// live entries
+    int tombstones;// deleted slots still sitting in probe chains
+    int borrowed;// table points into a loaded snapshot
+} HashMap;
+
+// Priority Queue Node  (for scheduling reminders)
+typedef struct PQNode {
+    int priority;// Priority based on time; Using a min-heap for the priority queue
+    int handle;// Medicine handle in the store
+} PQNode;
+
+// Priority Queue (Min-Heap) -keeps medicines sorted by time
+typedef struct PriorityQueue {
+    PQNode* heap;// Array-based heap, grows as needed
+    int size;
+    int capacity;
+    int* pos;// position map: pos[handle] = heap index, or -1 if not queued
+    int posCapacity;
+    int borrowed;// heap and pos point into a loaded snapshot
+    //heap[0] is root, for node at index i:
+    //left child at 2*i+1
+    //right child at 2*i+2  
+    //parent at (i-1)/2
+} PriorityQueue;
+
+// Snapshot file header. The sections after it are the raw store / HashMap / heap arrays,
+// each 64-byte aligned, so a loaded snapshot is used in place straight from mmap
+#define SNAPSHOT_MAGIC "PPSNAP1"
+#define SNAPSHOT_VERSION 3 //v2: 64-bit medicine IDs, v3: recurrence rules + next-dose heap keys (older files are upgraded on load)
+enum { SEC_IDS, SEC_PRIORITIES, SEC_FLAGS, SEC_TEXT, SEC_FREE, SEC_TABLE, SEC_HEAP, SEC_POS, SEC_RULES, SEC_COUNT };
+typedef struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    int32_t storeUsed, storeCount, freeCount;
+    int32_t mapCapacity, mapCount, mapTombstones;
+    int32_t pqSize, posCapacity;
+    uint64_t offset[SEC_COUNT];// byte offset of each section in the file
+    uint64_t length[SEC_COUNT];// byte length of each section
+    uint64_t hotChecksum;// everything except the text section
+    uint64_t textChecksum;// text section, only checked on a full verify
+    uint64_t headerChecksum;// this header with headerChecksum = 0
+} SnapshotHeader;
+
+// v1 / v2 header: same fields, no rules section
+typedef struct SnapshotHeaderV2 {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    int32_t storeUsed, storeCount, freeCount;
+    int32_t mapCapacity, mapCount, mapTombstones;
+    int32_t pqSize, posCapacity;
+    uint64_t offset[SEC_RULES];
+    uint64_t length[SEC_RULES];
+    uint64_t hotChecksum;
+    uint64_t textChecksum;
+    uint64_t headerChecksum;
+} SnapshotHeaderV2;
+
+// A loaded snapshot mapping
+typedef struct Snapshot {
+    void* base;
+    size_t length;
+} Snapshot;
+
+// Sorted walk over a PriorityQueue without touching it: a small side heap holds the
+// heap indices that could come next (a popped node's children are the new candidates)
+typedef struct ScheduleIterator {
+    const PriorityQueue* pq;// queue being read (never modified)
+    int* candidates;// min-heap of indices into pq->heap
+    int count;
+    int capacity;
+} ScheduleIterator;
+
+// History status codes
+#define HISTORY_TAKEN 1
+#define HISTORY_MISSED 2
+
+// Handle of an interned string: byte offset into the string table, 0 is the empty string
+typedef uint32_t StringRef;
+
+// History Entry -one taken/missed event, as handed out by history queries
+typedef struct HistoryEntry {
+    time_t timestamp;// Time of entry
+    MedicineId medicineId;// Medicine ID
+    unsigned char status;// HISTORY_TAKEN or HISTORY_MISSED
+    const char* medicineName;// points into the string table, stays valid
+} HistoryEntry;
+
+// History Block (unrolled linked list) -a node holds a whole array of entries,
+// so walking history is mostly sequential reads instead of one pointer hop per event.
+// Entries are stored column by column and a block only ever holds one UTC day, so a range
+// query can skip whole blocks on minTime/maxTime and only touch the columns it filters on
+#define HISTORY_BLOCK_ENTRIES 256
+#define SECONDS_PER_DAY 86400
+typedef struct HistoryBlock {
+    int count;// entries used, oldest at [0], newest at [count-1]
+    long long day;// UTC day number (timestamp / SECONDS_PER_DAY) of every entry here
+    time_t minTime;// oldest / newest timestamp in the block
+    time_t maxTime;
+    struct HistoryBlock* older;// next block towards the tail
+    struct HistoryBlock* newer;// previous block towards the head
+    int32_t offsets[HISTORY_BLOCK_ENTRIES];// seconds since the start of 'day' (0..86399)
+    MedicineId medicineIds[HISTORY_BLOCK_ENTRIES];
+    unsigned char statuses[HISTORY_BLOCK_ENTRIES];
+    StringRef medicineNames[HISTORY_BLOCK_ENTRIES];// interned (see stringAt), only read for display
+} HistoryBlock;
+
+// Timestamp of entry i (the column only stores the offset into the block's day)
+static inline time_t historyTime(const HistoryBlock* block, int i) {
+    return (time_t)(block->day * SECONDS_PER_DAY) + block->offsets[i];
+}
+
+// Block allocator for history - hands out whole blocks and keeps a few freed ones
+// around for reuse; beyond that, trimmed blocks go straight back to the system
+#define HISTORY_SPARE_BLOCKS 16
+typedef struct HistoryArena {
+    HistoryBlock* spare;// free blocks, chained through ->older
+    int spareCount;
+    long long blocksInUse;
+} HistoryArena;
+
+// History log record - fixed size so the log is just an array of these on disk
+typedef struct HistoryRecord {
+    int64_t timestamp;// Time of entry
+    int64_t medicineId;
+    uint32_t checksum;// over the whole record with this field = 0
+    char medicineName[MAX_NAME];
+    uint8_t status;// HISTORY_TAKEN or HISTORY_MISSED
+    uint8_t reserved;// keeps the record at 72 bytes with no hidden padding
+} HistoryRecord;
+
+// Version 1 record (32-bit medicine IDs), still read from old segments
+typedef struct HistoryRecordV1 {
+    int64_t timestamp;
+    int32_t medicineId;
+    uint32_t checksum;
+    char medicineName[MAX_NAME];
+    uint8_t status;
+    uint8_t reserved[5];
+} HistoryRecordV1;
+
+// Segment file header. A compacted segment replaces segments firstCovered..its own number
+#define WAL_MAGIC "PPWAL1"
+#define WAL_VERSION 2 //v2: 64-bit medicine IDs (v1 segments are converted when read)
+typedef struct WalSegmentHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+    int32_t firstCovered;
+    uint32_t reserved;
+} WalSegmentHeader;
+
+// Append-only history log with group commit: appends go into a buffer, a flusher
+// thread writes the whole batch and fsyncs once, at most maxLatencyMs after the first append
+typedef struct HistoryLog {
+    char prefix[256];// segment file name prefix
+    int fd;// current segment, -1 when closed
+    int segment;// current segment number
+    int firstSegment;// oldest segment still on disk
+    int compactFrom;// first segment not yet merged by a compaction
+    long long segmentRecords;// records in the current segment
+    long long maxSegmentRecords;
+    int compactAfter;// closed segments before they get merged
+    int retentionDays;// compaction drops older events (0 = keep everything)
+    int maxLatencyMs;
+    HistoryRecord* pending;// filled by appends
+    HistoryRecord* writing;// being written by the flusher
+    int pendingCount;
+    int bufferCapacity;
+    struct timespec firstPendingAt;// when the oldest pending record was appended
+    unsigned long long appended;// records handed to the log
+    unsigned long long durable;// records known to be on disk
+    unsigned long long syncs;// fsync calls made
+    int running;
+    int failed;// a write/fsync failed, log is no longer durable
+    pthread_mutex_t lock;
+    pthread_cond_t wake;// flusher waits on this
+    pthread_cond_t flushed;// appenders / waiters wait on this
+    pthread_t flusher;
+} HistoryLog;
+
+// Adherence counters - kept up to date on every history insert so statistics never rescan history.
+// Global counts are bucketed in 15-minute UTC slots: every real time zone's midnight falls on a
+// 15-minute boundary, so "today" (or any local date range) is just a sum over ~96 slots, worked
+// out at query time with whatever time zone / DST rules are in effect then.
+#define STATS_SLOT_SECONDS 900
+typedef struct SlotCount {
+    int taken;
+    int missed;
+} SlotCount;
+
+typedef struct AdherenceCounters {
+    SlotCount* slots;// slots[i] counts events in slot baseSlot + i
+    long long baseSlot;
+    int slotCapacity;
+    MedicineId* medIds;// per-medicine totals: open addressing on medicine ID
+    SlotCount* medCounts;
+    int medCapacity;// power of two (0 until the first event)
+    int medUsed;
+} AdherenceCounters;
+
+//Linked List Structure -for history tracking (a list of blocks)
+typedef struct LinkedList {
+    HistoryBlock* head;// newest block
+    HistoryBlock* tail;// oldest block (trimmed first)
+    int count;// Count of history entries
+    HistoryArena arena;
+    AdherenceCounters stats;// running taken/missed counts
+} LinkedList;
+
+// METRICS - counters and histograms on the hot paths (HashMap probes, heap sifts, history
+// appends, sampled op latency). Built in with -DPILLPILOT_METRICS=1; otherwise every METRIC_*
+// macro is empty and a normal build pays nothing. Each thread bumps its own cache-line
+// aligned block with plain stores, no atomics or locks; a dump adds the blocks up. Histograms
+// are log2 buckets (bucket b: values with b significant bits). Gauges are whatever the last
+// touched structure said. Written in Prometheus text format to PILLPILOT_METRICS_FILE
+// (default pillpilot.metrics) on exit and whenever the process gets SIGUSR1
+#ifndef PILLPILOT_METRICS
+#define PILLPILOT_METRICS 0
+#endif
+#define METRICS_FILE "pillpilot.metrics"
+#define METRIC_BUCKETS 40 //up to 2^39 (~550 s in ns)
+#define METRIC_SAMPLE_MASK 63 //time 1 op in 64 per thread
+
+enum { MET_MAP_RESIZES, MET_HISTORY_APPENDS, MET_HISTORY_BLOCKS_NEW, MET_HISTORY_BLOCKS_REUSED, MET_COUNTER_COUNT };
+enum {
+    MET_MAP_LOOKUP_PROBES, MET_MAP_INSERT_PROBES, MET_HEAP_SIFT_LEVELS,
+    MET_LOOKUP_NS, MET_INSERT_NS, MET_ENQUEUE_NS, MET_APPEND_NS, MET_HIST_COUNT
+};
+enum { MET_MAP_ENTRIES, MET_MAP_TOMBSTONES, MET_MAP_CAPACITY, MET_HEAP_SIZE, MET_HISTORY_ENTRIES, MET_GAUGE_COUNT };
+
+#if PILLPILOT_METRICS
+typedef struct MetricsBlock {
+    unsigned long long counters[MET_COUNTER_COUNT];
+    unsigned long long buckets[MET_HIST_COUNT][METRIC_BUCKETS];
+    unsigned long long sums[MET_HIST_COUNT];
+    unsigned sampleTick;
+    struct MetricsBlock* next;// every thread's block, newest first
+} __attribute__((aligned(64))) MetricsBlock;
+
+static MetricsBlock* metricsBlocks;// list head (atomic)
+static __thread MetricsBlock* metricsLocal;
+static long long metricsGauges[MET_GAUGE_COUNT];
+static MetricsBlock metricsFallback;// if a thread can't get a block of its own (counts may race)
+
+// This thread's block, made on first use. Blocks outlive their threads so no counts are lost
+static MetricsBlock* metricsBlock(void) {
+    if (__builtin_expect(metricsLocal != NULL, 1)) return metricsLocal;
+    MetricsBlock* m = (MetricsBlock*)aligned_alloc(64, sizeof(MetricsBlock));
+    if (!m) return metricsLocal = &metricsFallback;
+    memset(m, 0, sizeof(*m));
+    do {
+        m->next = __atomic_load_n(&metricsBlocks, __ATOMIC_RELAXED);
+    } while (!__atomic_compare_exchange_n(&metricsBlocks, &m->next, m, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    return metricsLocal = m;
+}
+
+// Only the owning thread writes a block; relaxed stores keep a concurrent dump's reads whole
+static inline void metricAdd(int counter, unsigned long long value) {
+    MetricsBlock* m = metricsBlock();
+    __atomic_store_n(&m->counters[counter], m->counters[counter] + value, __ATOMIC_RELAXED);
+}
+
+static inline void metricObserve(int hist, unsigned long long value) {
+    MetricsBlock* m = metricsBlock();
+    int b = value ? 64 - __builtin_clzll(value) : 0;
+    if (b >= METRIC_BUCKETS) b = METRIC_BUCKETS - 1;
+    __atomic_store_n(&m->buckets[hist][b], m->buckets[hist][b] + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&m->sums[hist], m->sums[hist] + value, __ATOMIC_RELAXED);
+}
+
+// Kept out of line so the unsampled path is just the tick test
+static __attribute__((noinline, cold)) long long metricClock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static __attribute__((noinline, cold)) void metricTimerEnd(int hist, long long start) {
+    metricObserve(hist, (unsigned long long)(metricClock() - start));
+}
+
+// Start time for a sampled op, 0 when this one isn't sampled
+static inline long long metricTimerStart(void) {
+    MetricsBlock* m = metricsBlock();
+    if (__builtin_expect((++m->sampleTick & METRIC_SAMPLE_MASK) != 0, 1)) return 0;
+    return metricClock();
+}
+
+static inline void metricTimerStop(int hist, long long start) {
+    if (__builtin_expect(start != 0, 0)) metricTimerEnd(hist, start);
+}
+
+#define METRIC_ADD(counter, value) metricAdd(counter, value)
+#define METRIC_OBSERVE(hist, value) metricObserve(hist, (unsigned long long)(value))
+#define METRIC_GAUGE(gauge, value) __atomic_store_n(&metricsGauges[gauge], (long long)(value), __ATOMIC_RELAXED)
+#define METRIC_TIMER_START(name) long long name = metricTimerStart()
+#define METRIC_TIMER_STOP(hist, name) metricTimerStop(hist, name)
+#else
+// sizeof keeps the arguments "used" without evaluating them
+#define METRIC_ADD(counter, value) ((void)sizeof(value))
+#define METRIC_OBSERVE(hist, value) ((void)sizeof(value))
+#define METRIC_GAUGE(gauge, value) ((void)sizeof(value))
+#define METRIC_TIMER_START(name) ((void)0)
+#define METRIC_TIMER_STOP(hist, name) ((void)0)
+#endif
+
+// Metrics export (Prometheus text format). Empty when metrics aren't built in
+#if PILLPILOT_METRICS
+static void writeMetricHistogram(FILE* fp, const char* name, const char* help, const char* label,
+                                 const unsigned long long* buckets, unsigned long long sum, double scale, int header) {
+    if (header) fprintf(fp, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+    int last = 0;
+    for (int b = 0; b < METRIC_BUCKETS; b++) {
+        if (buckets[b]) last = b;
+    }
+    unsigned long long total = 0;
+    for (int b = 0; b <= last; b++) {
+        total += buckets[b];
+        double bound = b == 0 ? 0 : (double)((1ULL << b) - 1) * scale;// largest value bucket b holds
+        fprintf(fp, "%s_bucket{%s%sle=\"%g\"} %llu\n", name, label, *label ? "," : "", bound, total);
+    }
+    fprintf(fp, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, label, *label ? "," : "", total);
+    fprintf(fp, "%s_sum%s%s%s %g\n", name, *label ? "{" : "", label, *label ? "}" : "", (double)sum * scale);
+    fprintf(fp, "%s_count%s%s%s %llu\n", name, *label ? "{" : "", label, *label ? "}" : "", total);
+}
+
+// Add up every thread's block and write it all out
+void writeMetrics(FILE* fp) {
+    static const char* counterNames[MET_COUNTER_COUNT][2] = {
+        {"pillpilot_map_resizes_total", "HashMap rebuilds (growing or clearing tombstones)"},
+        {"pillpilot_history_appends_total", "History events recorded"},
+        {"pillpilot_history_blocks_allocated_total", "History blocks taken from malloc"},
+        {"pillpilot_history_blocks_reused_total", "History blocks reused from the spare list"},
+    };
+    static const char* gaugeNames[MET_GAUGE_COUNT][2] = {
+        {"pillpilot_map_entries", "Live medicines in the HashMap"},
+        {"pillpilot_map_tombstones", "Deleted HashMap slots still in probe chains"},
+        {"pillpilot_map_capacity", "HashMap slots"},
+        {"pillpilot_heap_size", "Medicines in the reminder queue"},
+        {"pillpilot_history_entries", "History events held in memory"},
+    };
+    unsigned long long counters[MET_COUNTER_COUNT] = {0};
+    unsigned long long buckets[MET_HIST_COUNT][METRIC_BUCKETS];
+    unsigned long long sums[MET_HIST_COUNT] = {0};
+    memset(buckets, 0, sizeof(buckets));
+    for (MetricsBlock* m = __atomic_load_n(&metricsBlocks, __ATOMIC_ACQUIRE); m; m = m->next) {
+        for (int c = 0; c < MET_COUNTER_COUNT; c++) counters[c] += __atomic_load_n(&m->counters[c], __ATOMIC_RELAXED);
+        for (int h = 0; h < MET_HIST_COUNT; h++) {
+            sums[h] += __atomic_load_n(&m->sums[h], __ATOMIC_RELAXED);
+            for (int b = 0; b < METRIC_BUCKETS; b++) buckets[h][b] += __atomic_load_n(&m->buckets[h][b], __ATOMIC_RELAXED);
+        }
+    }
+    for (int c = 0; c < MET_COUNTER_COUNT; c++) {
+        fprintf(fp, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", counterNames[c][0], counterNames[c][1],
+                counterNames[c][0], counterNames[c][0], counters[c]);
+    }
+    for (int g = 0; g < MET_GAUGE_COUNT; g++) {
+        fprintf(fp, "# HELP %s %s\n# TYPE %s gauge\n%s %lld\n", gaugeNames[g][0], gaugeNames[g][1], gaugeNames[g][0],
+                gaugeNames[g][0], __atomic_load_n(&metricsGauges[g], __ATOMIC_RELAXED));
+    }
+    long long capacity = __atomic_load_n(&metricsGauges[MET_MAP_CAPACITY], __ATOMIC_RELAXED);
+    double load = capacity > 0 ? (double)(__atomic_load_n(&metricsGauges[MET_MAP_ENTRIES], __ATOMIC_RELAXED) +
+                                          __atomic_load_n(&metricsGauges[MET_MAP_TOMBSTONES], __ATOMIC_RELAXED)) /
+                                     capacity
+                               : 0;
+    fprintf(fp, "# HELP pillpilot_map_load_ratio Used HashMap slots (live + tombstones) / capacity\n"
+                "# TYPE pillpilot_map_load_ratio gauge\npillpilot_map_load_ratio %g\n", load);
+    const char* probeHelp = "Slots looked at per HashMap operation";
+    writeMetricHistogram(fp, "pillpilot_map_probe_length", probeHelp, "op=\"lookup\"", buckets[MET_MAP_LOOKUP_PROBES],
+                         sums[MET_MAP_LOOKUP_PROBES], 1, 1);
+    writeMetricHistogram(fp, "pillpilot_map_probe_length", probeHelp, "op=\"insert\"", buckets[MET_MAP_INSERT_PROBES],
+                         sums[MET_MAP_INSERT_PROBES], 1, 0);
+    writeMetricHistogram(fp, "pillpilot_heap_sift_levels", "Levels a node moved per heap sift", "",
+                         buckets[MET_HEAP_SIFT_LEVELS], sums[MET_HEAP_SIFT_LEVELS], 1, 1);
+    const char* ops[4] = {"op=\"lookup\"", "op=\"insert\"", "op=\"enqueue\"", "op=\"history_append\""};
+    for (int i = 0; i < 4; i++) {
+        writeMetricHistogram(fp, "pillpilot_op_latency_seconds", "Sampled latency of hot-path operations (1 in 64)",
+                             ops[i], buckets[MET_LOOKUP_NS + i], sums[MET_LOOKUP_NS + i], 1e-9, i == 0);
+    }
+}
+
+// Events recorded in one histogram so far, all threads
+unsigned long long metricCount(int hist) {
+    unsigned long long total = 0;
+    for (MetricsBlock* m = __atomic_load_n(&metricsBlocks, __ATOMIC_ACQUIRE); m; m = m->next) {
+        for (int b = 0; b < METRIC_BUCKETS; b++) total += __atomic_load_n(&m->buckets[hist][b], __ATOMIC_RELAXED);
+    }
+    return total;
+}
+
+// Write to path via a temp file + rename, so a scraper never reads half a dump. Returns 1 on success
+int dumpMetrics(const char* path) {
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE* fp = fopen(tmp, "w");
+    if (!fp) return 0;
+    writeMetrics(fp);
+    int ok = fclose(fp) == 0 && rename(tmp, path) == 0;
+    if (!ok) remove(tmp);
+    return ok;
+}
+
+static void* metricsSignalThread(void* arg) {
+    const char* path = (const char*)arg;
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    int sig;
+    while (sigwait(&set, &sig) == 0) dumpMetrics(path);
+    return NULL;
+}
+
+// Dump to path on every SIGUSR1. Call before starting other threads: SIGUSR1 is blocked here
+// so every thread started later inherits that, and only the dump thread takes the signal
+int startMetricsExport(const char* path) {
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    pthread_t thread;
+    if (pthread_sigmask(SIG_BLOCK, &set, NULL) != 0 ||
+        pthread_create(&thread, NULL, metricsSignalThread, (void*)path) != 0) {
+        return 0;
+    }
+    pthread_detach(thread);
+    return 1;
+}
+#else
+static inline int dumpMetrics(const char* path) {
+    (void)path;
+    return 0;
+}
+
+static inline int startMetricsExport(const char* path) {
+    (void)path;
+    return 0;
+}
+#endif
+
+// Medicine Store - owns the medicine data, everything else refers to it by handle
+
+// Initialize empty store
+int initMedicineStore(MedicineStore* store) {
+    memset(store, 0, sizeof(*store));
+    store->capacity = TABLE_SIZE;
+    store->ids = (MedicineId*)malloc((size_t)store->capacity * sizeof(MedicineId));
+    store->priorities = (int*)malloc((size_t)store->capacity * sizeof(int));
+    store->flags = (unsigned char*)malloc((size_t)store->capacity);
+    store->text = (MedicineText*)malloc((size_t)store->capacity * sizeof(MedicineText));
+    store->rules = (RecurrenceRule*)malloc((size_t)store->capacity * sizeof(RecurrenceRule));
+    store->freeSlots = (int*)malloc((size_t)store->capacity * sizeof(int));
+    if (!store->ids || !store->priorities || !store->flags || !store->text || !store->rules || !store->freeSlots) {
+        printf("Memory allocation failed!\n");
+        return 0;
+    }
+    return 1;
+}
+
+// Release the store arrays
+void freeMedicineStore(MedicineStore* store) {
+    if (!store->borrowed) {// snapshot memory goes away with the mapping
+        free(store->ids);
+        free(store->priorities);
+        free(store->flags);
+        free(store->text);
+        free(store->rules);
+        free(store->freeSlots);
+    }
+    memset(store, 0, sizeof(*store));
+}
+
+// Copy an array out of a snapshot mapping onto the heap
+static void* copyOut(const void* src, size_t bytes) {
+    void* dst = malloc(bytes ? bytes : 1);
+    if (dst && bytes) memcpy(dst, src, bytes);
+    return dst;
+}
+
+// Move store arrays that live in a snapshot mapping onto the heap so realloc works on them
+static int detachMedicineStore(MedicineStore* store) {
+    size_t n = (size_t)store->capacity;
+    MedicineId* ids = (MedicineId*)copyOut(store->ids, n * sizeof(MedicineId));
+    int* priorities = (int*)copyOut(store->priorities, n * sizeof(int));
+    unsigned char* flags = (unsigned char*)copyOut(store->flags, n);
+    MedicineText* text = (MedicineText*)copyOut(store->text, n * sizeof(MedicineText));
+    RecurrenceRule* rules = (RecurrenceRule*)copyOut(store->rules, n * sizeof(RecurrenceRule));
+    int* freeSlots = (int*)copyOut(store->freeSlots, n * sizeof(int));
+    if (!ids || !priorities || !flags || !text || !rules || !freeSlots) {
+        free(ids); free(priorities); free(flags); free(text); free(rules); free(freeSlots);
+        printf("Memory allocation failed!\n");
+        return 0;
+    }
+    store->ids = ids;
+    store->priorities = priorities;
+    store->flags = flags;
+    store->text = text;
+    store->rules = rules;
+    store->freeSlots = freeSlots;
+    store->borrowed = 0;
+    return 1;
+}
+
+// Grow every array together so handles stay valid in all of them
+static int growMedicineStore(MedicineStore* store) {
+    if (store->borrowed && !detachMedicineStore(store)) return 0;
+    int newCapacity = store->capacity ? store->capacity * 2 : TABLE_SIZE;
+    MedicineId* ids = (MedicineId*)realloc(store->ids, (size_t)newCapacity * sizeof(MedicineId));
+    if (ids) store->ids = ids;
+    int* priorities = (int*)realloc(store->priorities, (size_t)newCapacity * sizeof(int));
+    if (priorities) store->priorities = priorities;
+    unsigned char* flags = (unsigned char*)realloc(store->flags, (size_t)newCapacity);
+    if (flags) store->flags = flags;
+    MedicineText* text = (MedicineText*)realloc(store->text, (size_t)newCapacity * sizeof(MedicineText));
+    if (text) store->text = text;
+    RecurrenceRule* rules = (RecurrenceRule*)realloc(store->rules, (size_t)newCapacity * sizeof(RecurrenceRule));
+    if (rules) store->rules = rules;
+    int* freeSlots = (int*)realloc(store->freeSlots, (size_t)newCapacity * sizeof(int));
+    if (freeSlots) store->freeSlots = freeSlots;
+    if (!ids || !priorities || !flags || !text || !rules || !freeSlots) {
+        printf("Memory allocation failed!\n");
+        return 0;// the arrays that did grow are still fine at the old capacity
+    }
+    store->capacity = newCapacity;
+    return 1;
+}
+
+// Once a day at one time - what every medicine starts with
+void dailyRule(RecurrenceRule* rule, int minute) {
+    memset(rule, 0, sizeof(*rule));
+    rule->times[0] = (int16_t)minute;
+    rule->timeCount = 1;
+    rule->weekdays = EVERY_DAY;
+}
+
+// Add a medicine to the store, returns its handle or -1.
+// It's taken daily at med->priority until the caller sets another rule
+int addToStore(MedicineStore* store, const Medicine* med) {
+    int handle;
+    if (store->freeCount > 0) {
+        handle = store->freeSlots[--store->freeCount];// reuse a deleted medicine's slot
+    } else {
+        if (store->used == store->capacity && !growMedicineStore(store)) {
+            return -1;
+        }
+        handle = store->used++;
+    }
+    store->ids[handle] = med->id;
+    store->priorities[handle] = med->priority;
+    store->flags[handle] = MED_LIVE;
+    MedicineText* text = &store->text[handle];
+    memcpy(text->name, med->name, MAX_NAME);
+    memcpy(text->dosage, med->dosage, MAX_DOSAGE);
+    memcpy(text->time, med->time, sizeof(text->time));
+    memcpy(text->instructions, med->instructions, MAX_INSTRUCTIONS);
+    dailyRule(&store->rules[handle], med->priority);
+    store->count++;
+    return handle;
+}
+
+// Mark a medicine as deleted; its slot goes on the free list
+// (take it out of the HashMap and reminder queue first, they hold the handle)
+void removeFromStore(MedicineStore* store, int handle) {
+    if (store->flags[handle] & MED_LIVE) {
+        store->flags[handle] &= ~MED_LIVE;
+        store->freeSlots[store->freeCount++] = handle;
+        store->count--;
+    }
+}
+
+// Copy a medicine back out of the store into a plain struct
+void getMedicine(MedicineStore* store, int handle, Medicine* out) {
+    MedicineText* text = &store->text[handle];
+    out->id = store->ids[handle];
+    out->priority = store->priorities[handle];
+    memcpy(out->name, text->name, MAX_NAME);
+    memcpy(out->dosage, text->dosage, MAX_DOSAGE);
+    memcpy(out->time, text->time, sizeof(out->time));
+    memcpy(out->instructions, text->instructions, MAX_INSTRUCTIONS);
+}
+
+//HashMap -Hash tables give us fast lookup; way better than searching arrays!
+//Hash function -converts medicine ID to array index
+int hashFunction(MedicineId id, int capacity) {
+    //murmur3 64-bit finalizer - mixes all bits so sequential / clustered ids spread out
+    unsigned long long h = (unsigned long long)id;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return (int)(h & (unsigned long long)(capacity - 1));// capacity is a power of two
+}
+
+// Allocate a table of the given capacity with every slot free
+static int allocTable(HashMap* map, int capacity) {
+    HashNode* table = (HashNode*)malloc((size_t)capacity * sizeof(HashNode));
+    map->borrowed = 0;
+    if (!table) {
+        printf("Memory allocation failed!\n");
+        return 0;
+    }
+    for (int i = 0; i < capacity; i++) {
+        table[i].handle = HANDLE_EMPTY;// Mark slot as free
+    }
+    map->table = table;
+    map->capacity = capacity;
+    map->count = 0;
+    map->tombstones = 0;
+    return 1;
+}
+
+// Initialize empty HashMap
+int initHashMap(HashMap* map) {
+    return allocTable(map, INITIAL_CAPACITY);
+}
+
+// Release the table memory
+void freeHashMap(HashMap* map) {
+    if (!map->borrowed) free(map->table);
+    map->borrowed = 0;
+    map->table = NULL;
+    map->capacity = 0;
+    map->count = 0;
+    map->tombstones = 0;
+}
+
+// Rehash every live entry into a new table; tombstones are dropped on the way
+static int resizeHashMap(HashMap* map, int newCapacity) {
+    HashNode* oldTable = map->table;
+    int oldCapacity = map->capacity;
+    int oldBorrowed = map->borrowed;
+    if (!allocTable(map, newCapacity)) {
+        map->table = oldTable;// keep the old table usable
+        map->borrowed = oldBorrowed;
+        return 0;
+    }
+    int mask = newCapacity - 1;
+    for (int i = 0; i < oldCapacity; i++) {
+        if (oldTable[i].handle < 0) continue;
+        // no tombstones or duplicates in a fresh table, so the first free slot is ours
+        int index = hashFunction(oldTable[i].id, newCapacity);
+        while (map->table[index].handle != HANDLE_EMPTY) {
+            index = (index + 1) & mask;
+        }
+        map->table[index] = oldTable[i];
+        map->count++;
+    }
+    if (!oldBorrowed) free(oldTable);
+    return 1;
+}
+
+// insertMedicine without the latency sample, so every return path gets timed by the caller
+static int putMedicine(HashMap* map, MedicineId id, int handle) {
+    // Keep live + deleted slots under MAX_LOAD_PERCENT so probe chains stay short
+    if ((long long)(map->count + map->tombstones + 1) * 100 > (long long)map->capacity * MAX_LOAD_PERCENT) {
+        // Mostly tombstones? rehash in place. Otherwise double the table
+        int newCapacity = map->capacity;
+        if ((long long)(map->count + 1) * 200 > (long long)map->capacity * MAX_LOAD_PERCENT) {
+            if (map->capacity > (1 << 29)) {
+                printf("HashMap is full!\n");
+                return 0;
+            }
+            newCapacity = map->capacity * 2;
+        }
+        if (!resizeHashMap(map, newCapacity)) return 0;
+        METRIC_ADD(MET_MAP_RESIZES, 1);
+        METRIC_GAUGE(MET_MAP_CAPACITY, map->capacity);
+    }
+    int mask = map->capacity - 1;
+    int home = hashFunction(id, map->capacity);// Get initial index
+    int index = home;
+    int firstDeleted = -1;// first tombstone seen, reused if the ID isn't already here
+
+    // Linear probing: walk the chain until an empty slot ends it
+    while (map->table[index].handle != HANDLE_EMPTY) {
+        if (map->table[index].handle >= 0) {
+            if (map->table[index].id == id) {
+                printf("Medicine ID %lld already exists!\n", id);
+                return 0;
+            }
+        } else if (firstDeleted < 0) {
+            firstDeleted = index;
+        }
+        index = (index + 1) & mask;//move to next index
+    }
+    METRIC_OBSERVE(MET_MAP_INSERT_PROBES, ((index - home) & mask) + 1);
+    if (firstDeleted >= 0) {
+        index = firstDeleted;
+        map->tombstones--;
+    }
+    // Found free slot, insert medicine
+    map->table[index].id = id;
+    map->table[index].handle = handle;// Mark slot as occupied
+    map->count++;
+    METRIC_GAUGE(MET_MAP_ENTRIES, map->count);
+    METRIC_GAUGE(MET_MAP_TOMBSTONES, map->tombstones);
+    METRIC_GAUGE(MET_MAP_CAPACITY, map->capacity);
+    //printf("Inserted medicine ID %d at index %d\n", id, index); // Debugging line
+    return 1;// Insertion successful
+}
+
+// Insert ID -> handle into HashMap (fails if the ID is already there)
+int insertMedicine(HashMap* map, MedicineId id, int handle) {
+    METRIC_TIMER_START(timer);
+    int inserted = putMedicine(map, id, handle);
+    METRIC_TIMER_STOP(MET_INSERT_NS, timer);// failed inserts (duplicate ID, full) are sampled too
+    return inserted;
+}
+
+// Find the slot holding this ID, or -1 if it isn't in the map
+static int findSlot(HashMap* map, MedicineId id) {
+    int mask = map->capacity - 1;
+    int home = hashFunction(id, map->capacity);// Get initial index
+    int index = home;
+    // Linear probing; tombstones don't end the chain, empty slots do
+    // (load factor < 1, so there is always an empty slot to stop at)
+    while (map->table[index].handle != HANDLE_EMPTY) {
+        if (map->table[index].id == id && map->table[index].handle >= 0) {
+            METRIC_OBSERVE(MET_MAP_LOOKUP_PROBES, ((index - home) & mask) + 1);
+            return index;
+        }
+        index = (index + 1) & mask;//move to next index
+    }
+    METRIC_OBSERVE(MET_MAP_LOOKUP_PROBES, ((index - home) & mask) + 1);
+    return -1;
+}
+
+// Search in HashMap - return the medicine's store handle or -1 if not found
+int searchMedicine(HashMap* map, MedicineId id) {
+    METRIC_TIMER_START(timer);
+    int index = findSlot(map, id);
+    METRIC_TIMER_STOP(MET_LOOKUP_NS, timer);
+    if (index < 0) {
+        return -1;// Not found
+    }
+    return map->table[index].handle;// found the medicine!
+    //printf("Medicine ID %d not found in HashMap\n", id); //Debugging line
+}
+
+// Delete from HashMap by ID, returns the handle it pointed at or -1 if not found
+int deleteMedicine(HashMap* map, MedicineId id) {
+    int index = findSlot(map, id);
+    if (index < 0) {
+        return -1;//Not found
+    }
+    int handle = map->table[index].handle;
+    // leave a tombstone so entries further along the probe chain stay reachable
+    map->table[index].handle = HANDLE_DELETED;
+    map->count--;
+    map->tombstones++;
+    METRIC_GAUGE(MET_MAP_ENTRIES, map->count);
+    METRIC_GAUGE(MET_MAP_TOMBSTONES, map->tombstones);
+    return handle;// Deletion successful
+}
+
+// REPORT WRITER - long listings (all medicines, the schedule, history) used to be one printf
+// per row plus a localtime + strftime per history row. Rows are now formatted straight into
+// big reusable buffers with small copy/pad helpers, and a full buffer is handed to a background
+// thread that writes it (and anything else queued) with one writev while the next one fills.
+// Timestamps go through a cached local day, so a row only works out its hh:mm:ss. The first
+// rows are handed over early so a huge listing starts showing at once, and on a terminal the
+// listing stops after each screenful (Enter for more, q to stop)
+#define REPORT_BUFFER_SIZE (256 * 1024)
+#define REPORT_BUFFERS 4 //one being filled, the rest queued or being written
+#define REPORT_FIRST_ROWS 64 //rows that go out before the first buffer is full
+#define REPORT_MAX_FIELD MAX_INSTRUCTIONS //longest text column we print
+#define REPORT_MAX_ROW 512 //room reserved per row (4 text columns + numbers + time)
+
+typedef struct ReportDay {
+    time_t start, end;// [start, end) is one local day with no clock change; empty if start == end
+    struct tm midnight;// broken-down time at start
+} ReportDay;
+
+typedef struct ReportWriter {
+    int fd;
+    char* buffers[REPORT_BUFFERS];// one allocation, REPORT_BUFFER_SIZE each
+    size_t lengths[REPORT_BUFFERS];
+    int head;// oldest queued buffer (under lock)
+    int queued;// buffers handed to the thread (under lock)
+    int filling;// buffer rows are formatted into - the one after the queued ones, only the formatter uses it
+    size_t used;// bytes in it
+    pthread_mutex_t lock;
+    pthread_cond_t ready;// buffers queued (or stop)
+    pthread_cond_t drained;// buffers written
+    pthread_t thread;
+    int threadRunning;// started at the first hand-over, so short listings never start it
+    int stop;
+    int failed;// a write failed; the rest of the output is dropped
+    int pageRows;// rows per screen, 0 = no paging
+    int rowsOnPage;
+    int quit;// user pressed q at a page break
+    long long rows;
+    long long startNs, firstOutNs;// when the report started / first bytes were written
+    ReportDay day;
+} ReportWriter;
+
+static long long reportClock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// writev every buffer in iov, retrying short writes
+static int writeBuffers(int fd, struct iovec* iov, int count) {
+    while (count > 0) {
+        ssize_t n = writev(fd, iov, count);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        while (count > 0 && (size_t)n >= iov->iov_len) {
+            n -= (ssize_t)iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= (size_t)n;
+        }
+    }
+    return 1;
+}
+
+// Writer thread: takes everything queued, writes it with one writev, hands the buffers back
+static void* reportThread(void* arg) {
+    ReportWriter* w = (ReportWriter*)arg;
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        while (w->queued == 0 && !w->stop) pthread_cond_wait(&w->ready, &w->lock);
+        if (w->queued == 0) break;// stopping and nothing left
+        int count = w->queued;
+        struct iovec iov[REPORT_BUFFERS];
+        for (int i = 0; i < count; i++) {
+            int b = (w->head + i) % REPORT_BUFFERS;
+            iov[i].iov_base = w->buffers[b];
+            iov[i].iov_len = w->lengths[b];
+        }
+        int failed = w->failed;
+        pthread_mutex_unlock(&w->lock);
+        // the queued buffers are ours until we move head past them
+        int ok = failed || writeBuffers(w->fd, iov, count);
+        long long now = reportClock();
+        pthread_mutex_lock(&w->lock);
+        if (!ok) w->failed = 1;
+        if (!w->firstOutNs) w->firstOutNs = now;
+        w->head = (w->head + count) % REPORT_BUFFERS;
+        w->queued -= count;
+        pthread_cond_signal(&w->drained);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+// pageRows 0 streams everything; returns 0 if out of memory
+int openReport(ReportWriter* w, int fd, int pageRows) {
+    memset(w, 0, sizeof(*w));
+    char* memory = (char*)malloc((size_t)REPORT_BUFFERS * REPORT_BUFFER_SIZE);
+    if (!memory) return 0;
+    for (int i = 0; i < REPORT_BUFFERS; i++) w->buffers[i] = memory + (size_t)i * REPORT_BUFFER_SIZE;
+    w->fd = fd;
+    w->pageRows = pageRows;
+    w->startNs = reportClock();
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->ready, NULL);
+    pthread_cond_init(&w->drained, NULL);
+    return 1;
+}
+
+// Hand the buffer being filled to the writer thread and move on to a free one
+static void reportHandOver(ReportWriter* w) {
+    if (w->used == 0) return;
+    if (!w->threadRunning) {
+        if (pthread_create(&w->thread, NULL, reportThread, w) != 0) {
+            // no thread: write it ourselves
+            struct iovec iov = {w->buffers[w->filling], w->used};
+            if (!w->failed && !writeBuffers(w->fd, &iov, 1)) w->failed = 1;
+            if (!w->firstOutNs) w->firstOutNs = reportClock();
+            w->used = 0;
+            return;
+        }
+        w->threadRunning = 1;
+    }
+    pthread_mutex_lock(&w->lock);
+    w->lengths[w->filling] = w->used;
+    w->queued++;
+    pthread_cond_signal(&w->ready);
+    while (w->queued == REPORT_BUFFERS) pthread_cond_wait(&w->drained, &w->lock);
+    pthread_mutex_unlock(&w->lock);
+    w->filling = (w->filling + 1) % REPORT_BUFFERS;
+    w->used = 0;
+}
+
+// Wait until everything so far is written
+static void reportDrain(ReportWriter* w) {
+    reportHandOver(w);
+    if (!w->threadRunning) return;
+    pthread_mutex_lock(&w->lock);
+    while (w->queued > 0) pthread_cond_wait(&w->drained, &w->lock);
+    pthread_mutex_unlock(&w->lock);
+}
+
+// Write out the rest, stop the thread, free the buffers
+void closeReport(ReportWriter* w) {
+    reportDrain(w);
+    if (w->threadRunning) {
+        pthread_mutex_lock(&w->lock);
+        w->stop = 1;
+        pthread_cond_signal(&w->ready);
+        pthread_mutex_unlock(&w->lock);
+        pthread_join(w->thread, NULL);
+    }
+    pthread_cond_destroy(&w->drained);
+    pthread_cond_destroy(&w->ready);
+    pthread_mutex_destroy(&w->lock);
+    free(w->buffers[0]);
+}
+
+// Where the next `bytes` bytes go (at most REPORT_MAX_ROW)
+static inline char* reportReserve(ReportWriter* w, size_t bytes) {
+    if (w->used + bytes > REPORT_BUFFER_SIZE) reportHandOver(w);
+    return w->buffers[w->filling] + w->used;
+}
+
+// Finish a row that ends at p: hands over early for the first rows, and pauses at a page break
+static void reportEndRow(ReportWriter* w, char* p) {
+    w->used = (size_t)(p - w->buffers[w->filling]);
+    w->rows++;
+    if (w->rows == REPORT_FIRST_ROWS) reportHandOver(w);
+    if (w->pageRows > 0 && ++w->rowsOnPage == w->pageRows) {
+        w->rowsOnPage = 0;
+        reportDrain(w);
+        static const char prompt[] = "-- more: Enter for the next page, q to stop -- ";
+        struct iovec iov = {(void*)prompt, sizeof(prompt) - 1};
+        char answer[16];
+        if (!writeBuffers(w->fd, &iov, 1) || !fgets(answer, sizeof(answer), stdin) || answer[0] == 'q' || answer[0] == 'Q') {
+            w->quit = 1;
+        }
+    }
+}
+
+// printf-style, for headers and totals
+static void reportf(ReportWriter* w, const char* format, ...) {
+    char* p = reportReserve(w, REPORT_MAX_ROW);
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(p, REPORT_MAX_ROW, format, args);
+    va_end(args);
+    if (n > 0) w->used += (size_t)(n < REPORT_MAX_ROW ? n : REPORT_MAX_ROW - 1);
+}
+
+// Same as %-*s
+static inline char* putPadded(char* p, const char* text, int width) {
+    size_t length = strlen(text);
+    if (length > REPORT_MAX_FIELD) length = REPORT_MAX_FIELD;
+    memcpy(p, text, length);
+    p += length;
+    if ((int)length < width) {
+        memset(p, ' ', (size_t)width - length);
+        p += width - (int)length;
+    }
+    return p;
+}
+
+// Same as %-*lld
+static inline char* putNumber(char* p, long long value, int width) {
+    char digits[24];
+    int n = 0;
+    unsigned long long v = value < 0 ? 0ULL - (unsigned long long)value : (unsigned long long)value;
+    do {
+        digits[n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    char* start = p;
+    if (value < 0) *p++ = '-';
+    while (n > 0) *p++ = digits[--n];
+    while (p - start < width) *p++ = ' ';
+    return p;
+}
+
+static inline char* putTwoDigits(char* p, int value) {
+    p[0] = (char)('0' + value / 10);
+    p[1] = (char)('0' + value % 10);
+    return p + 2;
+}
+
+// Broken-down local time for t. Rows mostly fall on the day of the one before, so that day is
+// kept and only the seconds since its midnight are split up. A day with a clock change in it
+// isn't cached (its rows pay for localtime_r as before)
+static void reportLocalTime(ReportWriter* w, time_t t, struct tm* out) {
+    ReportDay* day = &w->day;
+    if (t < day->start || t >= day->end) {
+        localtime_r(&t, out);
+        day->start = t - (out->tm_hour * 3600 + out->tm_min * 60 + out->tm_sec);
+        day->end = day->start + 86400;
+        struct tm last;
+        localtime_r(&day->start, &day->midnight);
+        time_t lastSecond = day->end - 1;
+        localtime_r(&lastSecond, &last);
+        if (day->midnight.tm_hour != 0 || day->midnight.tm_min != 0 || day->midnight.tm_sec != 0 ||
+            day->midnight.tm_yday != out->tm_yday || last.tm_yday != out->tm_yday ||
+            last.tm_hour != 23 || last.tm_min != 59 || last.tm_sec != 59) {
+            day->start = day->end = 0;
+        }
+        return;
+    }
+    int seconds = (int)(t - day->start);
+    *out = day->midnight;
+    out->tm_hour = seconds / 3600;
+    out->tm_min = seconds / 60 % 60;
+    out->tm_sec = seconds % 60;
+}
+
+// Same as strftime "%Y-%m-%d %H:%M:%S"
+static char* putTimestamp(ReportWriter* w, char* p, time_t t) {
+    struct tm tm;
+    reportLocalTime(w, t, &tm);
+    p = putNumber(p, tm.tm_year + 1900, 0);
+    *p++ = '-';
+    p = putTwoDigits(p, tm.tm_mon + 1);
+    *p++ = '-';
+    p = putTwoDigits(p, tm.tm_mday);
+    *p++ = ' ';
+    p = putTwoDigits(p, tm.tm_hour);
+    *p++ = ':';
+    p = putTwoDigits(p, tm.tm_min);
+    *p++ = ':';
+    return putTwoDigits(p, tm.tm_sec);
+}
+
+// Same as strftime "%a %H:%M" in the C locale
+static char* putWeekdayTime(ReportWriter* w, char* p, time_t t) {
+    static const char names[7][4] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+    struct tm tm;
+    reportLocalTime(w, t, &tm);
+    memcpy(p, names[tm.tm_wday], 3);
+    p[3] = ' ';
+    p = putTwoDigits(p + 4, tm.tm_hour);
+    *p++ = ':';
+    return putTwoDigits(p, tm.tm_min);
+}
+
+// A report on stdout. Pages when someone is reading it on a terminal; a pipe or file gets
+// everything in one go. Anything printf'd before has to go out first
+int openTerminalReport(ReportWriter* w) {
+    fflush(stdout);
+    int pageRows = 0;
+    struct winsize size;
+    if (isatty(STDIN_FILENO) && isatty(STDOUT_FILENO)) {
+        pageRows = ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_row > 4 ? size.ws_row - 2 : 22;
+    }
+    return openReport(w, STDOUT_FILENO, pageRows);
+}
+
+// All meds as a report
+void writeAllMedicines(ReportWriter* w, HashMap* map, MedicineStore* store) {
+    reportf(w, "\n=== ALL MEDICINES ===\n");
+    reportf(w, "%-5s %-20s %-10s %-6s %-30s\n", "ID", "Name", "Dosage", "Time", "Instructions");
+    reportf(w, "--------------------------------------------------------------------------------\n");
+    // Walk the store's dense arrays instead of the sparse hash table
+    for (int h = 0; h < store->used && !w->quit; h++) {
+        if (store->flags[h] & MED_LIVE) {
+            MedicineText* t = &store->text[h];// Get medicine text
+            char* p = reportReserve(w, REPORT_MAX_ROW);// "%-5lld %-20s %-10s %-6s %-30s\n"
+            p = putNumber(p, store->ids[h], 5);
+            *p++ = ' ';
+            p = putPadded(p, t->name, 20);
+            *p++ = ' ';
+            p = putPadded(p, t->dosage, 10);
+            *p++ = ' ';
+            p = putPadded(p, t->time, 6);
+            *p++ = ' ';
+            p = putPadded(p, t->instructions, 30);
+            *p++ = '\n';
+            reportEndRow(w, p);
+        }
+    }
+    reportf(w, "\nTotal Medicines: %d\n", map->count);
+}
+
+// Display all meds
+void displayAllMedicines(HashMap* map, MedicineStore* store) {
+    ReportWriter w;
+    if (!openTerminalReport(&w)) {
+        printf("\n✗ Out of memory!\n");
+        return;
+    }
+    writeAllMedicines(&w, map, store);
+    closeReport(&w);
+    //printf("Displayed all medicines in HashMap\n"); //Debugg
+}
+
+// Concurrent HashMap - one ID index shared by many threads (nurse-station terminals).
+// Reads never block: a lookup only probes the current table. A slot's key is set once with
+// CAS and never changes after that (delete just tombstones the handle), so a probe chain can't
+// shift under a reader. Writers lock one stripe, picked by the key's hash, which keeps writers of
+// the same key in order; empty slots are still claimed with CAS since keys of other stripes
+// probe through the same slots. Growing (or clearing out tombstones) locks every stripe, builds
+// a new table and publishes it with one pointer store. Readers announce the epoch they started
+// in, and an old table is freed once no reader from its epoch is still around (RCU style)
+#define MAP_STRIPES 64
+#define MAP_MAX_READERS 64 //lock-free reader slots; registerMapReader gives -1 past this, and those lookups take the stripe lock
+#define MAP_INITIAL_CAPACITY (MAP_STRIPES * 16) //so each stripe's share of the load starts sensible
+#define CONCURRENT_EMPTY_KEY (-1) //IDs are never negative
+
+typedef struct ConcurrentTable {
+    HashNode* slots;// id = CONCURRENT_EMPTY_KEY until claimed, then fixed
+    int capacity;// power of two
+    unsigned long long retiredAt;// epoch it was replaced in
+    struct ConcurrentTable* retired;// next older table waiting to be freed
+} ConcurrentTable;
+
+typedef struct MapStripe {
+    pthread_mutex_t lock;
+    int claimed;// slots claimed by keys of this stripe (live + tombstones)
+    int live;
+} __attribute__((aligned(64))) MapStripe;// a cache line each, so stripes don't false-share
+
+typedef struct MapReaderSlot {
+    unsigned long long epoch;// epoch of the lookup in progress, 0 when idle
+} __attribute__((aligned(64))) MapReaderSlot;
+
+typedef struct ConcurrentHashMap {
+    ConcurrentTable* table;// current table (atomic pointer)
+    ConcurrentTable* retired;// replaced tables, newest first (stripe locks held to touch)
+    unsigned long long epoch;
+    int readers;// reader slots handed out
+    MapStripe stripes[MAP_STRIPES];
+    MapReaderSlot readerSlots[MAP_MAX_READERS];
+} ConcurrentHashMap;
+
+static ConcurrentTable* allocConcurrentTable(int capacity) {
+    ConcurrentTable* t = (ConcurrentTable*)malloc(sizeof(ConcurrentTable));
+    HashNode* slots = (HashNode*)malloc((size_t)capacity * sizeof(HashNode));
+    if (!t || !slots) {
+        free(t);
+        free(slots);
+        return NULL;
+    }
+    for (int i = 0; i < capacity; i++) {
+        slots[i].id = CONCURRENT_EMPTY_KEY;
+        slots[i].handle = HANDLE_EMPTY;
+    }
+    t->slots = slots;
+    t->capacity = capacity;
+    t->retiredAt = 0;
+    t->retired = NULL;
+    return t;
+}
+
+// Returns 1 on success (the map is large, allocate it on the heap)
+int initConcurrentHashMap(ConcurrentHashMap* map) {
+    memset(map, 0, sizeof(*map));
+    map->table = allocConcurrentTable(MAP_INITIAL_CAPACITY);
+    if (!map->table) {
+        printf("Memory allocation failed!\n");
+        return 0;
+    }
+    map->epoch = 1;
+    for (int s = 0; s < MAP_STRIPES; s++) pthread_mutex_init(&map->stripes[s].lock, NULL);
+    return 1;
+}
+
+// Free the map and any tables still waiting (no other thread may be using it)
+void freeConcurrentHashMap(ConcurrentHashMap* map) {
+    ConcurrentTable* t = map->table;
+    if (t) t->retired = map->retired;
+    while (t) {
+        ConcurrentTable* older = t->retired;
+        free(t->slots);
+        free(t);
+        t = older;
+    }
+    map->table = NULL;
+    map->retired = NULL;
+    for (int s = 0; s < MAP_STRIPES; s++) pthread_mutex_destroy(&map->stripes[s].lock);
+}
+
+// Each reading thread takes a slot once; returns its number, or -1 if they're all taken
+int registerMapReader(ConcurrentHashMap* map) {
+    int reader = __atomic_fetch_add(&map->readers, 1, __ATOMIC_RELAXED);
+    return reader < MAP_MAX_READERS ? reader : -1;
+}
+
+static int stripeOf(MedicineId id) {
+    return hashFunction(id, 1 << 30) >> 24 & (MAP_STRIPES - 1);// high bits, not the slot's low ones
+}
+
+// Lock-free lookup for a registered reader - returns the handle or -1. reader -1 (no slot was
+// left) still works: it holds the key's stripe lock instead, which keeps the table from being
+// replaced or freed under it
+int searchMedicineConcurrent(ConcurrentHashMap* map, int reader, MedicineId id) {
+    MapReaderSlot* me = NULL;
+    MapStripe* stripe = NULL;
+    if (reader >= 0 && reader < MAP_MAX_READERS) {
+        me = &map->readerSlots[reader];
+        // announce before looking at the table, so a writer can't free it under us
+        __atomic_store_n(&me->epoch, __atomic_load_n(&map->epoch, __ATOMIC_ACQUIRE), __ATOMIC_SEQ_CST);
+    } else {
+        stripe = &map->stripes[stripeOf(id)];
+        pthread_mutex_lock(&stripe->lock);
+    }
+    ConcurrentTable* t = __atomic_load_n(&map->table, __ATOMIC_SEQ_CST);
+    int mask = t->capacity - 1;
+    int index = hashFunction(id, t->capacity);
+    int handle = -1;
+    for (int probes = 0; probes < t->capacity; probes++) {
+        MedicineId key = __atomic_load_n(&t->slots[index].id, __ATOMIC_ACQUIRE);
+        if (key == CONCURRENT_EMPTY_KEY) break;// end of the chain
+        if (key == id) {
+            handle = __atomic_load_n(&t->slots[index].handle, __ATOMIC_ACQUIRE);
+            if (handle < 0) handle = -1;
+            break;
+        }
+        index = (index + 1) & mask;
+    }
+    if (me) __atomic_store_n(&me->epoch, 0, __ATOMIC_RELEASE);
+    else pthread_mutex_unlock(&stripe->lock);
+    return handle;
+}
+
+// Free replaced tables no reader can still be looking at. Caller holds every stripe lock
+static void reclaimTables(ConcurrentHashMap* map) {
+    unsigned long long oldest = __atomic_load_n(&map->epoch, __ATOMIC_SEQ_CST);
+    for (int r = 0; r < MAP_MAX_READERS; r++) {
+        unsigned long long e = __atomic_load_n(&map->readerSlots[r].epoch, __ATOMIC_SEQ_CST);
+        if (e != 0 && e < oldest) oldest = e;
+    }
+    ConcurrentTable** link = &map->retired;
+    while (*link) {
+        ConcurrentTable* t = *link;
+        if (t->retiredAt < oldest) {// every reader now started after it was replaced
+            *link = t->retired;
+            free(t->slots);
+            free(t);
+        } else {
+            link = &t->retired;
+        }
+    }
+}
+
+// Slot for id in t, claiming an empty one if claim is set; -1 if absent (or the table is full).
+// *claimedNew tells whether a new slot was taken. Caller holds the key's stripe lock
+static int claimSlot(ConcurrentTable* t, MedicineId id, int claim, int* claimedNew) {
+    int mask = t->capacity - 1;
+    int index = hashFunction(id, t->capacity);
+    *claimedNew = 0;
+    for (int probes = 0; probes < t->capacity; probes++) {
+        MedicineId key = __atomic_load_n(&t->slots[index].id, __ATOMIC_ACQUIRE);
+        if (key == CONCURRENT_EMPTY_KEY) {
+            if (!claim) return -1;
+            MedicineId expected = CONCURRENT_EMPTY_KEY;
+            if (__atomic_compare_exchange_n(&t->slots[index].id, &expected, id, 0, __ATOMIC_ACQ_REL,
+                                            __ATOMIC_ACQUIRE)) {
+                *claimedNew = 1;
+                return index;
+            }
+            key = expected;// a writer of another stripe got here first
+        }
+        if (key == id) return index;
+        index = (index + 1) & mask;
+    }
+    return -1;
+}
+
+// Rebuild with room to spare and publish the new table. Locks every stripe, so the caller
+// must not hold one. force rebuilds even if the table doesn't look full overall
+static int growConcurrentHashMap(ConcurrentHashMap* map, int force) {
+    for (int s = 0; s < MAP_STRIPES; s++) pthread_mutex_lock(&map->stripes[s].lock);
+    ConcurrentTable* old = map->table;
+    int live = 0, claimed = 0;
+    for (int s = 0; s < MAP_STRIPES; s++) {
+        live += map->stripes[s].live;
+        claimed += map->stripes[s].claimed;
+    }
+    int ok = 1;
+    // one stripe running ahead of the rest isn't enough on its own
+    if (force || (long long)claimed * 100 >= (long long)old->capacity * MAX_LOAD_PERCENT / 2) {
+        int newCapacity = old->capacity;
+        while ((long long)live * 100 >= (long long)newCapacity * MAX_LOAD_PERCENT / 2) newCapacity *= 2;
+        ConcurrentTable* t = allocConcurrentTable(newCapacity);
+        ok = t != NULL;
+        if (ok) {
+            for (int s = 0; s < MAP_STRIPES; s++) map->stripes[s].claimed = 0;
+            for (int i = 0; i < old->capacity; i++) {// only live entries move, tombstones are dropped
+                if (old->slots[i].handle < 0) continue;
+                int index = hashFunction(old->slots[i].id, newCapacity);
+                while (t->slots[index].id != CONCURRENT_EMPTY_KEY) index = (index + 1) & (newCapacity - 1);
+                t->slots[index] = old->slots[i];
+                map->stripes[stripeOf(old->slots[i].id)].claimed++;
+            }
+            __atomic_store_n(&map->table, t, __ATOMIC_SEQ_CST);
+            old->retiredAt = __atomic_fetch_add(&map->epoch, 1, __ATOMIC_SEQ_CST);
+            old->retired = map->retired;
+            map->retired = old;
+            reclaimTables(map);
+        }
+    }
+    for (int s = MAP_STRIPES - 1; s >= 0; s--) pthread_mutex_unlock(&map->stripes[s].lock);
+    return ok;
+}
+
+// Insert id -> handle. Returns 0 if the id is already there (or out of memory)
+int insertMedicineConcurrent(ConcurrentHashMap* map, MedicineId id, int handle) {
+    MapStripe* stripe = &map->stripes[stripeOf(id)];
+    int checked = 0;
+    while (1) {
+        pthread_mutex_lock(&stripe->lock);
+        ConcurrentTable* t = map->table;
+        // this stripe's share of the table is past the load limit: see if it's time to grow
+        int crowded = (long long)(stripe->claimed + 1) * MAP_STRIPES * 100 >=
+                      (long long)t->capacity * MAX_LOAD_PERCENT;
+        if (crowded && !checked) {
+            pthread_mutex_unlock(&stripe->lock);
+            if (!growConcurrentHashMap(map, 0)) break;
+            checked = 1;
+            continue;
+        }
+        int claimedNew;
+        int index = claimSlot(t, id, 1, &claimedNew);
+        if (index >= 0) {
+            int ok = 1;
+            if (claimedNew) {
+                stripe->claimed++;
+            } else if (t->slots[index].handle >= 0) {
+                ok = 0;// already there
+            }
+            if (ok) {// same-key writers share our stripe lock, a plain atomic store will do
+                __atomic_store_n(&t->slots[index].handle, handle, __ATOMIC_RELEASE);
+                stripe->live++;
+            }
+            pthread_mutex_unlock(&stripe->lock);
+            return ok;
+        }
+        pthread_mutex_unlock(&stripe->lock);
+        if (!growConcurrentHashMap(map, 1)) break;// table really is full
+    }
+    printf("Memory allocation failed!\n");
+    return 0;
+}
+
+// Delete by ID, returns the handle it pointed at or -1
+int deleteMedicineConcurrent(ConcurrentHashMap* map, MedicineId id) {
+    MapStripe* stripe = &map->stripes[stripeOf(id)];
+    pthread_mutex_lock(&stripe->lock);
+    ConcurrentTable* t = map->table;
+    int claimedNew;
+    int index = claimSlot(t, id, 0, &claimedNew);
+    int handle = -1;
+    if (index >= 0 && t->slots[index].handle >= 0) {
+        handle = t->slots[index].handle;
+        __atomic_store_n(&t->slots[index].handle, HANDLE_DELETED, __ATOMIC_RELEASE);
+        stripe->live--;
+    }
+    pthread_mutex_unlock(&stripe->lock);
+    return handle;
+}
+
+// Live entries (a snapshot while writers are running)
+int concurrentHashMapCount(ConcurrentHashMap* map) {
+    int live = 0;
+    for (int s = 0; s < MAP_STRIPES; s++) live += __atomic_load_n(&map->stripes[s].live, __ATOMIC_RELAXED);
+    return live;
+}
+
+// Name index - every live medicine's handle, sorted by name (case-insensitive, then exact
+// case, then handle so equal names still have a fixed order). Exact, case-insensitive and
+// prefix lookups are a binary search plus a walk over the matches: O(log n + k).
+// One insert / delete moves the tail of a 4-byte array (a memmove, ~1 MB at 500k names);
+// bulk loads append unsorted and sort once in buildNameIndex, like the heap's appendPQ
+typedef struct NameIndex {
+    int* handles;
+    int count;
+    int capacity;
+    int sortedCount;// handles[0..sortedCount) are in order, the rest came from appendNameIndex
+} NameIndex;
+
+enum { NAME_EXACT, NAME_ANY_CASE, NAME_PREFIX };// lookup modes (prefix is case-insensitive too)
+
+int initNameIndex(NameIndex* index) {
+    index->count = 0;
+    index->sortedCount = 0;
+    index->capacity = TABLE_SIZE;
+    index->handles = (int*)malloc((size_t)index->capacity * sizeof(int));
+    if (!index->handles) {
+        printf("Memory allocation failed!\n");
+        return 0;
+    }
+    return 1;
+}
+
+void freeNameIndex(NameIndex* index) {
+    free(index->handles);
+    index->handles = NULL;
+    index->count = index->sortedCount = index->capacity = 0;
+}
+
+static int compareIndexedNames(const MedicineStore* store, int a, int b) {
+    const char* nameA = store->text[a].name;
+    const char* nameB = store->text[b].name;
+    int c = strcasecmp(nameA, nameB);
+    if (c == 0) c = strcmp(nameA, nameB);
+    return c != 0 ? c : (a > b) - (a < b);
+}
+
+static int reserveNameIndex(NameIndex* index) {
+    if (index->count < index->capacity) return 1;
+    int* handles = (int*)realloc(index->handles, (size_t)index->capacity * 2 * sizeof(int));
+    if (!handles) {
+        printf("Memory allocation failed!\n");
+        return 0;
+    }
+    index->handles = handles;
+    index->capacity *= 2;
+    return 1;
+}
+
+// Index position of the first name >= name (case-insensitive) among the sorted handles
+static int nameLowerBound(const NameIndex* index, const MedicineStore* store, const char* name) {
+    int lo = 0, hi = index->sortedCount;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (strcasecmp(store->text[index->handles[mid]].name, name) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Position of a handle that's in the index (or where it would go)
+static int handlePosition(const NameIndex* index, const MedicineStore* store, int handle) {
+    int lo = 0, hi = index->sortedCount;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (compareIndexedNames(store, index->handles[mid], handle) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Add a medicine that's already in the store, O(log n) search + one memmove. Returns 1 on success
+int insertNameIndex(NameIndex* index, const MedicineStore* store, int handle) {
+    if (!reserveNameIndex(index)) return 0;
+    int at = handlePosition(index, store, handle);
+    // anything appended in bulk sits after the sorted part, so it moves along with the tail
+    memmove(&index->handles[at + 1], &index->handles[at], (size_t)(index->count - at) * sizeof(int));
+    index->handles[at] = handle;
+    index->count++;
+    index->sortedCount++;
+    return 1;
+}
+
+// Bulk add: unsorted until buildNameIndex. Returns 1 on success
+int appendNameIndex(NameIndex* index, int handle) {
+    if (!reserveNameIndex(index)) return 0;
+    index->handles[index->count++] = handle;
+    return 1;
+}
+
+typedef struct NameSortKey {
+    const char* name;
+    int handle;
+} NameSortKey;
+
+static int compareNameSortKeys(const void* a, const void* b) {
+    const NameSortKey* x = (const NameSortKey*)a;
+    const NameSortKey* y = (const NameSortKey*)b;
+    int c = strcasecmp(x->name, y->name);
+    if (c == 0) c = strcmp(x->name, y->name);
+    return c != 0 ? c : (x->handle > y->handle) - (x->handle < y->handle);
+}
+
+// Put appended handles in order: sort them (names pulled next to the handles so qsort doesn't
+// need the store), then merge with the sorted part. O(m log m + n). Returns 1 on success
+int buildNameIndex(NameIndex* index, const MedicineStore* store) {
+    int added = index->count - index->sortedCount;
+    if (added == 0) return 1;
+    NameSortKey* keys = (NameSortKey*)malloc((size_t)added * sizeof(NameSortKey));
+    int* merged = (int*)malloc((size_t)index->capacity * sizeof(int));
+    if (!keys || !merged) {
+        free(keys);
+        free(merged);
+        printf("Memory allocation failed!\n");
+        return 0;
+    }
+    for (int i = 0; i < added; i++) {
+        int handle = index->handles[index->sortedCount + i];
+        keys[i] = (NameSortKey){store->text[handle].name, handle};
+    }
+    qsort(keys, (size_t)added, sizeof(NameSortKey), compareNameSortKeys);
+    int a = 0, b = 0, out = 0;
+    while (a < index->sortedCount && b < added) {
+        if (compareIndexedNames(store, index->handles[a], keys[b].handle) < 0) merged[out++] = index->handles[a++];
+        else merged[out++] = keys[b++].handle;
+    }
+    while (a < index->sortedCount) merged[out++] = index->handles[a++];
+    while (b < added) merged[out++] = keys[b++].handle;
+    free(keys);
+    free(index->handles);
+    index->handles = merged;
+    index->sortedCount = index->count;
+    return 1;
+}
+
+// Index every live medicine in the store (after loading a snapshot)
+int rebuildNameIndex(NameIndex* index, const MedicineStore* store) {
+    index->count = index->sortedCount = 0;
+    for (int h = 0; h < store->used; h++) {
+        if ((store->flags[h] & MED_LIVE) && !appendNameIndex(index, h)) return 0;
+    }
+    return buildNameIndex(index, store);
+}
+
+// Take a medicine out; call before its name changes or its store slot is freed
+void removeNameIndex(NameIndex* index, const MedicineStore* store, int handle) {
+    int at = handlePosition(index, store, handle);
+    if (at >= index->sortedCount || index->handles[at] != handle) {// still in the unsorted tail?
+        at = index->sortedCount;
+        while (at < index->count && index->handles[at] != handle) at++;
+        if (at == index->count) return;
+    } else {
+        index->sortedCount--;
+    }
+    memmove(&index->handles[at], &index->handles[at + 1], (size_t)(index->count - at - 1) * sizeof(int));
+    index->count--;
+}
+
+// Medicines whose name matches text (mode NAME_EXACT / NAME_ANY_CASE / NAME_PREFIX), in name
+// order. Writes at most max handles into out and returns how many. Only sees the sorted part,
+// so run buildNameIndex after a bulk load
+int findMedicinesByName(const NameIndex* index, const MedicineStore* store, const char* text, int mode, int* out,
+                        int max) {
+    size_t length = strlen(text);
+    int found = 0;
+    for (int i = nameLowerBound(index, store, text); i < index->sortedCount && found < max; i++) {
+        const char* name = store->text[index->handles[i]].name;
+        if (mode == NAME_PREFIX ? strncasecmp(name, text, length) != 0 : strcasecmp(name, text) != 0) break;
+        if (mode == NAME_EXACT && strcmp(name, text) != 0) continue;
+        out[found++] = index->handles[i];
+    }
+    return found;
+}
+
+//Priority Queue - O(log n) insertion and deletion //to manage reminders efficiently; for scheduling tasks.
+// Indexed min-heap: pos[] maps a medicine handle to its heap slot, so we can
+// remove or reschedule a medicine in O(log n) without searching the heap
+
+// Initialize empty Priority Queue
+int initPriorityQueue(PriorityQueue* pq) {
+    pq->size = 0;
+    pq->borrowed = 0;
+    pq->capacity = TABLE_SIZE;
+    pq->posCapacity = TABLE_SIZE;
+    pq->heap = (PQNode*)malloc((size_t)pq->capacity * sizeof(PQNode));
+    pq->pos = (int*)malloc((size_t)pq->posCapacity * sizeof(int));
+    if (!pq->heap || !pq->pos) {
+        printf("Memory allocation failed!\n");
+        return 0;
+    }
+    for (int i = 0; i < pq->posCapacity; i++) pq->pos[i] = -1;// nothing queued yet
+    return 1;
+}
+
+// Release the heap array
+void freePriorityQueue(PriorityQueue* pq) {
+    if (!pq->borrowed) {
+        free(pq->heap);
+        free(pq->pos);
+    }
+    pq->borrowed = 0;
+    pq->heap = NULL;
+    pq->pos = NULL;
+    pq->size = 0;
+    pq->capacity = 0;
+    pq->posCapacity = 0;
+}
+
+// Heapify up - moves the node at index up to maintain heap property
+// The node is lifted out and parents slide down into the hole, one write per level
+// Depth of heap slot i (root = 0), for the sift metrics
+#define HEAP_LEVEL(i) (31 - __builtin_clz((unsigned)(i) + 1))
+
+void heapifyUp(PriorityQueue* pq, int index) {
+    PQNode moving = pq->heap[index];
+    int from = index;
+    while (index > 0) {
+        int parent = (index - 1) / 2;// Calculate parent index
+        // If moving element has smaller priority than parent, parent drops into the hole
+        if (moving.priority < pq->heap[parent].priority) {
+            pq->heap[index] = pq->heap[parent];
+            pq->pos[pq->heap[index].handle] = index;
+            index = parent;//move up to parent index
+        } else {
+            break;
+        }
+    }
+    pq->heap[index] = moving;
+    pq->pos[moving.handle] = index;
+    METRIC_OBSERVE(MET_HEAP_SIFT_LEVELS, HEAP_LEVEL(from) - HEAP_LEVEL(index));
+}
+
+// Heapify down: moves the element at index down to maintain heap property
+void heapifyDown(PriorityQueue* pq, int index) {
+    PQNode moving = pq->heap[index];
+    int from = index;
+    while (1) {// continue until the hole is in the right place
+        int smallest = 2 * index + 1;// Left child index
+        if (smallest >= pq->size) break;// no children
+        int right = smallest + 1;// Right child index
+        // Pick the smaller child
+        if (right < pq->size && pq->heap[right].priority < pq->heap[smallest].priority) {
+            smallest = right;
+        }
+        // If the child is smaller, it moves up into the hole and we continue
+        if (pq->heap[smallest].priority < moving.priority) {
+            pq->heap[index] = pq->heap[smallest];
+            pq->pos[pq->heap[index].handle] = index;
+            index = smallest;
+        } else {
+            break;//break if heap property is satisfied
+        }
+    }
+    pq->heap[index] = moving;
+    pq->pos[moving.handle] = index;
+    METRIC_OBSERVE(MET_HEAP_SIFT_LEVELS, HEAP_LEVEL(index) - HEAP_LEVEL(from));
+    //printf("Heapified down to index %d\n", index); //Debugg
+}
+
+// Move heap/pos out of a snapshot mapping onto the heap so they can grow
+static int detachPriorityQueue(PriorityQueue* pq) {
+    PQNode* heap = (PQNode*)copyOut(pq->heap, (size_t)pq->capacity * sizeof(PQNode));
+    int* pos = (int*)copyOut(pq->pos, (size_t)pq->posCapacity * sizeof(int));
+    if (!heap || !pos) {
+        free(heap);
+        free(pos);
+        return 0;
+    }
+    pq->heap = heap;
+    pq->pos = pos;
+    pq->borrowed = 0;
+    return 1;
+}
+
+// Make sure pos[] has room for this handle
+static int ensurePosCapacity(PriorityQueue* pq, int handle) {
+    if (handle < pq->posCapacity) return 1;
+    if (pq->borrowed && !detachPriorityQueue(pq)) return 0;
+    int newCapacity = pq->posCapacity ? pq->posCapacity * 2 : TABLE_SIZE;
+    while (newCapacity <= handle) newCapacity *= 2;
+    int* pos = (int*)realloc(pq->pos, (size_t)newCapacity * sizeof(int));
+    if (!pos) return 0;
+    for (int i = pq->posCapacity; i < newCapacity; i++) pos[i] = -1;
+    pq->pos = pos;
+    pq->posCapacity = newCapacity;
+    return 1;
+}
+
+// Change a queued medicine's priority - O(log n)
+int updatePriorityPQ(PriorityQueue* pq, int handle, int priority) {
+    if (handle < 0 || handle >= pq->posCapacity || pq->pos[handle] < 0) {
+        return 0;// not in the queue
+    }
+    int index = pq->pos[handle];
+    int oldPriority = pq->heap[index].priority;
+    pq->heap[index].priority = priority;
+    if (priority < oldPriority) {
+        heapifyUp(pq, index);
+    } else {
+        heapifyDown(pq, index);
+    }
+    return 1;
+}
+
+// Put a node at the end of the heap array without sifting it (caller restores the heap)
+static int appendNodePQ(PriorityQueue* pq, int handle, int priority) {
+    // Grow the heap array when it's full
+    if (pq->size >= pq->capacity) {
+        int newCapacity = pq->capacity ? pq->capacity * 2 : TABLE_SIZE;
+        PQNode* heap = NULL;
+        if (!pq->borrowed || detachPriorityQueue(pq)) {
+            heap = (PQNode*)realloc(pq->heap, (size_t)newCapacity * sizeof(PQNode));
+        }
+        if (!heap) {
+            printf("Priority Queue is full!\n");
+            return 0;
+        }
+        pq->heap = heap;
+        pq->capacity = newCapacity;
+    }
+    pq->heap[pq->size].priority = priority;
+    pq->heap[pq->size].handle = handle;
+    pq->pos[handle] = pq->size;
+    pq->size++;
+    return 1;
+}
+
+// Insert medicine handle into Priority Queue (already queued = reschedule)
+int enqueuePQ(PriorityQueue* pq, int handle, int priority) {
+    if (!ensurePosCapacity(pq, handle)) {
+        printf("Priority Queue is full!\n");
+        return 0;
+    }
+    if (pq->pos[handle] >= 0) {
+        return updatePriorityPQ(pq, handle, priority);
+    }
+    // Insert at the end
+    METRIC_TIMER_START(timer);
+    if (!appendNodePQ(pq, handle, priority)) return 0;
+    heapifyUp(pq, pq->size - 1);//move up to maintain heap prop
+    METRIC_TIMER_STOP(MET_ENQUEUE_NS, timer);
+    METRIC_GAUGE(MET_HEAP_SIZE, pq->size);
+    //printf("Enqueued handle %d with priority %d\n", handle, priority); //Debugg
+    return 1;
+}
+
+// Bulk loading: append a not-yet-queued handle without keeping heap order.
+// Call buildHeapPQ once the batch is in, before anything else touches the queue
+int appendPQ(PriorityQueue* pq, int handle, int priority) {
+    if (!ensurePosCapacity(pq, handle)) {
+        printf("Priority Queue is full!\n");
+        return 0;
+    }
+    if (pq->pos[handle] >= 0) return 0;// already queued
+    return appendNodePQ(pq, handle, priority);
+}
+
+// Restore heap order after appending nodes from index 'from' on.
+// A few appends are sifted up one by one; a big batch uses Floyd's bottom-up build, O(n)
+void buildHeapPQ(PriorityQueue* pq, int from) {
+    int appended = pq->size - from;
+    if (appended <= 0) return;
+    int depth = 1;
+    while ((1 << depth) <= pq->size) depth++;
+    if ((long long)appended * depth < pq->size) {
+        for (int i = from; i < pq->size; i++) heapifyUp(pq, i);
+        return;
+    }
+    for (int i = pq->size / 2 - 1; i >= 0; i--) heapifyDown(pq, i);
+}
+
+// Take out the node at heap index i, the last node fills its place
+static PQNode removeAtPQ(PriorityQueue* pq, int i) {
+    PQNode removed = pq->heap[i];
+    pq->pos[removed.handle] = -1;
+    pq->size--;
+    METRIC_GAUGE(MET_HEAP_SIZE, pq->size);
+    if (i < pq->size) {
+        pq->heap[i] = pq->heap[pq->size];
+        pq->pos[pq->heap[i].handle] = i;
+        // the moved node may belong above or below its new spot
+        if (pq->heap[i].priority < removed.priority) {
+            heapifyUp(pq, i);
+        } else {
+            heapifyDown(pq, i);
+        }
+    }
+    return removed;
+}
+
+// Pop the earliest medicine - O(log n). Returns 0 if the queue is empty
+int popMinPQ(PriorityQueue* pq, PQNode* out) {
+    if (pq->size == 0) {
+        return 0;
+    }
+    PQNode min = removeAtPQ(pq, 0);
+    if (out) *out = min;
+    return 1;
+}
+
+// Remove a medicine from the queue wherever it is - O(log n)
+int removeFromPQ(PriorityQueue* pq, int handle) {
+    if (handle < 0 || handle >= pq->posCapacity || pq->pos[handle] < 0) {
+        return 0;// not queued
+    }
+    removeAtPQ(pq, pq->pos[handle]);
+    return 1;
+}
+
+// Schedule iterator - k steps cost O(k log k) and only ever hold k+1 candidates
+
+// Push a heap index onto the candidate heap
+static int pushCandidate(ScheduleIterator* it, int heapIndex) {
+    if (it->count == it->capacity) {
+        int newCapacity = it->capacity ? it->capacity * 2 : 16;
+        int* candidates = (int*)realloc(it->candidates, (size_t)newCapacity * sizeof(int));
+        if (!candidates) return 0;
+        it->candidates = candidates;
+        it->capacity = newCapacity;
+    }
+    const PQNode* heap = it->pq->heap;
+    int index = it->count++;
+    while (index > 0) {// same hole-based sift as heapifyUp
+        int parent = (index - 1) / 2;
+        if (heap[heapIndex].priority < heap[it->candidates[parent]].priority) {
+            it->candidates[index] = it->candidates[parent];
+            index = parent;
+        } else {
+            break;
+        }
+    }
+    it->candidates[index] = heapIndex;
+    return 1;
+}
+
+// Pop the candidate with the smallest priority
+static int popCandidate(ScheduleIterator* it) {
+    const PQNode* heap = it->pq->heap;
+    int top = it->candidates[0];
+    int moving = it->candidates[--it->count];
+    int index = 0;
+    while (1) {
+        int smallest = 2 * index + 1;
+        if (smallest >= it->count) break;
+        if (smallest + 1 < it->count &&
+            heap[it->candidates[smallest + 1]].priority < heap[it->candidates[smallest]].priority) {
+            smallest++;
+        }
+        if (heap[it->candidates[smallest]].priority < heap[moving].priority) {
+            it->candidates[index] = it->candidates[smallest];
+            index = smallest;
+        } else {
+            break;
+        }
+    }
+    if (it->count > 0) it->candidates[index] = moving;
+    return top;
+}
+
+// Start a sorted walk over the queue
+void initScheduleIterator(ScheduleIterator* it, const PriorityQueue* pq) {
+    it->pq = pq;
+    it->candidates = NULL;
+    it->count = 0;
+    it->capacity = 0;
+    if (pq->size > 0) pushCandidate(it, 0);// the root is always first
+}
+
+// Next queued medicine in time order; returns 0 when the walk is done
+int nextScheduled(ScheduleIterator* it, PQNode* out) {
+    if (it->count == 0) return 0;
+    int index = popCandidate(it);
+    *out = it->pq->heap[index];
+    // its children are the only new nodes that can come next
+    int left = 2 * index + 1;
+    if (left < it->pq->size && !pushCandidate(it, left)) return 0;
+    if (left + 1 < it->pq->size && !pushCandidate(it, left + 1)) return 0;
+    return 1;
+}
+
+void freeScheduleIterator(ScheduleIterator* it) {
+    free(it->candidates);
+    it->candidates = NULL;
+    it->count = 0;
+    it->capacity = 0;
+}
+
+// Copy the k earliest queued medicines into out (sorted), returns how many were found
+int topKPQ(const PriorityQueue* pq, int k, PQNode* out) {
+    ScheduleIterator it;
+    int found = 0;
+    initScheduleIterator(&it, pq);
+    while (found < k && nextScheduled(&it, &out[found])) {
+        found++;
+    }
+    freeScheduleIterator(&it);
+    return found;
+}
+
+
+// String table - each distinct string (history's medicine names) is kept once and referred to
+// by a 32-bit handle, so a history event is a few words instead of carrying its own 50-byte
+// copy of the name. Strings are packed into 1 MB pages that never move: stringAt needs no lock
+// and the pointer it gives stays good for the rest of the run. Interning takes the lock (the
+// ward's worker threads share the table). Strings are never freed, there are only as many as
+// there are distinct names
+#define STRING_PAGE_BITS 20
+#define STRING_PAGE_SIZE (1u << STRING_PAGE_BITS)
+#define STRING_MAX_PAGES 4096 //4 GB of text, all a 32-bit handle can reach
+
+typedef struct StringSlot {
+    StringRef ref;// 0 = empty slot
+    uint32_t hash;// checked before comparing the bytes
+} StringSlot;
+
+typedef struct StringTable {
+    char* pages[STRING_MAX_PAGES];
+    uint64_t used;// bytes handed out; a string never straddles two pages
+    StringSlot* slots;// open addressing on the hash
+    uint32_t slotCapacity;// power of two (0 until the first string)
+    uint32_t count;
+    pthread_mutex_t lock;
+} StringTable;
+
+static StringTable stringTable = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static const char* stringAt(StringRef ref) {
+    if (ref == 0) return "";
+    return stringTable.pages[ref >> STRING_PAGE_BITS] + (ref & (STRING_PAGE_SIZE - 1));
+}
+
+// FNV-1a
+static uint32_t hashString(const char* text, size_t length) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        h ^= (unsigned char)text[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static int growStringSlots(StringTable* t) {
+    uint32_t newCapacity = t->slotCapacity ? t->slotCapacity * 2 : 1024;
+    StringSlot* slots = (StringSlot*)calloc(newCapacity, sizeof(StringSlot));
+    if (!slots) return 0;
+    for (uint32_t i = 0; i < t->slotCapacity; i++) {
+        if (t->slots[i].ref == 0) continue;
+        uint32_t index = t->slots[i].hash & (newCapacity - 1);
+        while (slots[index].ref != 0) index = (index + 1) & (newCapacity - 1);
+        slots[index] = t->slots[i];
+    }
+    free(t->slots);
+    t->slots = slots;
+    t->slotCapacity = newCapacity;
+    return 1;
+}
+
+// Handle of the first length bytes of text (added if it's new). Returns 1 on success
+int internString(const char* text, size_t length, StringRef* out) {
+    if (length == 0) {
+        *out = 0;
+        return 1;
+    }
+    StringTable* t = &stringTable;
+    uint32_t hash = hashString(text, length);
+    pthread_mutex_lock(&t->lock);
+    if ((uint64_t)(t->count + 1) * 2 > t->slotCapacity && !growStringSlots(t)) {// under 50% full
+        pthread_mutex_unlock(&t->lock);
+        printf("Memory allocation failed!\n");
+        return 0;
+    }
+    uint32_t index = hash & (t->slotCapacity - 1);
+    while (t->slots[index].ref != 0) {
+        if (t->slots[index].hash == hash) {
+            const char* s = stringAt(t->slots[index].ref);
+            if (memcmp(s, text, length) == 0 && s[length] == 0) {
+                *out = t->slots[index].ref;
+                pthread_mutex_unlock(&t->lock);
+                return 1;
+            }
+        }
+        index = (index + 1) & (t->slotCapacity - 1);
+    }
+    if (t->used == 0) t->used = 1;// offset 0 stands for the empty string
+    uint64_t page = t->used >> STRING_PAGE_BITS;
+    if ((t->used & (STRING_PAGE_SIZE - 1)) + length + 1 > STRING_PAGE_SIZE) t->used = ++page << STRING_PAGE_BITS;
+    if (length + 1 > STRING_PAGE_SIZE || page >= STRING_MAX_PAGES ||
+        (!t->pages[page] && !(t->pages[page] = (char*)malloc(STRING_PAGE_SIZE)))) {
+        pthread_mutex_unlock(&t->lock);
+        printf("String table is full!\n");
+        return 0;
+    }
+    StringRef ref = (StringRef)t->used;
+    char* s = t->pages[page] + (ref & (STRING_PAGE_SIZE - 1));
+    memcpy(s, text, length);
+    s[length] = 0;
+    t->used += length + 1;
+    t->slots[index] = (StringSlot){ref, hash};
+    t->count++;
+    pthread_mutex_unlock(&t->lock);
+    *out = ref;
+    return 1;
+}
+
+// LinkedList; good for history tracking; dynamic data where we frequently add/remove entries!
+// Unrolled: each node is a block of HISTORY_BLOCK_ENTRIES events, newest block at the head
+
+// Get a block from the arena (reuses a spare one if there is any)
+static HistoryBlock* allocHistoryBlock(HistoryArena* arena) {
+    HistoryBlock* block = arena->spare;
+    if (block) {
+        arena->spare = block->older;
+        arena->spareCount--;
+        METRIC_ADD(MET_HISTORY_BLOCKS_REUSED, 1);
+    } else {
+        block = (HistoryBlock*)malloc(sizeof(HistoryBlock));
+        if (!block) return NULL;
+        METRIC_ADD(MET_HISTORY_BLOCKS_NEW, 1);
+    }
+    block->count = 0;
+    block->older = NULL;
+    block->newer = NULL;
+    arena->blocksInUse++;
+    return block;
+}
+
+// Give a block back: kept as a spare, or freed once we have enough spares
+static void releaseHistoryBlock(HistoryArena* arena, HistoryBlock* block) {
+    arena->blocksInUse--;
+    if (arena->spareCount < HISTORY_SPARE_BLOCKS) {
+        block->older = arena->spare;
+        arena->spare = block;
+        arena->spareCount++;
+    } else {
+        free(block);
+    }
+}
+
+// Slot counter for a timestamp, growing the slot array either way if needed (NULL on failure)
+static SlotCount* statsSlot(AdherenceCounters* c, time_t timestamp) {
+    long long slot = (long long)(timestamp >= 0 ? timestamp / STATS_SLOT_SECONDS
+                                                : -((-timestamp + STATS_SLOT_SECONDS - 1) / STATS_SLOT_SECONDS));
+    if (!c->slots) {
+        c->slotCapacity = 96 * 8;// a week to start with
+        c->slots = (SlotCount*)calloc((size_t)c->slotCapacity, sizeof(SlotCount));
+        if (!c->slots) return NULL;
+        c->baseSlot = slot - 96;// a little room for slightly older events
+    }
+    if (slot < c->baseSlot) {// older than anything so far, make room at the front
+        long long shift = c->baseSlot - slot + 96;
+        long long newCapacity = c->slotCapacity + shift;
+        if (newCapacity > (1LL << 30)) return NULL;
+        SlotCount* slots = (SlotCount*)realloc(c->slots, (size_t)newCapacity * sizeof(SlotCount));
+        if (!slots) return NULL;
+        memmove(slots + shift, slots, (size_t)c->slotCapacity * sizeof(SlotCount));
+        memset(slots, 0, (size_t)shift * sizeof(SlotCount));
+        c->slots = slots;
+        c->slotCapacity = (int)newCapacity;
+        c->baseSlot -= shift;
+    }
+    if (slot - c->baseSlot >= c->slotCapacity) {
+        long long newCapacity = (long long)c->slotCapacity * 2;
+        while (slot - c->baseSlot >= newCapacity) newCapacity *= 2;
+        if (newCapacity > (1LL << 30)) return NULL;
+        SlotCount* slots = (SlotCount*)realloc(c->slots, (size_t)newCapacity * sizeof(SlotCount));
+        if (!slots) return NULL;
+        memset(slots + c->slotCapacity, 0, (size_t)(newCapacity - c->slotCapacity) * sizeof(SlotCount));
+        c->slots = slots;
+        c->slotCapacity = (int)newCapacity;
+    }
+    return &c->slots[slot - c->baseSlot];
+}
+
+// Per-medicine counter (created if missing unless lookupOnly); NULL if absent / no memory
+static SlotCount* statsMedicine(AdherenceCounters* c, MedicineId medId, int lookupOnly) {
+    if (c->medCapacity == 0 || (!lookupOnly && (c->medUsed + 1) * 100 > c->medCapacity * MAX_LOAD_PERCENT)) {
+        if (lookupOnly) return NULL;
+        int newCapacity = c->medCapacity ? c->medCapacity * 2 : 64;
+        MedicineId* ids = (MedicineId*)malloc((size_t)newCapacity * sizeof(MedicineId));
+        SlotCount* counts = (SlotCount*)calloc((size_t)newCapacity, sizeof(SlotCount));
+        if (!ids || !counts) {
+            free(ids);
+            free(counts);
+            return NULL;
+        }
+        for (int i = 0; i < newCapacity; i++) ids[i] = -1;// IDs are never negative
+        for (int i = 0; i < c->medCapacity; i++) {
+            if (c->medIds[i] < 0) continue;
+            int index = hashFunction(c->medIds[i], newCapacity);
+            while (ids[index] >= 0) index = (index + 1) & (newCapacity - 1);
+            ids[index] = c->medIds[i];
+            counts[index] = c->medCounts[i];
+        }
+        free(c->medIds);
+        free(c->medCounts);
+        c->medIds = ids;
+        c->medCounts = counts;
+        c->medCapacity = newCapacity;
+    }
+    int index = hashFunction(medId, c->medCapacity);
+    while (c->medIds[index] >= 0) {
+        if (c->medIds[index] == medId) return &c->medCounts[index];
+        index = (index + 1) & (c->medCapacity - 1);
+    }
+    if (lookupOnly) return NULL;
+    c->medIds[index] = medId;
+    c->medUsed++;
+    return &c->medCounts[index];
+}
+
+// Add (delta = 1) or remove (delta = -1) one event from the counters - O(1)
+static void countHistoryEvent(AdherenceCounters* c, MedicineId medId, int status, time_t timestamp, int delta) {
+    SlotCount* slot = statsSlot(c, timestamp);
+    SlotCount* med = statsMedicine(c, medId, 0);
+    if (status == HISTORY_TAKEN) {
+        if (slot) slot->taken += delta;
+        if (med) med->taken += delta;
+    } else {
+        if (slot) slot->missed += delta;
+        if (med) med->missed += delta;
+    }
+}
+
+void initLinkedList(LinkedList* list) {
+    list->head = NULL;// Empty list
+    list->tail = NULL;
+    list->count = 0;
+    list->arena.spare = NULL;
+    list->arena.spareCount = 0;
+    list->arena.blocksInUse = 0;
+    memset(&list->stats, 0, sizeof(list->stats));
+}
+
+// Free every block, spares included
+void freeLinkedList(LinkedList* list) {
+    HistoryBlock* block = list->head;
+    while (block) {
+        HistoryBlock* older = block->older;
+        free(block);
+        block = older;
+    }
+    block = list->arena.spare;
+    while (block) {
+        HistoryBlock* next = block->older;
+        free(block);
+        block = next;
+    }
+    free(list->stats.slots);
+    free(list->stats.medIds);
+    free(list->stats.medCounts);
+    initLinkedList(list);
+}
+
+// Insert a history entry with a given timestamp at head (used when replaying the log)
+int insertHistoryEntry(LinkedList* list, MedicineId medId, const char* medName, int status, time_t timestamp) {
+    METRIC_TIMER_START(timer);
+    StringRef name;
+    if (!internString(medName, strnlen(medName, MAX_NAME - 1), &name)) return 0;// (truncated to fit)
+    HistoryBlock* block = list->head;
+    long long day = (long long)(timestamp >= 0 ? timestamp / SECONDS_PER_DAY
+                                               : -((-timestamp + SECONDS_PER_DAY - 1) / SECONDS_PER_DAY));
+    if (!block || block->count == HISTORY_BLOCK_ENTRIES || block->day != day) {
+        // head block is full (or holds another day), start a new one
+        block = allocHistoryBlock(&list->arena);
+        if (!block) {// Check for memory allocation failure
+            printf("Memory allocation failed!\n");
+            return 0;
+        }
+        block->older = list->head;
+        if (list->head) list->head->newer = block;
+        else list->tail = block;
+        list->head = block;
+        block->day = day;
+        block->minTime = timestamp;
+        block->maxTime = timestamp;
+    }
+    int i = block->count++;
+    block->offsets[i] = (int32_t)(timestamp - (time_t)(day * SECONDS_PER_DAY));
+    block->medicineIds[i] = medId;
+    block->statuses[i] = (unsigned char)status;
+    block->medicineNames[i] = name;
+    if (timestamp < block->minTime) block->minTime = timestamp;
+    if (timestamp > block->maxTime) block->maxTime = timestamp;
+    list->count++;
+    countHistoryEvent(&list->stats, medId, status, timestamp, 1);
+    METRIC_ADD(MET_HISTORY_APPENDS, 1);
+    METRIC_GAUGE(MET_HISTORY_ENTRIES, list->count);
+    METRIC_TIMER_STOP(MET_APPEND_NS, timer);
+    return 1;
+}
+
+// Insert new history entry at head (most recent first); returns its timestamp, or -1 on failure
+time_t insertAtHead(LinkedList* list, MedicineId medId, char* medName, int status) {
+    time_t now = time(NULL);// Current time
+    return insertHistoryEntry(list, medId, medName, status, now) ? now : (time_t)-1;
+}
+
+// Drop whole blocks at the old end whose newest entry is before 'before'; returns entries dropped
+int trimHistory(LinkedList* list, time_t before) {
+    int dropped = 0;
+    while (list->tail && list->tail->maxTime < before) {
+        HistoryBlock* block = list->tail;
+        list->tail = block->newer;
+        if (list->tail) list->tail->older = NULL;
+        else list->head = NULL;
+        dropped += block->count;
+        for (int i = 0; i < block->count; i++) {// trimmed events leave the statistics too
+            countHistoryEvent(&list->stats, block->medicineIds[i], block->statuses[i], historyTime(block, i), -1);
+        }
+        releaseHistoryBlock(&list->arena, block);
+    }
+    list->count -= dropped;
+    METRIC_GAUGE(MET_HISTORY_ENTRIES, list->count);
+    return dropped;
+}
+
+// Start of the local day containing t, shifted by dayOffset days (DST safe: asks mktime)
+time_t localDayStart(time_t t, int dayOffset) {
+    struct tm tmDay;
+    localtime_r(&t, &tmDay);// reentrant - nothing else can overwrite our struct
+    tmDay.tm_mday += dayOffset;
+    tmDay.tm_hour = 0;
+    tmDay.tm_min = 0;
+    tmDay.tm_sec = 0;
+    tmDay.tm_isdst = -1;// let mktime work out DST for that date
+    return mktime(&tmDay);
+}
+
+const char* historyStatusName(int status) {
+    return status == HISTORY_TAKEN ? "taken" : "missed";
+}
+
+// ADHERENCE KERNELS - count taken / missed over the status (and offset) columns.
+// Scalar, SSE2 and AVX2 versions; the best one the CPU supports is picked once at runtime
+// (PILLPILOT_SIMD=scalar|sse2|avx2 forces one). All of them must give the same answers
+
+// Count every status in statuses[0..n)
+static void countStatusScalar(const unsigned char* statuses, int n, int* taken, int* missed) {
+    int t = 0, m = 0;
+    for (int i = 0; i < n; i++) {
+        t += statuses[i] == HISTORY_TAKEN;
+        m += statuses[i] == HISTORY_MISSED;
+    }
+    *taken += t;
+    *missed += m;
+}
+
+// Count statuses whose offset is in [lo, hi)
+static void countStatusRangeScalar(const unsigned char* statuses, const int32_t* offsets, int n,
+                                   int32_t lo, int32_t hi, int* taken, int* missed) {
+    int t = 0, m = 0;
+    for (int i = 0; i < n; i++) {
+        int in = offsets[i] >= lo && offsets[i] < hi;
+        t += in & (statuses[i] == HISTORY_TAKEN);
+        m += in & (statuses[i] == HISTORY_MISSED);
+    }
+    *taken += t;
+    *missed += m;
+}
+
+#ifdef HAVE_X86_SIMD
+// 16 statuses per step: compare bytes, popcount the masks
+__attribute__((target("sse2"))) static void countStatusSse2(const unsigned char* statuses, int n,
+                                                            int* taken, int* missed) {
+    const __m128i t = _mm_set1_epi8(HISTORY_TAKEN);
+    const __m128i m = _mm_set1_epi8(HISTORY_MISSED);
+    int ct = 0, cm = 0, i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(statuses + i));
+        ct += __builtin_popcount((unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, t)));
+        cm += __builtin_popcount((unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, m)));
+    }
+    *taken += ct;
+    *missed += cm;
+    countStatusScalar(statuses + i, n - i, taken, missed);// leftover tail
+}
+
+// 4 entries per step: offsets compared as int32, status bytes widened to int32 lanes
+__attribute__((target("sse2"))) static void countStatusRangeSse2(const unsigned char* statuses,
+                                                                 const int32_t* offsets, int n,
+                                                                 int32_t lo, int32_t hi,
+                                                                 int* taken, int* missed) {
+    const __m128i t = _mm_set1_epi32(HISTORY_TAKEN);
+    const __m128i m = _mm_set1_epi32(HISTORY_MISSED);
+    const __m128i below = _mm_set1_epi32(lo - 1);// offset > lo - 1  <=>  offset >= lo
+    const __m128i upper = _mm_set1_epi32(hi);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i accT = zero, accM = zero;// lanes count down by one per match (masks are -1)
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i off = _mm_loadu_si128((const __m128i*)(offsets + i));
+        __m128i in = _mm_and_si128(_mm_cmpgt_epi32(off, below), _mm_cmpgt_epi32(upper, off));
+        int packed;
+        memcpy(&packed, statuses + i, sizeof(packed));
+        __m128i st = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), zero);
+        accT = _mm_sub_epi32(accT, _mm_and_si128(in, _mm_cmpeq_epi32(st, t)));
+        accM = _mm_sub_epi32(accM, _mm_and_si128(in, _mm_cmpeq_epi32(st, m)));
+    }
+    int lanes[4];
+    _mm_storeu_si128((__m128i*)lanes, accT);
+    *taken += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    _mm_storeu_si128((__m128i*)lanes, accM);
+    *missed += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    countStatusRangeScalar(statuses + i, offsets + i, n - i, lo, hi, taken, missed);
+}
+
+// Same as SSE2 with 32 statuses per step
+__attribute__((target("avx2,popcnt"))) static void countStatusAvx2(const unsigned char* statuses, int n,
+                                                                   int* taken, int* missed) {
+    const __m256i t = _mm256_set1_epi8(HISTORY_TAKEN);
+    const __m256i m = _mm256_set1_epi8(HISTORY_MISSED);
+    int ct = 0, cm = 0, i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(statuses + i));
+        ct += __builtin_popcount((unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, t)));
+        cm += __builtin_popcount((unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, m)));
+    }
+    *taken += ct;
+    *missed += cm;
+    countStatusScalar(statuses + i, n - i, taken, missed);
+}
+
+// 8 entries per step
+__attribute__((target("avx2"))) static void countStatusRangeAvx2(const unsigned char* statuses,
+                                                                 const int32_t* offsets, int n,
+                                                                 int32_t lo, int32_t hi,
+                                                                 int* taken, int* missed) {
+    const __m256i t = _mm256_set1_epi32(HISTORY_TAKEN);
+    const __m256i m = _mm256_set1_epi32(HISTORY_MISSED);
+    const __m256i below = _mm256_set1_epi32(lo - 1);
+    const __m256i upper = _mm256_set1_epi32(hi);
+    __m256i accT = _mm256_setzero_si256(), accM = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i off = _mm256_loadu_si256((const __m256i*)(offsets + i));
+        __m256i in = _mm256_and_si256(_mm256_cmpgt_epi32(off, below), _mm256_cmpgt_epi32(upper, off));
+        __m256i st = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(statuses + i)));
+        accT = _mm256_sub_epi32(accT, _mm256_and_si256(in, _mm256_cmpeq_epi32(st, t)));
+        accM = _mm256_sub_epi32(accM, _mm256_and_si256(in, _mm256_cmpeq_epi32(st, m)));
+    }
+    int lanes[8];
+    _mm256_storeu_si256((__m256i*)lanes, accT);
+    for (int k = 0; k < 8; k++) *taken += lanes[k];
+    _mm256_storeu_si256((__m256i*)lanes, accM);
+    for (int k = 0; k < 8; k++) *missed += lanes[k];
+    countStatusRangeScalar(statuses + i, offsets + i, n - i, lo, hi, taken, missed);
+}
+#endif
+
+typedef struct AdherenceKernels {
+    const char* name;
+    void (*countStatus)(const unsigned char* statuses, int n, int* taken, int* missed);
+    void (*countStatusRange)(const unsigned char* statuses, const int32_t* offsets, int n,
+                             int32_t lo, int32_t hi, int* taken, int* missed);
+} AdherenceKernels;
+
+static const AdherenceKernels adherenceKernels[] = {
+    {"scalar", countStatusScalar, countStatusRangeScalar},
+#ifdef HAVE_X86_SIMD
+    {"sse2", countStatusSse2, countStatusRangeSse2},
+    {"avx2", countStatusAvx2, countStatusRangeAvx2},
+#endif
+};
+#define ADHERENCE_KERNEL_COUNT ((int)(sizeof(adherenceKernels) / sizeof(adherenceKernels[0])))
+
+static const AdherenceKernels* activeKernels = NULL;
+
+// Can this CPU run kernel set k?
+int adherenceKernelSupported(int k) {
+    if (k < 0 || k >= ADHERENCE_KERNEL_COUNT) return 0;
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (strcmp(adherenceKernels[k].name, "sse2") == 0) return __builtin_cpu_supports("sse2");
+    if (strcmp(adherenceKernels[k].name, "avx2") == 0) return __builtin_cpu_supports("avx2");
+#endif
+    return 1;
+}
+
+// Switch kernels by name; returns 0 if unknown or not supported here
+int selectAdherenceKernels(const char* name) {
+    for (int k = 0; k < ADHERENCE_KERNEL_COUNT; k++) {
+        if (strcmp(adherenceKernels[k].name, name) == 0 && adherenceKernelSupported(k)) {
+            activeKernels = &adherenceKernels[k];
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Kernels in use, picking the widest supported set on first call
+static const AdherenceKernels* getAdherenceKernels(void) {
+    if (!activeKernels) {
+        const char* forced = getenv("PILLPILOT_SIMD");
+        if (!forced || !selectAdherenceKernels(forced)) {
+            for (int k = ADHERENCE_KERNEL_COUNT - 1; k >= 0; k--) {
+                if (adherenceKernelSupported(k)) {
+                    activeKernels = &adherenceKernels[k];
+                    break;
+                }
+            }
+        }
+    }
+    return activeKernels;
+}
+
+// Taken / missed of one block between two times [from, to)
+static void countBlock(const AdherenceKernels* kernels, const HistoryBlock* block, time_t from, time_t to,
+                       int* taken, int* missed) {
+    if (block->maxTime < from || block->minTime >= to) return;
+    if (block->minTime >= from && block->maxTime < to) {// whole block, status column only
+        kernels->countStatus(block->statuses, block->count, taken, missed);
+        return;
+    }
+    time_t base = (time_t)(block->day * SECONDS_PER_DAY);
+    int32_t lo = from > base ? (int32_t)(from - base) : 0;// clamp to the block's day
+    int32_t hi = to < base + SECONDS_PER_DAY ? (int32_t)(to - base) : SECONDS_PER_DAY;
+    kernels->countStatusRange(block->statuses, block->offsets, block->count, lo, hi, taken, missed);
+}
+
+// Taken / missed per local day for 'days' days starting at the local midnight 'firstDay'.
+// counts[d] gets day d; a block crossing a local midnight is split on its offset column
+void adherenceByDay(LinkedList* list, time_t firstDay, int days, SlotCount* counts) {
+    const AdherenceKernels* kernels = getAdherenceKernels();
+    time_t* bounds = (time_t*)malloc((size_t)(days + 1) * sizeof(time_t));
+    memset(counts, 0, (size_t)days * sizeof(SlotCount));
+    if (!bounds) return;
+    for (int d = 0; d <= days; d++) bounds[d] = localDayStart(firstDay, d);
+    for (HistoryBlock* block = list->head; block != NULL; block = block->older) {
+        if (block->maxTime < bounds[0] || block->minTime >= bounds[days]) continue;
+        int d = 0;// first day the block touches (binary search, days can be long)
+        int hiDay = days - 1;
+        while (d < hiDay) {
+            int mid = (d + hiDay + 1) / 2;
+            if (bounds[mid] <= block->minTime) d = mid;
+            else hiDay = mid - 1;
+        }
+        for (; d < days && bounds[d] <= block->maxTime; d++) {
+            countBlock(kernels, block, bounds[d], bounds[d + 1], &counts[d].taken, &counts[d].missed);
+        }
+    }
+    free(bounds);
+}
+
+// Called for each match of a history query; return 0 to stop early
+typedef int (*HistoryVisitor)(const HistoryEntry* entry, void* ctx);
+
+// Range query: entries with from <= timestamp < to, newest first.
+// medId < 0 matches any medicine, status 0 matches either; visit may be NULL to just count.
+// Blocks outside the range are skipped on their min/max time, and blocks entirely inside
+// it don't even read the timestamp column. Returns the number of matches visited
+int queryHistory(LinkedList* list, time_t from, time_t to, MedicineId medId, int status,
+                 HistoryVisitor visit, void* ctx) {
+    int matches = 0;
+    if (!visit && medId < 0) {// plain count: let the kernels do it
+        const AdherenceKernels* kernels = getAdherenceKernels();
+        int taken = 0, missed = 0;
+        for (HistoryBlock* block = list->head; block != NULL; block = block->older) {
+            countBlock(kernels, block, from, to, &taken, &missed);
+        }
+        return (status != HISTORY_MISSED ? taken : 0) + (status != HISTORY_TAKEN ? missed : 0);
+    }
+    for (HistoryBlock* block = list->head; block != NULL; block = block->older) {
+        if (block->maxTime < from || block->minTime >= to) continue;// nothing in range here
+        int whole = block->minTime >= from && block->maxTime < to;
+        for (int i = block->count - 1; i >= 0; i--) {
+            if (medId >= 0 && block->medicineIds[i] != medId) continue;
+            if (status && block->statuses[i] != status) continue;
+            if (!whole && (historyTime(block, i) < from || historyTime(block, i) >= to)) continue;
+            matches++;
+            if (visit) {
+                HistoryEntry entry;
+                entry.timestamp = historyTime(block, i);
+                entry.medicineId = block->medicineIds[i];
+                entry.status = block->statuses[i];
+                entry.medicineName = stringAt(block->medicineNames[i]);
+                if (!visit(&entry, ctx)) return matches;
+            }
+        }
+    }
+    return matches;
+}
+
+// Print one history row into the report in ctx; stops the query if the reader quit paging
+static int printHistoryEntry(const HistoryEntry* current, void* ctx) {
+    ReportWriter* w = (ReportWriter*)ctx;
+    char* p = reportReserve(w, REPORT_MAX_ROW);// "%-20s %-10s %-30s\n", time as %Y-%m-%d %H:%M:%S
+    p = putPadded(p, current->medicineName, 20);
+    *p++ = ' ';
+    p = putPadded(p, historyStatusName(current->status), 10);
+    *p++ = ' ';
+    char* stamp = p;
+    p = putTimestamp(w, p, current->timestamp);
+    while (p - stamp < 30) *p++ = ' ';
+    *p++ = '\n';
+    reportEndRow(w, p);
+    return !w->quit;
+}
+
+// History as a report - most recent first
+void writeHistory(ReportWriter* w, LinkedList* list) {
+    reportf(w, "\n=== MEDICATION HISTORY ===\n");
+    reportf(w, "%-20s %-10s %-30s\n", "Medicine", "Status", "Timestamp");
+    reportf(w, "--------------------------------------------------------------------------------\n");
+    // Traverse the blocks newest first, each block back to front
+    for (HistoryBlock* block = list->head; block != NULL && !w->quit; block = block->older) {
+        for (int i = block->count - 1; i >= 0 && !w->quit; i--) {
+            HistoryEntry current;
+            current.timestamp = historyTime(block, i);
+            current.medicineId = block->medicineIds[i];
+            current.status = block->statuses[i];
+            current.medicineName = stringAt(block->medicineNames[i]);
+            printHistoryEntry(&current, w);
+        }
+    }
+    reportf(w, "\nTotal Entries: %d\n", list->count);
+    if(list->count == 0) {
+        reportf(w, "No medication history recorded yet.\n");
+    }
+}
+
+// Display history -most recent first
+void displayHistory(LinkedList* list) {
+    ReportWriter w;
+    if (!openTerminalReport(&w)) {
+        printf("\n✗ Out of memory!\n");
+        return;
+    }
+    writeHistory(&w, list);
+    closeReport(&w);
+}
+
+// Display the history of the last 'days' days (local midnights), optionally for one medicine / status
+void displayHistoryRange(LinkedList* list, int days, MedicineId medId, int status) {
+    time_t now = time(NULL);
+    time_t from = localDayStart(now, 1 - days);
+    time_t to = localDayStart(now, 1);
+    ReportWriter w;
+    if (!openTerminalReport(&w)) {
+        printf("\n✗ Out of memory!\n");
+        return;
+    }
+    reportf(&w, "\n=== MEDICATION HISTORY (last %d day%s) ===\n", days, days == 1 ? "" : "s");
+    reportf(&w, "%-20s %-10s %-30s\n", "Medicine", "Status", "Timestamp");
+    reportf(&w, "--------------------------------------------------------------------------------\n");
+    int matches = queryHistory(list, from, to, medId, status, printHistoryEntry, &w);
+    if (!w.quit) reportf(&w, "\nMatching Entries: %d\n", matches);
+    closeReport(&w);
+}
+
+// Taken / missed between two times [from, to) - sums the 15-minute slots, no history scan.
+// Both ends should be on a 15-minute boundary (local midnights always are)
+void getStatisticsRange(LinkedList* list, time_t from, time_t to, int* taken, int* missed) {
+    *taken = 0;//counter initialization
+    *missed = 0;
+    AdherenceCounters* c = &list->stats;
+    if (!c->slots || to <= from) return;
+    long long first = (long long)(from / STATS_SLOT_SECONDS) - c->baseSlot;
+    long long last = (long long)(to / STATS_SLOT_SECONDS) - c->baseSlot;// exclusive
+    if (first < 0) first = 0;
+    if (last > c->slotCapacity) last = c->slotCapacity;
+    for (long long i = first; i < last; i++) {
+        *taken += c->slots[i].taken;
+        *missed += c->slots[i].missed;
+    }
+}
+
+// Get statistics for today: total taken, total missed
+// "Today" is worked out on every call, so it rolls over at midnight and follows TZ changes
+void getStatistics(LinkedList* list, int* taken, int* missed) {
+    tzset();// pick up a changed TZ
+    time_t now = time(NULL);//current time
+    getStatisticsRange(list, localDayStart(now, 0), localDayStart(now, 1), taken, missed);
+}
+
+// All-time taken / missed for one medicine
+void getMedicineStatistics(LinkedList* list, MedicineId medId, int* taken, int* missed) {
+    SlotCount* counts = statsMedicine(&list->stats, medId, 1);
+    *taken = counts ? counts->taken : 0;
+    *missed = counts ? counts->missed : 0;
+}
+
+// UTIL FUNCS
+// Calculate priority from time string (HH:MM)
+int calculatePriority(char* time) {
+    int hours, minutes;
+    sscanf(time, "%d:%d", &hours, &minutes);
+    return hours * 60 + minutes;// Convert to total minutes from midnight
+    //e.g., 08:30 = 8*60 + 30 = 510min
+}
+
+// Monotonic wall-clock seconds, for timings
+static double nowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// RECURRENCE RULES - multi-dose schedules ("08:00,14:00,20:00", "every 8h for 10 days",
+// "mon,wed,fri until 2027-01-31"). The reminder queue holds one node per medicine, keyed by
+// its next dose in minutes since the epoch; when that dose is popped, the following one is
+// worked out from the rule and the node goes straight back in. So the queue is as big as the
+// list of prescriptions, never doses x days - a year-long regimen costs one node.
+static const char* const weekdayNames[7] = {"sun", "mon", "tue", "wed", "thu", "fri", "sat"};
+
+// Local time `minute` minutes past midnight, dayOffset days after the day of t (DST aware).
+// Works from the UTC offset instead of mktime, which re-reads the time zone on every call
+static time_t localTimeOnDay(time_t t, int dayOffset, int minute, int* weekday) {
+    struct tm tmAt;
+    localtime_r(&t, &tmAt);
+    // the wall clock we want, in seconds as if local time were UTC
+    long long wall = (long long)t + tmAt.tm_gmtoff - (tmAt.tm_hour * 3600 + tmAt.tm_min * 60 + tmAt.tm_sec) +
+                     (long long)dayOffset * 86400 + minute * 60;
+    time_t result = (time_t)(wall - tmAt.tm_gmtoff);
+    for (int i = 0; i < 2; i++) {// a DST change in between moves the offset: correct for it
+        localtime_r(&result, &tmAt);
+        time_t better = (time_t)(wall - tmAt.tm_gmtoff);
+        if (better == result) break;
+        result = better;
+        localtime_r(&result, &tmAt);
+    }
+    if (weekday) *weekday = tmAt.tm_wday;
+    return result;
+}
+
+// First dose strictly after `after`, or -1 once the rule has run out
+time_t nextOccurrence(const RecurrenceRule* rule, time_t after) {
+    int days = rule->weekdays & EVERY_DAY ? rule->weekdays & EVERY_DAY : EVERY_DAY;
+    if (rule->interval > 0) {
+        time_t step = (time_t)rule->interval * 60;
+        time_t t = after < rule->start ? rule->start : rule->start + ((after - rule->start) / step + 1) * step;
+        for (int tries = 0; tries < 8; tries++) {// a week of skipped days at most
+            if (rule->end && t >= rule->end) return -1;
+            int weekday;
+            localTimeOnDay(t, 0, 0, &weekday);
+            if (days & (1 << weekday)) return t;
+            time_t midnight = localTimeOnDay(t, 1, 0, NULL);// first dose on or after the next day
+            t = rule->start + (midnight - rule->start + step - 1) / step * step;
+        }
+        return -1;
+    }
+    time_t from = rule->start > 0 && after < rule->start ? rule->start - 1 : after;
+    for (int day = 0; day < 8; day++) {
+        for (int i = 0; i < rule->timeCount; i++) {
+            int weekday;
+            time_t t = localTimeOnDay(from, day, rule->times[i], &weekday);
+            if (!(days & (1 << weekday))) break;// whole day is off
+            if (t > from) return rule->end && t >= rule->end ? -1 : t;
+        }
+    }
+    return -1;
+}
+
+// Local midnight of a YYYY-MM-DD date, -1 if it isn't one
+static time_t parseDate(const char* s) {
+    struct tm tmDay;
+    memset(&tmDay, 0, sizeof(tmDay));
+    char extra;
+    if (sscanf(s, "%d-%d-%d%c", &tmDay.tm_year, &tmDay.tm_mon, &tmDay.tm_mday, &extra) != 3 ||
+        tmDay.tm_mon < 1 || tmDay.tm_mon > 12 || tmDay.tm_mday < 1 || tmDay.tm_mday > 31) {
+        return -1;
+    }
+    tmDay.tm_year -= 1900;
+    tmDay.tm_mon -= 1;
+    tmDay.tm_isdst = -1;
+    return mktime(&tmDay);
+}
+
+// "8h", "90m", "8" + "hours" ... -> minutes (0 if it doesn't parse). May use up the next token
+static int parseEvery(char* token, char** rest) {
+    char* unit;
+    long n = strtol(token, &unit, 10);
+    if (n <= 0 || unit == token) return 0;
+    if (*unit == 0 && *rest) unit = strtok_r(NULL, " ", rest);// unit is a word of its own
+    if (!unit) return 0;
+    if (strcmp(unit, "h") == 0 || strcmp(unit, "hour") == 0 || strcmp(unit, "hours") == 0) n *= 60;
+    else if (strcmp(unit, "m") != 0 && strcmp(unit, "min") != 0 && strcmp(unit, "minutes") != 0) return 0;
+    return n <= 7 * 24 * 60 ? (int)n : 0;
+}
+
+static void addDoseTime(RecurrenceRule* rule, int minute) {
+    int i = rule->timeCount;
+    for (int j = 0; j < rule->timeCount; j++) {
+        if (rule->times[j] == minute) return;// already there
+    }
+    if (i == MAX_DOSE_TIMES) return;
+    while (i > 0 && rule->times[i - 1] > minute) {// keep them sorted
+        rule->times[i] = rule->times[i - 1];
+        i--;
+    }
+    rule->times[i] = (int16_t)minute;
+    rule->timeCount++;
+}
+
+// Parse a repeat rule for a medicine whose (first) time is firstMinute. Empty = daily.
+// Words: HH:MM[,HH:MM...]  every N(h|m)  mon,wed,...|weekdays|weekends  for N days
+// from YYYY-MM-DD  until YYYY-MM-DD. Returns 1 on success, 0 if it doesn't make sense
+int parseRecurrence(const char* text, int firstMinute, time_t now, RecurrenceRule* out) {
+    char buf[128];
+    snprintf(buf, sizeof(buf), "%s", text);
+    for (char* c = buf; *c; c++) {
+        if (*c >= 'A' && *c <= 'Z') *c += 'a' - 'A';
+        if (*c == '\t' || *c == ';') *c = ' ';
+    }
+    dailyRule(out, firstMinute);
+    int days = 0, forDays = 0, every = 0;
+    time_t from = 0, until = 0;
+    char* rest = NULL;
+    for (char* token = strtok_r(buf, " ", &rest); token; token = strtok_r(NULL, " ", &rest)) {
+        if (strcmp(token, "daily") == 0) continue;
+        if (strcmp(token, "every") == 0) {
+            char* n = strtok_r(NULL, " ", &rest);
+            if (!n || !(every = parseEvery(n, &rest))) return 0;
+        } else if (strcmp(token, "for") == 0) {
+            char* n = strtok_r(NULL, " ", &rest);
+            char* unit;
+            forDays = n ? (int)strtol(n, &unit, 10) : 0;
+            if (forDays <= 0) return 0;
+            if (*unit == 0) unit = strtok_r(NULL, " ", &rest);
+            if (!unit || (strcmp(unit, "d") != 0 && strcmp(unit, "day") != 0 && strcmp(unit, "days") != 0)) return 0;
+        } else if (strcmp(token, "from") == 0 || strcmp(token, "until") == 0) {
+            char* date = strtok_r(NULL, " ", &rest);
+            time_t t = date ? parseDate(date) : -1;
+            if (t < 0) return 0;
+            if (token[0] == 'f') from = t;
+            else until = t;
+        } else if (strcmp(token, "weekdays") == 0) {
+            days |= 0x3e;
+        } else if (strcmp(token, "weekends") == 0) {
+            days |= 0x41;
+        } else if (strchr(token, ':')) {// list of times
+            char* timesRest = NULL;
+            for (char* t = strtok_r(token, ",", &timesRest); t; t = strtok_r(NULL, ",", &timesRest)) {
+                int hours, minutes;
+                char extra;
+                if (sscanf(t, "%d:%d%c", &hours, &minutes, &extra) != 2 || hours < 0 || hours > 23 ||
+                    minutes < 0 || minutes > 59) {
+                    return 0;
+                }
+                addDoseTime(out, hours * 60 + minutes);
+            }
+        } else {// list of day names
+            char* daysRest = NULL;
+            for (char* d = strtok_r(token, ",", &daysRest); d; d = strtok_r(NULL, ",", &daysRest)) {
+                int day = 0;
+                while (day < 7 && strncmp(d, weekdayNames[day], 3) != 0) day++;
+                if (day == 7) return 0;
+                days |= 1 << day;
+            }
+        }
+    }
+    if (days) out->weekdays = (uint8_t)days;
+    time_t base = from ? from : localDayStart(now, 0);
+    if (every) {
+        if (out->timeCount > 1) return 0;// either times of day or an interval, not both
+        out->interval = every;
+        out->start = localTimeOnDay(base, 0, firstMinute, NULL);
+        if (forDays) out->end = localTimeOnDay(base, forDays, firstMinute, NULL);
+    } else {
+        out->start = from;
+        if (forDays) out->end = localDayStart(base, forDays);
+    }
+    if (until) {
+        time_t end = localDayStart(until, 1);// until a date = that whole day included
+        if (!out->end || end < out->end) out->end = end;
+    }
+    return !out->end || out->end > out->start;
+}
+
+// Move the medicine's own time (oldMinute) to a new minute of day, keeping the rest of the rule.
+// times[] is sorted, so the medicine's time isn't necessarily times[0] - look it up
+void rescheduleRule(RecurrenceRule* rule, int oldMinute, int minute) {
+    if (rule->interval > 0) {
+        rule->start = localTimeOnDay(rule->start, 0, minute, NULL);
+        rule->times[0] = (int16_t)minute;
+        return;
+    }
+    for (int i = 0; i < rule->timeCount; i++) {
+        if (rule->times[i] == oldMinute) {
+            for (int j = i + 1; j < rule->timeCount; j++) rule->times[j - 1] = rule->times[j];
+            rule->timeCount--;
+            break;
+        }
+    }
+    addDoseTime(rule, minute);
+}
+
+// Human readable rule, e.g. "08:00,20:00 mon,wed,fri until 2026-12-31"
+void formatRecurrence(const RecurrenceRule* rule, char* buf, size_t size) {
+    size_t len = 0;
+    struct tm tmDay;
+    if (rule->interval > 0) {
+        time_t start = (time_t)rule->start;
+        localtime_r(&start, &tmDay);
+        if (rule->interval % 60 == 0) len += snprintf(buf + len, size - len, "every %dh", rule->interval / 60);
+        else len += snprintf(buf + len, size - len, "every %dm", rule->interval);
+        len += strftime(buf + len, size - len, " from %Y-%m-%d %H:%M", &tmDay);
+    } else {
+        if (rule->timeCount == 1 && rule->weekdays == EVERY_DAY) len += snprintf(buf + len, size - len, "daily ");
+        for (int i = 0; i < rule->timeCount && len < size; i++) {
+            len += snprintf(buf + len, size - len, "%s%02d:%02d", i ? "," : "", rule->times[i] / 60,
+                            rule->times[i] % 60);
+        }
+        if (rule->start > 0 && len < size) {
+            time_t start = (time_t)rule->start;
+            localtime_r(&start, &tmDay);
+            len += strftime(buf + len, size - len, " from %Y-%m-%d", &tmDay);
+        }
+    }
+    if ((rule->weekdays & EVERY_DAY) != EVERY_DAY && rule->weekdays) {
+        for (int day = 0, first = 1; day < 7 && len < size; day++) {
+            if (!(rule->weekdays & (1 << day))) continue;
+            len += snprintf(buf + len, size - len, "%s%s", first ? " " : ",", weekdayNames[day]);
+            first = 0;
+        }
+    }
+    if (rule->end > 0 && len < size) {
+        time_t last = (time_t)rule->end - 1;
+        localtime_r(&last, &tmDay);
+        strftime(buf + len, size - len, " until %Y-%m-%d", &tmDay);
+    }
+}
+
+// Queue key for a dose: minutes since the epoch (an int is good until the year 6000)
+static int doseKey(time_t t) {
+    return (int)(t / 60);
+}
+
+// (Re)queue a medicine at its first dose after `after`. A rule with no doses left drops
+// out of the queue. Returns 1 if it's queued
+int scheduleNextDose(PriorityQueue* pq, MedicineStore* store, int handle, time_t after) {
+    time_t next = nextOccurrence(&store->rules[handle], after);
+    if (next < 0) {
+        removeFromPQ(pq, handle);
+        return 0;
+    }
+    return enqueuePQ(pq, handle, doseKey(next));
+}
+
+// Pop the earliest dose if it's due by `now`: the node stays in the queue, re-keyed to that
+// medicine's following dose (or leaves it when the rule has run out). O(log n)
+int popDueDose(PriorityQueue* pq, MedicineStore* store, time_t now, PQNode* out) {
+    if (pq->size == 0 || pq->heap[0].priority > doseKey(now)) return 0;
+    PQNode due = pq->heap[0];
+    time_t next = nextOccurrence(&store->rules[due.handle], (time_t)due.priority * 60);
+    if (next < 0) {
+        popMinPQ(pq, NULL);
+    } else {
+        updatePriorityPQ(pq, due.handle, doseKey(next));
+    }
+    if (out) *out = due;
+    return 1;
+}
+
+// Move every medicine whose next dose is already past on to its first dose after now
+// (one step per medicine, however many doses were skipped). Returns how many moved
+int catchUpDoses(PriorityQueue* pq, MedicineStore* store, time_t now) {
+    int moved = 0;
+    while (pq->size > 0 && pq->heap[0].priority < doseKey(now)) {
+        scheduleNextDose(pq, store, pq->heap[0].handle, now - 1);
+        moved++;
+    }
+    return moved;
+}
+
+// Display the doses of the next 24 hours in time order. Medicines whose queued dose is
+// already past move on first; then the queue is walked in order and each medicine's later
+// doses are expanded one at a time in a small side queue (no more than one node each)
+void writePriorityQueue(ReportWriter* w, PriorityQueue* pq, MedicineStore* store, time_t now) {
+    reportf(w, "\n=== UPCOMING DOSES - NEXT 24 HOURS (Sorted by Time) ===\n");
+    reportf(w, "%-10s %-20s %-10s %-30s\n", "Time", "Medicine", "Dosage", "Instructions");
+    reportf(w, "--------------------------------------------------------------------------------\n");
+    catchUpDoses(pq, store, now);
+    int limit = doseKey(now + 86400);
+    PriorityQueue upcoming;
+    if (!initPriorityQueue(&upcoming)) return;
+    // Stream the heap in time order, no copy and no sort, until past the window
+    ScheduleIterator it;
+    PQNode node;
+    initScheduleIterator(&it, pq);
+    while (nextScheduled(&it, &node) && node.priority <= limit) enqueuePQ(&upcoming, node.handle, node.priority);
+    freeScheduleIterator(&it);
+    while (!w->quit && popMinPQ(&upcoming, &node)) {
+        MedicineText* t = &store->text[node.handle];
+        time_t dose = (time_t)node.priority * 60;
+        char* p = reportReserve(w, REPORT_MAX_ROW);// "%-10s %-20s %-10s %-30s\n", time as %a %H:%M
+        char* when = p;
+        p = putWeekdayTime(w, p, dose);
+        while (p - when < 10) *p++ = ' ';
+        *p++ = ' ';
+        p = putPadded(p, t->name, 20);
+        *p++ = ' ';
+        p = putPadded(p, t->dosage, 10);
+        *p++ = ' ';
+        p = putPadded(p, t->instructions, 30);
+        *p++ = '\n';
+        reportEndRow(w, p);
+        time_t next = nextOccurrence(&store->rules[node.handle], dose);
+        if (next >= 0 && doseKey(next) <= limit) enqueuePQ(&upcoming, node.handle, doseKey(next));
+    }
+    freePriorityQueue(&upcoming);
+}
+
+void displayPriorityQueue(PriorityQueue* pq, MedicineStore* store) {
+    ReportWriter w;
+    if (!openTerminalReport(&w)) {
+        printf("\n✗ Out of memory!\n");
+        return;
+    }
+    writePriorityQueue(&w, pq, store, time(NULL));
+    closeReport(&w);
+}
+
+// REMINDER SCHEDULER - a background thread that fires each medicine's reminders at its doses,
+// following its recurrence rule. Timers live in a hierarchical timing wheel: 5 levels of 64 slots, 1 ms ticks at the
+// bottom, so insert and cancel are O(1) (unlink from a slot list) and 64^5 ms (~12 days) is in
+// range. A timer sits in the level that matches how far off it is and drops down a level
+// (cascades) as its time gets closer. The thread works out the next tick anything happens
+// from the slot bitmaps and sleeps on a condition variable until exactly then - no polling.
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 5
+#define REMINDER_NO_SLOT (-1)
+
+typedef struct ReminderFired {
+    int handle;// store handle the timer belongs to
+    MedicineId id;
+    time_t doseTime;// wall-clock time of the dose, 0 for one-shot timers
+    long long dueNs;// monotonic time it was due
+    long long firedNs;// monotonic time the callback was called
+} ReminderFired;
+
+// Called on the scheduler thread, without the scheduler lock (so it may arm / cancel)
+typedef void (*ReminderCallback)(void* ctx, const ReminderFired* fired);
+
+typedef struct ReminderScheduler {
+    // one timer per store handle, struct of arrays like the store
+    long long* due;// monotonic ms
+    int* next;
+    int* prev;
+    int* slot;// level * WHEEL_SLOTS + slot it's linked into, or REMINDER_NO_SLOT
+    MedicineId* ids;
+    int64_t* doseTimes;// dose the timer is for, 0 = one-shot
+    RecurrenceRule* rules;// copy of each repeating timer's rule (allocated once one is armed)
+    int capacity;
+    int pending;// timers in the wheel
+    int heads[WHEEL_LEVELS * WHEEL_SLOTS];// first timer in each slot, -1 if empty
+    unsigned long long occupied[WHEEL_LEVELS];// bit per non-empty slot
+    long long current;// next tick (ms) to process
+    long long sleepUntil;// tick the thread is sleeping until (LLONG_MAX = until woken)
+    ReminderFired* fired;// dispatch buffer, reused every wakeup
+    int firedCount;
+    int firedCapacity;
+    ReminderCallback callback;
+    void* ctx;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_t thread;
+    int running;
+    int stop;
+} ReminderScheduler;
+
+static long long monotonicNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Monotonic ms at which the wall clock will show t
+static long long monotonicMsAt(time_t t) {
+    struct timespec wall;
+    clock_gettime(CLOCK_REALTIME, &wall);
+    long long wallMs = (long long)wall.tv_sec * 1000 + wall.tv_nsec / 1000000;
+    return monotonicNs() / 1000000 + ((long long)t * 1000 - wallMs);
+}
+
+int initReminderScheduler(ReminderScheduler* s, ReminderCallback callback, void* ctx) {
+    memset(s, 0, sizeof(*s));
+    for (int i = 0; i < WHEEL_LEVELS * WHEEL_SLOTS; i++) s->heads[i] = -1;
+    s->current = monotonicNs() / 1000000;
+    s->sleepUntil = LLONG_MAX;
+    s->callback = callback;
+    s->ctx = ctx;
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);// wall clock jumps don't stretch a sleep
+    int ok = pthread_mutex_init(&s->lock, NULL) == 0 && pthread_cond_init(&s->wake, &attr) == 0;
+    pthread_condattr_destroy(&attr);
+    if (!ok) printf("Could not set up the reminder scheduler\n");
+    return ok;
+}
+
+// Make room for timers up to `handle` (and their rules, if withRules). Caller holds the lock
+static int growReminders(ReminderScheduler* s, int handle, int withRules) {
+    if (withRules && !s->rules && s->capacity > 0) {
+        s->rules = (RecurrenceRule*)malloc((size_t)s->capacity * sizeof(RecurrenceRule));
+        if (!s->rules) {
+            printf("Memory allocation failed!\n");
+            return 0;
+        }
+    }
+    if (handle < s->capacity) return 1;
+    int newCapacity = s->capacity ? s->capacity : TABLE_SIZE;
+    while (newCapacity <= handle) newCapacity *= 2;
+    long long* due = (long long*)realloc(s->due, (size_t)newCapacity * sizeof(long long));
+    if (due) s->due = due;
+    int* next = (int*)realloc(s->next, (size_t)newCapacity * sizeof(int));
+    if (next) s->next = next;
+    int* prev = (int*)realloc(s->prev, (size_t)newCapacity * sizeof(int));
+    if (prev) s->prev = prev;
+    int* slot = (int*)realloc(s->slot, (size_t)newCapacity * sizeof(int));
+    if (slot) s->slot = slot;
+    MedicineId* ids = (MedicineId*)realloc(s->ids, (size_t)newCapacity * sizeof(MedicineId));
+    if (ids) s->ids = ids;
+    int64_t* doseTimes = (int64_t*)realloc(s->doseTimes, (size_t)newCapacity * sizeof(int64_t));
+    if (doseTimes) s->doseTimes = doseTimes;
+    RecurrenceRule* rules = NULL;
+    if (withRules || s->rules) {
+        rules = (RecurrenceRule*)realloc(s->rules, (size_t)newCapacity * sizeof(RecurrenceRule));
+        if (rules) s->rules = rules;
+    }
+    if (!due || !next || !prev || !slot || !ids || !doseTimes || ((withRules || s->rules) && !rules)) {
+        printf("Memory allocation failed!\n");
+        return 0;
+    }
+    for (int h = s->capacity; h < newCapacity; h++) s->slot[h] = REMINDER_NO_SLOT;
+    s->capacity = newCapacity;
+    return 1;
+}
+
+// Put a timer into the slot for its due tick, or for tick `earliest` if it's already late. That's
+// s->current outside runWheelTick (the next tick to run); while a tick is firing, its level-0
+// slot is already emptied, so timers re-armed there pass s->current + 1
+static void linkTimer(ReminderScheduler* s, int h, long long earliest) {
+    long long when = s->due[h] > earliest ? s->due[h] : earliest;
+    unsigned long long delta = (unsigned long long)(when - s->current);
+    int level = delta < WHEEL_SLOTS ? 0 : (63 - __builtin_clzll(delta)) / WHEEL_BITS;
+    if (level >= WHEEL_LEVELS) {// past the top level: park it at the far end, it cascades back down
+        level = WHEEL_LEVELS - 1;
+        when = s->current + (1LL << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+    }
+    int index = (int)(when >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1);
+    int slot = level * WHEEL_SLOTS + index;
+    s->prev[h] = -1;
+    s->next[h] = s->heads[slot];
+    if (s->heads[slot] >= 0) s->prev[s->heads[slot]] = h;
+    s->heads[slot] = h;
+    s->slot[h] = slot;
+    s->occupied[level] |= 1ULL << index;
+}
+
+static void unlinkTimer(ReminderScheduler* s, int h) {
+    int slot = s->slot[h];
+    if (s->prev[h] >= 0) s->next[s->prev[h]] = s->next[h];
+    else s->heads[slot] = s->next[h];
+    if (s->next[h] >= 0) s->prev[s->next[h]] = s->prev[h];
+    if (s->heads[slot] < 0) s->occupied[slot / WHEEL_SLOTS] &= ~(1ULL << (slot % WHEEL_SLOTS));
+    s->slot[h] = REMINDER_NO_SLOT;
+}
+
+// First tick at which a slot fires or cascades, -1 when the wheel is empty
+static long long nextWheelTick(ReminderScheduler* s) {
+    long long best = -1;
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        if (!s->occupied[level]) continue;
+        int shift = WHEEL_BITS * level;
+        int index = (int)(s->current >> shift) & (WHEEL_SLOTS - 1);
+        // rotate so the current slot is bit 0, then the lowest set bit is the nearest slot
+        unsigned long long rotated = s->occupied[level] >> index | (index ? s->occupied[level] << (WHEEL_SLOTS - index) : 0);
+        long long tick = ((s->current >> shift) + __builtin_ctzll(rotated)) << shift;
+        if (level > 0 && tick < s->current) tick += 1LL << (shift + WHEEL_BITS);// this slot's turn came round already
+        if (best < 0 || tick < best) best = tick;
+    }
+    return best;
+}
+
+// Process the current tick: cascade higher slots that start here, then fire level 0
+static int runWheelTick(ReminderScheduler* s) {
+    for (int level = 1; level < WHEEL_LEVELS; level++) {
+        int shift = WHEEL_BITS * level;
+        if (s->current & ((1LL << shift) - 1)) break;
+        int slot = level * WHEEL_SLOTS + ((int)(s->current >> shift) & (WHEEL_SLOTS - 1));
+        int h = s->heads[slot];
+        s->heads[slot] = -1;
+        s->occupied[level] &= ~(1ULL << (slot % WHEEL_SLOTS));
+        while (h >= 0) {
+            int next = s->next[h];
+            linkTimer(s, h, s->current);// level 0 of this tick hasn't run yet
+            h = next;
+        }
+    }
+    int slot = (int)(s->current & (WHEEL_SLOTS - 1));
+    int h = s->heads[slot];
+    s->heads[slot] = -1;
+    s->occupied[0] &= ~(1ULL << slot);
+    while (h >= 0) {
+        int next = s->next[h];
+        s->slot[h] = REMINDER_NO_SLOT;
+        s->pending--;
+        if (s->firedCount == s->firedCapacity) {
+            int newCapacity = s->firedCapacity ? s->firedCapacity * 2 : 64;
+            ReminderFired* fired = (ReminderFired*)realloc(s->fired, (size_t)newCapacity * sizeof(ReminderFired));
+            if (!fired) {
+                printf("Memory allocation failed!\n");
+                return 0;
+            }
+            s->fired = fired;
+            s->firedCapacity = newCapacity;
+        }
+        s->fired[s->firedCount++] = (ReminderFired){h, s->ids[h], (time_t)s->doseTimes[h], s->due[h] * 1000000, 0};
+        if (s->doseTimes[h] != 0) {// repeating: straight back in for the rule's next dose
+            time_t nextDose = nextOccurrence(&s->rules[h], (time_t)s->doseTimes[h]);
+            if (nextDose >= 0) {
+                s->doseTimes[h] = nextDose;
+                s->due[h] = monotonicMsAt(nextDose);
+                linkTimer(s, h, s->current + 1);// already due (after a suspend / catch-up): the very next tick
+                s->pending++;
+            }
+        }
+        h = next;
+    }
+    s->current++;
+    return 1;
+}
+
+// Arm (or re-arm) the timer for a handle at a monotonic ms; rule NULL = one-shot.
+// Caller holds the lock
+static int setReminderLocked(ReminderScheduler* s, int handle, MedicineId id, long long dueMs,
+                             const RecurrenceRule* rule, time_t doseTime) {
+    if (!growReminders(s, handle, rule != NULL)) return 0;
+    if (s->slot[handle] != REMINDER_NO_SLOT) {
+        unlinkTimer(s, handle);
+        s->pending--;
+    }
+    s->due[handle] = dueMs;
+    s->ids[handle] = id;
+    s->doseTimes[handle] = rule ? doseTime : 0;
+    if (rule) s->rules[handle] = *rule;// the thread works out the next dose from its own copy
+    linkTimer(s, handle, s->current);
+    s->pending++;
+    if (dueMs < s->sleepUntil) pthread_cond_signal(&s->wake);// only wake the thread if it'd sleep past this
+    return 1;
+}
+
+// Drop a handle's pending reminder, O(1). One already being dispatched still goes out
+void cancelReminder(ReminderScheduler* s, int handle) {
+    pthread_mutex_lock(&s->lock);
+    if (handle < s->capacity && s->slot[handle] != REMINDER_NO_SLOT) {
+        unlinkTimer(s, handle);
+        s->pending--;
+    }
+    pthread_mutex_unlock(&s->lock);
+}
+
+// Fire at every dose of a rule, starting with the next one. A rule with no doses left
+// just cancels whatever was armed
+int armReminder(ReminderScheduler* s, int handle, MedicineId id, const RecurrenceRule* rule) {
+    time_t next = nextOccurrence(rule, time(NULL));
+    if (next < 0) {
+        cancelReminder(s, handle);
+        return 1;
+    }
+    pthread_mutex_lock(&s->lock);
+    int ok = setReminderLocked(s, handle, id, monotonicMsAt(next), rule, next);
+    pthread_mutex_unlock(&s->lock);
+    return ok;
+}
+
+// Fire once at a monotonic time in ns (rounded up to the next ms tick)
+int armReminderAt(ReminderScheduler* s, int handle, MedicineId id, long long dueNs) {
+    pthread_mutex_lock(&s->lock);
+    int ok = setReminderLocked(s, handle, id, (dueNs + 999999) / 1000000, NULL, 0);
+    pthread_mutex_unlock(&s->lock);
+    return ok;
+}
+
+static void* reminderThread(void* arg) {
+    ReminderScheduler* s = (ReminderScheduler*)arg;
+    pthread_mutex_lock(&s->lock);
+    while (!s->stop) {
+        long long nowMs = monotonicNs() / 1000000;
+        // jump straight to each tick where something happens, nothing in between needs a look
+        long long tick;
+        while ((tick = nextWheelTick(s)) >= 0 && tick <= nowMs) {
+            s->current = tick;
+            if (!runWheelTick(s)) break;
+        }
+        if (s->current <= nowMs) s->current = nowMs + 1;
+        if (s->firedCount > 0) {
+            int count = s->firedCount;
+            int capacity = s->firedCapacity;
+            s->firedCount = 0;
+            ReminderFired* fired = s->fired;
+            s->fired = NULL;// callbacks may arm timers: they won't touch this batch
+            s->firedCapacity = 0;
+            pthread_mutex_unlock(&s->lock);
+            for (int i = 0; i < count; i++) {
+                fired[i].firedNs = monotonicNs();
+                s->callback(s->ctx, &fired[i]);
+            }
+            pthread_mutex_lock(&s->lock);
+            if (!s->fired) {// hand the buffer back for the next wakeup
+                s->fired = fired;
+                s->firedCapacity = capacity;
+            } else {
+                free(fired);
+            }
+            continue;// time has moved on while dispatching
+        }
+        tick = nextWheelTick(s);
+        if (tick < 0) {
+            s->sleepUntil = LLONG_MAX;
+            pthread_cond_wait(&s->wake, &s->lock);
+        } else {
+            struct timespec until = {(time_t)(tick / 1000), (long)(tick % 1000) * 1000000};
+            s->sleepUntil = tick;
+            pthread_cond_timedwait(&s->wake, &s->lock, &until);
+        }
+        s->sleepUntil = LLONG_MIN;// awake: arming doesn't need to signal
+    }
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+int startReminderScheduler(ReminderScheduler* s) {
+    s->stop = 0;
+    s->running = pthread_create(&s->thread, NULL, reminderThread, s) == 0;
+    if (!s->running) printf("Could not start the reminder thread\n");
+    return s->running;
+}
+
+// Stop the thread (if it runs) and free everything
+void freeReminderScheduler(ReminderScheduler* s) {
+    if (s->running) {
+        pthread_mutex_lock(&s->lock);
+        s->stop = 1;
+        pthread_cond_signal(&s->wake);
+        pthread_mutex_unlock(&s->lock);
+        pthread_join(s->thread, NULL);
+        s->running = 0;
+    }
+    free(s->due);
+    free(s->next);
+    free(s->prev);
+    free(s->slot);
+    free(s->ids);
+    free(s->doseTimes);
+    free(s->rules);
+    free(s->fired);
+    pthread_cond_destroy(&s->wake);
+    pthread_mutex_destroy(&s->lock);
+    memset(s, 0, sizeof(*s));
+}
+
+// WARD - many patients at once. Patients are hashed into shards; each shard has its own
+// store, HashMap, reminder queue and history (the same structures the single-patient menu
+// uses) behind one lock, so work on different shards never meets. A pool of worker threads
+// runs a task over every shard with work stealing, and ward-wide queries ("what's due in
+// the next 15 minutes") merge the shards' queues with a k-way merge.
+typedef long long PatientId;
+
+typedef struct PatientShard {
+    pthread_mutex_t lock;
+    MedicineStore store;
+    HashMap map;
+    PriorityQueue pq;
+    LinkedList history;
+    PatientId* patients;// patient of each store handle
+    int patientCapacity;
+} __attribute__((aligned(64))) PatientShard;
+
+typedef struct Ward {
+    PatientShard* shards;
+    int shardCount;// power of two
+} Ward;
+
+// One due dose in a ward-wide query
+typedef struct WardDose {
+    int key;// dose time, minutes since the epoch
+    int shard;
+    int handle;
+    PatientId patient;
+    MedicineId medicine;
+} WardDose;
+
+// shardCount is rounded up to a power of two. Returns 1 on success
+int initWard(Ward* ward, int shardCount) {
+    int count = 1;
+    while (count < shardCount) count *= 2;
+    ward->shards = (PatientShard*)aligned_alloc(64, (size_t)count * sizeof(PatientShard));
+    ward->shardCount = 0;
+    if (!ward->shards) {
+        printf("Memory allocation failed!\n");
+        return 0;
+    }
+    for (int i = 0; i < count; i++) {
+        PatientShard* shard = &ward->shards[i];
+        memset(shard, 0, sizeof(*shard));
+        pthread_mutex_init(&shard->lock, NULL);
+        initLinkedList(&shard->history);
+        ward->shardCount = i + 1;// so freeWard only frees what was set up
+        if (!initMedicineStore(&shard->store) || !initHashMap(&shard->map) || !initPriorityQueue(&shard->pq)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void freeWard(Ward* ward) {
+    for (int i = 0; i < ward->shardCount; i++) {
+        PatientShard* shard = &ward->shards[i];
+        freeLinkedList(&shard->history);
+        freeHashMap(&shard->map);
+        freePriorityQueue(&shard->pq);
+        freeMedicineStore(&shard->store);
+        free(shard->patients);
+        pthread_mutex_destroy(&shard->lock);
+    }
+    free(ward->shards);
+    ward->shards = NULL;
+    ward->shardCount = 0;
+}
+
+int wardShardOf(const Ward* ward, PatientId patient) {
+    return hashFunction(patient, ward->shardCount);
+}
+
+// Add a medicine for a patient, queued at its next dose after `now`. Returns its handle in
+// the patient's shard, or -1
+int addWardMedicine(Ward* ward, PatientId patient, const Medicine* med, const RecurrenceRule* rule, time_t now) {
+    PatientShard* shard = &ward->shards[wardShardOf(ward, patient)];
+    pthread_mutex_lock(&shard->lock);
+    int handle = searchMedicine(&shard->map, med->id) >= 0 ? -1 : addToStore(&shard->store, med);
+    if (handle >= 0 && handle >= shard->patientCapacity) {
+        int newCapacity = shard->patientCapacity ? shard->patientCapacity * 2 : TABLE_SIZE;
+        while (newCapacity <= handle) newCapacity *= 2;
+        PatientId* patients = (PatientId*)realloc(shard->patients, (size_t)newCapacity * sizeof(PatientId));
+        if (patients) {
+            shard->patients = patients;
+            shard->patientCapacity = newCapacity;
+        }
+    }
+    if (handle >= 0 && (handle >= shard->patientCapacity || !insertMedicine(&shard->map, med->id, handle))) {
+        removeFromStore(&shard->store, handle);
+        handle = -1;
+    }
+    if (handle >= 0) {
+        shard->patients[handle] = patient;
+        if (rule) shard->store.rules[handle] = *rule;
+        scheduleNextDose(&shard->pq, &shard->store, handle, now);
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return handle;
+}
+
+// Every dose due by now + windowMinutes across the ward, in time order (overdue ones first).
+// Each shard's queue is a heap, so ScheduleIterator reads its due doses off in order while
+// just that shard is locked; then a small heap over the shards' sorted runs merges them:
+// O(k log shards) for k results. Writes at most max doses into out and returns how many
+int dueAcrossWard(Ward* ward, time_t now, int windowMinutes, WardDose* out, int max) {
+    int limit = doseKey(now) + windowMinutes;
+    int shards = ward->shardCount;
+    int* runStart = (int*)malloc((size_t)(shards + 1) * sizeof(int));// shard s owns runs[runStart[s] .. runStart[s + 1])
+    int* cursor = (int*)malloc((size_t)shards * sizeof(int));
+    int* heap = (int*)malloc((size_t)shards * sizeof(int));
+    int runCapacity = 256, runCount = 0;
+    WardDose* runs = (WardDose*)malloc((size_t)runCapacity * sizeof(WardDose));
+    if (!runStart || !cursor || !heap || !runs) {
+        free(runStart);
+        free(cursor);
+        free(heap);
+        free(runs);
+        return 0;
+    }
+    for (int s = 0; s < shards; s++) {
+        PatientShard* shard = &ward->shards[s];
+        ScheduleIterator it;
+        PQNode node;
+        runStart[s] = runCount;
+        pthread_mutex_lock(&shard->lock);
+        initScheduleIterator(&it, &shard->pq);
+        // a shard never needs to give more than max: the first max of the ward are among them
+        while (runCount - runStart[s] < max && nextScheduled(&it, &node) && node.priority <= limit) {
+            if (runCount == runCapacity) {
+                WardDose* grown = (WardDose*)realloc(runs, (size_t)runCapacity * 2 * sizeof(WardDose));
+                if (!grown) break;
+                runs = grown;
+                runCapacity *= 2;
+            }
+            runs[runCount++] = (WardDose){node.priority, s, node.handle, shard->patients[node.handle],
+                                          shard->store.ids[node.handle]};
+        }
+        freeScheduleIterator(&it);
+        pthread_mutex_unlock(&shard->lock);
+    }
+    runStart[shards] = runCount;
+
+    // k-way merge: heap of shards ordered by the key at their cursor
+    int size = 0, found = 0;
+    for (int s = 0; s < shards; s++) {
+        cursor[s] = runStart[s];
+        if (cursor[s] == runStart[s + 1]) continue;
+        int index = size++;
+        while (index > 0 && runs[cursor[s]].key < runs[cursor[heap[(index - 1) / 2]]].key) {
+            heap[index] = heap[(index - 1) / 2];
+            index = (index - 1) / 2;
+        }
+        heap[index] = s;
+    }
+    while (size > 0 && found < max) {
+        int top = heap[0];
+        out[found++] = runs[cursor[top]++];
+        // that run moves on; if it's used up, the last run takes its place at the top
+        int moving = cursor[top] < runStart[top + 1] ? top : heap[--size];
+        int index = 0;
+        while (size > 0) {
+            int child = 2 * index + 1;
+            if (child >= size) break;
+            if (child + 1 < size && runs[cursor[heap[child + 1]]].key < runs[cursor[heap[child]]].key) child++;
+            if (runs[cursor[heap[child]]].key >= runs[cursor[moving]].key) break;
+            heap[index] = heap[child];
+            index = child;
+        }
+        if (size > 0) heap[index] = moving;
+    }
+    free(runStart);
+    free(cursor);
+    free(heap);
+    free(runs);
+    return found;
+}
+
+// Worker pool. A pass hands every worker an even slice of the shard indices; a worker eats
+// its slice from the front and, once it's empty, steals the back half of another worker's
+// slice. A slice is one 64-bit word (lo | hi << 32) changed only by CAS, so taking and
+// stealing never lock. Shards differ a lot in size, stealing evens that out.
+typedef void (*ShardTask)(PatientShard* shard, int shardIndex, void* ctx);
+
+struct WardPool;
+typedef struct WardWorker {
+    unsigned long long range;// [lo, hi) of shard indices still to do (atomic)
+    struct WardPool* pool;
+    pthread_t thread;
+    int index;
+    long long shardsDone;
+    long long steals;
+} __attribute__((aligned(64))) WardWorker;
+
+typedef struct WardPool {
+    Ward* ward;
+    WardWorker* workers;
+    int workerCount;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    unsigned generation;// bumped for every pass
+    int active;// workers still in the current pass
+    int stop;
+    ShardTask task;
+    void* ctx;
+} WardPool;
+
+#define WARD_RANGE(lo, hi) ((unsigned long long)(unsigned)(lo) | (unsigned long long)(hi) << 32)
+
+// Next shard from the front of our own slice, -1 if it's empty
+static int takeOwnShard(WardWorker* w) {
+    unsigned long long range = __atomic_load_n(&w->range, __ATOMIC_ACQUIRE);
+    while (1) {
+        unsigned lo = (unsigned)range, hi = (unsigned)(range >> 32);
+        if (lo >= hi) return -1;
+        if (__atomic_compare_exchange_n(&w->range, &range, WARD_RANGE(lo + 1, hi), 1, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE)) {
+            return (int)lo;
+        }
+    }
+}
+
+// Move the back half of some other worker's slice into ours. Returns 0 when nobody has any left
+static int stealShards(WardWorker* w) {
+    WardPool* pool = w->pool;
+    for (int k = 1; k < pool->workerCount; k++) {
+        WardWorker* victim = &pool->workers[(w->index + k) % pool->workerCount];
+        unsigned long long range = __atomic_load_n(&victim->range, __ATOMIC_ACQUIRE);
+        while (1) {
+            unsigned lo = (unsigned)range, hi = (unsigned)(range >> 32);
+            if (lo >= hi) break;
+            unsigned split = hi - (hi - lo + 1) / 2;
+            if (__atomic_compare_exchange_n(&victim->range, &range, WARD_RANGE(lo, split), 1, __ATOMIC_ACQ_REL,
+                                            __ATOMIC_ACQUIRE)) {
+                __atomic_store_n(&w->range, WARD_RANGE(split, hi), __ATOMIC_RELEASE);
+                w->steals++;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+static void* wardWorkerThread(void* arg) {
+    WardWorker* w = (WardWorker*)arg;
+    WardPool* pool = w->pool;
+    unsigned seen = 0;
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        while (!pool->stop && pool->generation == seen) pthread_cond_wait(&pool->start, &pool->lock);
+        if (pool->stop) break;
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+        int shard;
+        do {
+            while ((shard = takeOwnShard(w)) >= 0) {
+                pool->task(&pool->ward->shards[shard], shard, pool->ctx);
+                w->shardsDone++;
+            }
+        } while (stealShards(w));
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->active == 0) pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+// Start `workers` threads for a ward. Returns 1 on success
+int initWardPool(WardPool* pool, Ward* ward, int workers) {
+    memset(pool, 0, sizeof(*pool));
+    pool->ward = ward;
+    pool->workers = (WardWorker*)aligned_alloc(64, (size_t)workers * sizeof(WardWorker));
+    if (!pool->workers) {
+        printf("Memory allocation failed!\n");
+        return 0;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    for (int i = 0; i < workers; i++) {
+        WardWorker* w = &pool->workers[i];
+        memset(w, 0, sizeof(*w));
+        w->pool = pool;
+        w->index = i;
+        if (pthread_create(&w->thread, NULL, wardWorkerThread, w) != 0) {
+            printf("Could not start ward worker %d\n", i);
+            break;
+        }
+        pool->workerCount = i + 1;
+    }
+    return pool->workerCount == workers;
+}
+
+// Run task once on every shard, spread over the pool; returns when all are done
+void runWardPass(WardPool* pool, ShardTask task, void* ctx) {
+    int n = pool->ward->shardCount, workers = pool->workerCount;
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->ctx = ctx;
+    for (int i = 0; i < workers; i++) {
+        __atomic_store_n(&pool->workers[i].range, WARD_RANGE((long long)n * i / workers, (long long)n * (i + 1) / workers),
+                         __ATOMIC_RELAXED);
+    }
+    pool->active = workers;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    while (pool->active > 0) pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void freeWardPool(WardPool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->workerCount; i++) pthread_join(pool->workers[i].thread, NULL);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->workers);
+    memset(pool, 0, sizeof(*pool));
+}
+
+// FILE SAVING - binary snapshot of the store, HashMap and schedule
+// Saved on exit, mmap'd on start: the arrays are used right where they sit in the file
+
+// Simple 64-bit checksum, 8 bytes per step (catches torn/corrupted files, not tampering)
+static uint64_t checksum64(uint64_t h, const void* data, size_t len) {
+    const unsigned char* p = (const unsigned char*)data;
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        h = (h ^ word) * 0x100000001b3ULL;
+        h ^= h >> 29;
+        p += 8;
+        len -= 8;
+    }
+    while (len--) {
+        h = (h ^ *p++) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+#define CHECKSUM_SEED 0xcbf29ce484222325ULL
+
+// Write the snapshot to a temp file, then rename it over the old one (never half-written)
+int saveSnapshot(const char* path, MedicineStore* store, HashMap* map, PriorityQueue* pq) {
+    char tmpPath[512];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+    FILE* fp = fopen(tmpPath, "wb");
+    if (!fp) {
+        printf("Could not write %s\n", tmpPath);
+        return 0;
+    }
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.headerSize = sizeof(header);
+    header.storeUsed = store->used;
+    header.storeCount = store->count;
+    header.freeCount = store->freeCount;
+    header.mapCapacity = map->capacity;
+    header.mapCount = map->count;
+    header.mapTombstones = map->tombstones;
+    header.pqSize = pq->size;
+    header.posCapacity = pq->posCapacity;
+
+    // freeSlots is saved at full length so it can still take every handle after loading
+    const void* data[SEC_COUNT] = {store->ids, store->priorities, store->flags, store->text,
+                                   store->freeSlots, map->table, pq->heap, pq->pos, store->rules};
+    uint64_t length[SEC_COUNT] = {
+        (uint64_t)store->used * sizeof(MedicineId), (uint64_t)store->used * sizeof(int),
+        (uint64_t)store->used, (uint64_t)store->used * sizeof(MedicineText),
+        (uint64_t)store->used * sizeof(int), (uint64_t)map->capacity * sizeof(HashNode),
+        (uint64_t)pq->size * sizeof(PQNode), (uint64_t)pq->posCapacity * sizeof(int),
+        (uint64_t)store->used * sizeof(RecurrenceRule)};
+
+    static const char zeros[64] = {0};
+    uint64_t offset = (sizeof(header) + 63) & ~(uint64_t)63;
+    int ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+             (offset == sizeof(header) || fwrite(zeros, offset - sizeof(header), 1, fp) == 1);
+    header.hotChecksum = CHECKSUM_SEED;
+    header.textChecksum = CHECKSUM_SEED;
+    for (int i = 0; i < SEC_COUNT && ok; i++) {
+        header.offset[i] = offset;
+        header.length[i] = length[i];
+        if (length[i] > 0) ok = fwrite(data[i], (size_t)length[i], 1, fp) == 1;
+        uint64_t padded = (length[i] + 63) & ~(uint64_t)63;
+        if (ok && padded > length[i]) ok = fwrite(zeros, (size_t)(padded - length[i]), 1, fp) == 1;
+        if (i == SEC_TEXT) {
+            header.textChecksum = checksum64(header.textChecksum, data[i], (size_t)length[i]);
+        } else {
+            header.hotChecksum = checksum64(header.hotChecksum, data[i], (size_t)length[i]);
+        }
+        offset += padded;
+    }
+    header.headerChecksum = checksum64(CHECKSUM_SEED, &header, sizeof(header));
+    // header goes in last, once the offsets and checksums are known
+    ok = ok && fseek(fp, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, fp) == 1;
+    ok = ok && fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+    ok = (fclose(fp) == 0) && ok;
+    if (!ok || rename(tmpPath, path) != 0) {
+        printf("Failed to save %s\n", path);
+        remove(tmpPath);
+        return 0;
+    }
+    return 1;
+}
+
+// Read and checksum the header into the current layout (older headers have no rules section).
+// Returns 0 if it isn't a snapshot header we know
+static int readSnapshotHeader(const void* base, size_t fileSize, SnapshotHeader* h) {
+    memcpy(h, base, sizeof(SnapshotHeaderV2));// the smaller of the two, and the file is at least this big
+    if (memcmp(h->magic, SNAPSHOT_MAGIC, sizeof(h->magic)) != 0) return 0;
+    if (h->version == SNAPSHOT_VERSION) {
+        if (fileSize < sizeof(SnapshotHeader) || h->headerSize != sizeof(SnapshotHeader)) return 0;
+        memcpy(h, base, sizeof(SnapshotHeader));
+        SnapshotHeader copy = *h;
+        copy.headerChecksum = 0;
+        return checksum64(CHECKSUM_SEED, &copy, sizeof(copy)) == h->headerChecksum;
+    }
+    if (h->version != 1 && h->version != 2) return 0;
+    SnapshotHeaderV2 old;
+    memcpy(&old, base, sizeof(old));
+    uint64_t stored = old.headerChecksum;
+    old.headerChecksum = 0;
+    if (old.headerSize != sizeof(old) || checksum64(CHECKSUM_SEED, &old, sizeof(old)) != stored) return 0;
+    for (int i = 0; i < SEC_RULES; i++) {
+        h->offset[i] = old.offset[i];
+        h->length[i] = old.length[i];
+    }
+    h->offset[SEC_RULES] = 0;
+    h->length[SEC_RULES] = 0;
+    h->hotChecksum = old.hotChecksum;
+    h->textChecksum = old.textChecksum;
+    h->headerChecksum = stored;
+    return 1;
+}
+
+// Check the header describes sections that fit the file and match the counts
+static int snapshotHeaderValid(const SnapshotHeader* h, size_t fileSize) {
+    if (h->storeUsed < 0 || h->storeCount < 0 || h->storeCount > h->storeUsed ||
+        h->freeCount < 0 || h->freeCount > h->storeUsed || h->pqSize < 0 || h->pqSize > h->storeUsed ||
+        h->posCapacity < 0 || h->mapCapacity < INITIAL_CAPACITY ||
+        (h->mapCapacity & (h->mapCapacity - 1)) != 0 ||
+        h->mapCount + h->mapTombstones >= h->mapCapacity) {
+        return 0;
+    }
+    uint64_t idSize = h->version == 1 ? sizeof(int32_t) : sizeof(MedicineId);
+    uint64_t nodeSize = h->version == 1 ? 2 * sizeof(int32_t) : sizeof(HashNode);
+    uint64_t expected[SEC_COUNT] = {
+        (uint64_t)h->storeUsed * idSize, (uint64_t)h->storeUsed * sizeof(int),
+        (uint64_t)h->storeUsed, (uint64_t)h->storeUsed * sizeof(MedicineText),
+        (uint64_t)h->storeUsed * sizeof(int), (uint64_t)h->mapCapacity * nodeSize,
+        (uint64_t)h->pqSize * sizeof(PQNode), (uint64_t)h->posCapacity * sizeof(int),
+        h->version < 3 ? 0 : (uint64_t)h->storeUsed * sizeof(RecurrenceRule)};
+    for (int i = 0; i < SEC_COUNT; i++) {
+        if (h->length[i] != expected[i] || h->offset[i] % 64 != 0 ||
+            h->offset[i] > fileSize || h->length[i] > fileSize - h->offset[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Older snapshots can't be used in place: v1 had 32-bit IDs, and before v3 there were no
+// rules and the heap was keyed by time of day. Copy them into fresh structures instead
+// (HashMap rebuilt for v1, every medicine daily, heap re-keyed by next dose). The next save
+// writes the current version
+static int upgradeSnapshot(const char* b, const SnapshotHeader* h, MedicineStore* store, HashMap* map,
+                           PriorityQueue* pq) {
+    MedicineStore newStore;
+    HashMap newMap;
+    PriorityQueue newQueue;
+    int ok = initMedicineStore(&newStore) & initHashMap(&newMap) & initPriorityQueue(&newQueue);
+    while (ok && newStore.capacity < h->storeUsed) ok = growMedicineStore(&newStore);
+    if (ok) {
+        if (h->version == 1) {
+            const int32_t* ids = (const int32_t*)(b + h->offset[SEC_IDS]);
+            for (int i = 0; i < h->storeUsed; i++) newStore.ids[i] = ids[i];
+        } else {
+            memcpy(newStore.ids, b + h->offset[SEC_IDS], (size_t)h->length[SEC_IDS]);
+        }
+        memcpy(newStore.priorities, b + h->offset[SEC_PRIORITIES], (size_t)h->length[SEC_PRIORITIES]);
+        memcpy(newStore.flags, b + h->offset[SEC_FLAGS], (size_t)h->length[SEC_FLAGS]);
+        memcpy(newStore.text, b + h->offset[SEC_TEXT], (size_t)h->length[SEC_TEXT]);
+        memcpy(newStore.freeSlots, b + h->offset[SEC_FREE], (size_t)h->length[SEC_FREE]);
+        newStore.used = h->storeUsed;
+        newStore.count = h->storeCount;
+        newStore.freeCount = h->freeCount;
+        for (int i = 0; i < newStore.used; i++) dailyRule(&newStore.rules[i], newStore.priorities[i]);
+        if (h->version == 1) {
+            for (int i = 0; i < newStore.used && ok; i++) {
+                if (newStore.flags[i] & MED_LIVE) ok = insertMedicine(&newMap, newStore.ids[i], i);
+            }
+        } else {
+            free(newMap.table);
+            newMap.table = (HashNode*)copyOut(b + h->offset[SEC_TABLE], (size_t)h->length[SEC_TABLE]);
+            newMap.capacity = h->mapCapacity;
+            newMap.count = h->mapCount;
+            newMap.tombstones = h->mapTombstones;
+            ok = newMap.table != NULL;
+        }
+        const PQNode* heap = (const PQNode*)(b + h->offset[SEC_HEAP]);
+        time_t now = time(NULL);
+        for (int i = 0; i < h->pqSize && ok; i++) {
+            int handle = heap[i].handle;
+            ok = handle >= 0 && handle < newStore.used &&
+                 appendPQ(&newQueue, handle, doseKey(nextOccurrence(&newStore.rules[handle], now)));
+        }
+        buildHeapPQ(&newQueue, 0);
+    }
+    if (!ok) {
+        freeMedicineStore(&newStore);
+        freeHashMap(&newMap);
+        freePriorityQueue(&newQueue);
+        return 0;
+    }
+    freeMedicineStore(store);
+    freeHashMap(map);
+    freePriorityQueue(pq);
+    *store = newStore;
+    *map = newMap;
+    *pq = newQueue;
+    return 1;
+}
+
+// mmap a snapshot and point the store, HashMap and queue straight at it (no parsing).
+// The mapping is private copy-on-write, so edits never touch the file; anything that
+// needs to grow is copied to the heap first. verifyText also checksums the text section.
+// Returns 1 on success; on failure the structures are left as they were.
+int loadSnapshot(const char* path, Snapshot* snap, MedicineStore* store, HashMap* map,
+                 PriorityQueue* pq, int verifyText) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 0;// no snapshot yet, start empty
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SnapshotHeader)) {
+        close(fd);
+        printf("Snapshot %s is too small, ignoring it\n", path);
+        return 0;
+    }
+    size_t size = (size_t)st.st_size;
+    void* base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);// the mapping keeps the file alive
+    if (base == MAP_FAILED) {
+        printf("Could not map %s\n", path);
+        return 0;
+    }
+    SnapshotHeader header;
+    const SnapshotHeader* h = &header;
+    int ok = readSnapshotHeader(base, size, &header) && snapshotHeaderValid(h, size);
+    if (ok) {
+        uint64_t hot = CHECKSUM_SEED;
+        for (int i = 0; i < SEC_COUNT; i++) {
+            if (i != SEC_TEXT) hot = checksum64(hot, (char*)base + h->offset[i], (size_t)h->length[i]);
+        }
+        ok = hot == h->hotChecksum;
+    }
+    if (ok && verifyText) {
+        ok = checksum64(CHECKSUM_SEED, (char*)base + h->offset[SEC_TEXT], (size_t)h->length[SEC_TEXT]) ==
+             h->textChecksum;
+    }
+    if (!ok) {
+        munmap(base, size);
+        printf("Snapshot %s is damaged or from another version, ignoring it\n", path);
+        return 0;
+    }
+
+    // adopt the mapped arrays
+    char* b = (char*)base;
+    if (h->version < SNAPSHOT_VERSION) {
+        ok = upgradeSnapshot(b, h, store, map, pq);
+        munmap(base, size);// nothing borrowed from it
+        if (!ok) printf("Could not upgrade snapshot %s\n", path);
+        return ok;
+    }
+    freeMedicineStore(store);
+    store->ids = (MedicineId*)(b + h->offset[SEC_IDS]);
+    store->priorities = (int*)(b + h->offset[SEC_PRIORITIES]);
+    store->flags = (unsigned char*)(b + h->offset[SEC_FLAGS]);
+    store->text = (MedicineText*)(b + h->offset[SEC_TEXT]);
+    store->freeSlots = (int*)(b + h->offset[SEC_FREE]);
+    store->rules = (RecurrenceRule*)(b + h->offset[SEC_RULES]);
+    store->freeCount = h->freeCount;
+    store->used = h->storeUsed;
+    store->count = h->storeCount;
+    store->capacity = h->storeUsed;
+    store->borrowed = 1;
+
+    freeHashMap(map);
+    map->table = (HashNode*)(b + h->offset[SEC_TABLE]);
+    map->capacity = h->mapCapacity;
+    map->count = h->mapCount;
+    map->tombstones = h->mapTombstones;
+    map->borrowed = 1;
+
+    freePriorityQueue(pq);
+    pq->heap = (PQNode*)(b + h->offset[SEC_HEAP]);
+    pq->size = h->pqSize;
+    pq->capacity = h->pqSize;
+    pq->pos = (int*)(b + h->offset[SEC_POS]);
+    pq->posCapacity = h->posCapacity;
+    pq->borrowed = 1;
+
+    snap->base = base;
+    snap->length = size;
+    return 1;
+}
+
+// Unmap a snapshot (free the structures that borrowed from it first)
+void closeSnapshot(Snapshot* snap) {
+    if (snap->base) munmap(snap->base, snap->length);
+    snap->base = NULL;
+    snap->length = 0;
+}
+
+// ID ALLOCATOR - 64-bit medicine IDs that never repeat, across restarts and threads.
+// An ID is (node << ID_SEQUENCE_BITS) | sequence: the node prefix keeps machines / shards apart,
+// the sequence only ever goes up. Sequences are leased from the ID file in big chunks, and a
+// lease is on disk before any ID in it is handed out - so after a crash we carry on from the
+// last lease end (skipping some IDs, never repeating one). Writers take IDs in batches with a
+// single atomic add; the lock is only taken when the lease has to be extended.
+#define ID_FILE "pillpilot.ids"
+#define ID_MAGIC "PPIDS1"
+#define ID_SEQUENCE_BITS 48
+#define ID_MAX_NODE 32767 //node fits in 15 bits, so IDs stay positive
+#define ID_LEASE_SIZE (1ULL << 20) //sequences reserved per ID file write
+#define ID_BATCH_SIZE 1024 //IDs a busy writer takes at a time
+
+typedef struct IdFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t node;
+    uint64_t leaseEnd;// every sequence below this may have been handed out
+    uint64_t checksum;
+} IdFileHeader;
+
+typedef struct IdAllocator {
+    int fd;
+    int node;
+    unsigned long long next;// next unused sequence (atomic)
+    unsigned long long leaseEnd;// sequences below this are reserved on disk (atomic)
+    int failed;// the ID file couldn't be written, no more IDs
+    pthread_mutex_t lock;// only for extending the lease
+} IdAllocator;
+
+// A writer's private run of IDs [next, end)
+typedef struct IdBatch {
+    MedicineId next;
+    MedicineId end;
+} IdBatch;
+
+// Write the lease end to the ID file and wait until it's durable
+static int writeIdFile(IdAllocator* a, unsigned long long leaseEnd) {
+    IdFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ID_MAGIC, sizeof(ID_MAGIC));
+    header.version = 1;
+    header.node = (uint32_t)a->node;
+    header.leaseEnd = leaseEnd;
+    header.checksum = checksum64(CHECKSUM_SEED, &header, sizeof(header));
+    return pwrite(a->fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) && fdatasync(a->fd) == 0;
+}
+
+// Open (or create) the ID file. node < 0 keeps the file's node (0 for a new file).
+// Returns 1 if an existing ID file was read, 0 if starting fresh, -1 on error
+int openIdAllocator(IdAllocator* a, const char* path, int node) {
+    memset(a, 0, sizeof(*a));
+    a->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (a->fd < 0) {
+        printf("Could not open %s\n", path);
+        return -1;
+    }
+    pthread_mutex_init(&a->lock, NULL);
+    int existed = 0;
+    IdFileHeader header;
+    if (pread(a->fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header)) {
+        uint64_t checksum = header.checksum;
+        header.checksum = 0;
+        if (memcmp(header.magic, ID_MAGIC, sizeof(ID_MAGIC)) == 0 && header.version == 1 &&
+            checksum64(CHECKSUM_SEED, &header, sizeof(header)) == checksum) {
+            a->node = (int)header.node;
+            a->next = header.leaseEnd;
+            existed = 1;
+        } else {
+            printf("ID file %s is damaged, continuing after the highest ID in use\n", path);
+        }
+    }
+    if (node >= 0) a->node = node;
+    if (a->node > ID_MAX_NODE) a->node = ID_MAX_NODE;
+    if (a->next == 0) a->next = 1;// ID 0 is never handed out
+    a->leaseEnd = a->next;// nothing leased yet this run
+    return existed;
+}
+
+// Never hand out IDs at or below one already in use (imported, or from before the ID file)
+void raiseIdFloor(IdAllocator* a, MedicineId used) {
+    if (used < 0 || (int)(used >> ID_SEQUENCE_BITS) != a->node) return;// another node's ID
+    unsigned long long sequence = (unsigned long long)used & ((1ULL << ID_SEQUENCE_BITS) - 1);
+    if (sequence >= a->next) a->next = sequence + 1;
+}
+
+// Reserve count consecutive IDs; *first gets the first one. Safe from any thread
+int reserveIds(IdAllocator* a, int count, MedicineId* first) {
+    unsigned long long sequence = __atomic_fetch_add(&a->next, (unsigned long long)count, __ATOMIC_RELAXED);
+    unsigned long long end = sequence + (unsigned long long)count;
+    if (end > (1ULL << ID_SEQUENCE_BITS)) return 0;// this node ran out (2^48 IDs)
+    if (end > __atomic_load_n(&a->leaseEnd, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_lock(&a->lock);
+        while (!a->failed && end > a->leaseEnd) {// one writer extends, the rest find it done
+            unsigned long long newEnd = end + ID_LEASE_SIZE;
+            if (writeIdFile(a, newEnd)) {
+                __atomic_store_n(&a->leaseEnd, newEnd, __ATOMIC_RELEASE);
+            } else {
+                a->failed = 1;
+                printf("Could not write the ID file, no new IDs!\n");
+            }
+        }
+        int failed = a->failed;
+        pthread_mutex_unlock(&a->lock);
+        if (failed) return 0;
+    }
+    *first = ((MedicineId)a->node << ID_SEQUENCE_BITS) | (MedicineId)sequence;
+    return 1;
+}
+
+// Next ID from a writer's batch, refilling it batchSize at a time; -1 if out of IDs
+MedicineId nextId(IdAllocator* a, IdBatch* batch, int batchSize) {
+    if (batch->next >= batch->end) {
+        if (!reserveIds(a, batchSize, &batch->next)) return -1;
+        batch->end = batch->next + batchSize;
+    }
+    return batch->next++;
+}
+
+// Hand back the unused rest of a batch if nobody has reserved past it since
+void releaseIdBatch(IdAllocator* a, IdBatch* batch) {
+    unsigned long long end = (unsigned long long)batch->end & ((1ULL << ID_SEQUENCE_BITS) - 1);
+    unsigned long long next = (unsigned long long)batch->next & ((1ULL << ID_SEQUENCE_BITS) - 1);
+    if (batch->next < batch->end) {
+        __atomic_compare_exchange_n(&a->next, &end, next, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    }
+    batch->next = batch->end = 0;
+}
+
+// Record exactly where we stopped, so a clean restart doesn't skip the rest of the lease
+void closeIdAllocator(IdAllocator* a) {
+    if (a->fd < 0) return;
+    if (!a->failed) writeIdFile(a, a->next);
+    close(a->fd);
+    a->fd = -1;
+    pthread_mutex_destroy(&a->lock);
+}
+
+// HISTORY LOG - write-ahead log for taken/missed events, replayed into the list on start
+
+static uint32_t recordChecksum(const HistoryRecord* rec) {
+    HistoryRecord copy = *rec;
+    copy.checksum = 0;
+    uint64_t h = checksum64(CHECKSUM_SEED, &copy, sizeof(copy));
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+// Check a version 1 record in place and rewrite it as a current one; 0 if it's damaged
+static int upgradeRecordV1(HistoryRecord* rec) {
+    HistoryRecordV1 old;
+    memcpy(&old, rec, sizeof(old));
+    uint32_t checksum = old.checksum;
+    old.checksum = 0;
+    uint64_t h = checksum64(CHECKSUM_SEED, &old, sizeof(old));
+    if ((uint32_t)(h ^ (h >> 32)) != checksum) return 0;
+    memset(rec, 0, sizeof(*rec));
+    rec->timestamp = old.timestamp;
+    rec->medicineId = old.medicineId;
+    memcpy(rec->medicineName, old.medicineName, MAX_NAME);
+    rec->status = old.status;
+    rec->checksum = recordChecksum(rec);
+    return 1;
+}
+
+static void segmentPath(const HistoryLog* log, int segment, char* out, size_t size) {
+    snprintf(out, size, "%s.%06d", log->prefix, segment);
+}
+
+// Create a new segment file and write its header
+static int openSegment(const char* path, int firstCovered) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+    WalSegmentHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, WAL_MAGIC, sizeof(WAL_MAGIC));
+    header.version = WAL_VERSION;
+    header.recordSize = sizeof(HistoryRecord);
+    header.firstCovered = firstCovered;
+    if (write(fd, &header, sizeof(header)) != (ssize_t)sizeof(header)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// write() everything, retrying short writes
+static int writeAll(int fd, const void* data, size_t bytes) {
+    const char* p = (const char*)data;
+    while (bytes > 0) {
+        ssize_t n = write(fd, p, bytes);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        p += n;
+        bytes -= (size_t)n;
+    }
+    return 1;
+}
+
+// Segment numbers on disk for this log, sorted; returns how many (caller frees *out)
+static int listSegments(const HistoryLog* log, int** out) {
+    int count = 0, capacity = 16;
+    int* numbers = (int*)malloc((size_t)capacity * sizeof(int));
+    DIR* dir = opendir(".");
+    size_t prefixLen = strlen(log->prefix);
+    struct dirent* entry;
+    while (numbers && dir && (entry = readdir(dir)) != NULL) {
+        const char* name = entry->d_name;
+        if (strncmp(name, log->prefix, prefixLen) != 0 || name[prefixLen] != '.') continue;
+        const char* digits = name + prefixLen + 1;
+        if (strlen(digits) != 6 || strspn(digits, "0123456789") != 6) continue;// skips .tmp files
+        if (count == capacity) {
+            capacity *= 2;
+            int* grown = (int*)realloc(numbers, (size_t)capacity * sizeof(int));
+            if (!grown) break;
+            numbers = grown;
+        }
+        numbers[count++] = atoi(digits);
+    }
+    if (dir) closedir(dir);
+    for (int i = 1; i < count; i++) {// insertion sort, there are only a handful
+        int v = numbers[i], j = i - 1;
+        while (j >= 0 && numbers[j] > v) { numbers[j + 1] = numbers[j]; j--; }
+        numbers[j + 1] = v;
+    }
+    *out = numbers;
+    return numbers ? count : 0;
+}
+
+// Read a segment's header; returns 0 if it isn't a valid segment
+static int readSegmentHeader(int fd, WalSegmentHeader* header) {
+    return read(fd, header, sizeof(*header)) == (ssize_t)sizeof(*header) &&
+           memcmp(header->magic, WAL_MAGIC, sizeof(WAL_MAGIC)) == 0 &&
+           ((header->version == WAL_VERSION && header->recordSize == sizeof(HistoryRecord)) ||
+            (header->version == 1 && header->recordSize == sizeof(HistoryRecordV1)));
+}
+
+// Call fn for every valid record in a segment, oldest first. Stops at a torn/corrupt tail.
+static long long scanSegment(const char* path, void (*fn)(const HistoryRecord*, void*), void* ctx) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    WalSegmentHeader header;
+    long long records = 0;
+    if (readSegmentHeader(fd, &header)) {
+        HistoryRecord batch[512];
+        ssize_t n;
+        int done = 0;
+        while (!done && (n = read(fd, batch, sizeof(batch))) > 0) {
+            int whole = (int)(n / (ssize_t)sizeof(HistoryRecord));
+            for (int i = 0; i < whole; i++) {
+                int valid = header.version == 1 ? upgradeRecordV1(&batch[i])
+                                                : recordChecksum(&batch[i]) == batch[i].checksum;
+                if (!valid) {
+                    done = 1;// half-written record from a crash, nothing valid after it
+                    break;
+                }
+                fn(&batch[i], ctx);
+                records++;
+            }
+            if (n % (ssize_t)sizeof(HistoryRecord) != 0) done = 1;
+        }
+    }
+    close(fd);
+    return records;
+}
+
+// Segments replaced by a compacted segment are skipped (and may still exist after a crash).
+// Returns the newest compacted segment number, or 0 if there is none
+static int markCovered(const HistoryLog* log, const int* numbers, int count, char* skip) {
+    char path[300];
+    int lastCompacted = 0;
+    for (int i = 0; i < count; i++) {
+        segmentPath(log, numbers[i], path, sizeof(path));
+        int fd = open(path, O_RDONLY);
+        WalSegmentHeader header;
+        if (fd >= 0 && readSegmentHeader(fd, &header)) {
+            for (int j = 0; j < i; j++) {
+                if (numbers[j] >= header.firstCovered) skip[j] = 1;
+            }
+            if (header.firstCovered < numbers[i]) lastCompacted = numbers[i];
+        }
+        if (fd >= 0) close(fd);
+    }
+    return lastCompacted;
+}
+
+typedef struct CompactContext {
+    int fd;
+    time_t cutoff;
+    HistoryRecord buffer[512];
+    int count;
+    int ok;
+} CompactContext;
+
+static void compactRecord(const HistoryRecord* rec, void* ctx) {
+    CompactContext* c = (CompactContext*)ctx;
+    if (rec->timestamp < c->cutoff) return;// past retention
+    c->buffer[c->count++] = *rec;
+    if (c->count == 512) {
+        c->ok = c->ok && writeAll(c->fd, c->buffer, sizeof(c->buffer));
+        c->count = 0;
+    }
+}
+
+// Merge closed segments into one file. Normally only the segments written since the last
+// compaction are merged (each event gets rewritten once); with a retention window everything
+// is merged so expired events can be dropped. The merged file takes the number of the newest
+// closed segment and records which ones it replaces, so a crash before the old files are
+// deleted can't replay anything twice.
+static void compactHistoryLog(HistoryLog* log) {
+    int target = log->segment - 1;
+    int from = log->retentionDays > 0 ? log->firstSegment : log->compactFrom;
+    if (target <= from) return;
+    char path[300], tmpPath[310];
+    segmentPath(log, target, path, sizeof(path));
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+    CompactContext c;
+    c.fd = openSegment(tmpPath, from);
+    c.cutoff = log->retentionDays > 0 ? time(NULL) - (time_t)log->retentionDays * 86400 : 0;
+    c.count = 0;
+    c.ok = c.fd >= 0;
+    for (int seg = from; seg <= target && c.ok; seg++) {
+        char segPath[300];
+        segmentPath(log, seg, segPath, sizeof(segPath));
+        scanSegment(segPath, compactRecord, &c);
+    }
+    if (c.ok && c.count > 0) c.ok = writeAll(c.fd, c.buffer, (size_t)c.count * sizeof(HistoryRecord));
+    if (c.fd >= 0) {
+        c.ok = c.ok && fsync(c.fd) == 0;
+        close(c.fd);
+    }
+    if (!c.ok || rename(tmpPath, path) != 0) {
+        remove(tmpPath);
+        return;// keep the uncompacted segments, try again next rotation
+    }
+    for (int seg = from; seg < target; seg++) {
+        char oldPath[300];
+        segmentPath(log, seg, oldPath, sizeof(oldPath));
+        remove(oldPath);
+    }
+    if (from == log->firstSegment) log->firstSegment = target;
+    log->compactFrom = target + 1;
+}
+
+// Close the current segment and start the next one (called by the flusher, lock not held)
+static int rotateSegment(HistoryLog* log) {
+    char path[300];
+    close(log->fd);
+    log->segment++;
+    segmentPath(log, log->segment, path, sizeof(path));
+    log->fd = openSegment(path, log->segment);
+    log->segmentRecords = 0;
+    if (log->fd < 0) return 0;
+    if (log->segment - log->compactFrom > log->compactAfter) compactHistoryLog(log);
+    return 1;
+}
+
+// Write one batch to disk with a single fsync, rotating segments as they fill up
+static int writeBatch(HistoryLog* log, const HistoryRecord* records, int count) {
+    while (count > 0) {
+        long long room = log->maxSegmentRecords - log->segmentRecords;
+        int chunk = count < room ? count : (int)room;
+        if (!writeAll(log->fd, records, (size_t)chunk * sizeof(HistoryRecord))) return 0;
+        log->segmentRecords += chunk;
+        records += chunk;
+        count -= chunk;
+        if (log->segmentRecords >= log->maxSegmentRecords) {
+            if (fdatasync(log->fd) != 0) return 0;// closed segments are always fully synced
+            log->syncs++;
+            if (!rotateSegment(log)) return 0;
+        }
+    }
+    if (fdatasync(log->fd) != 0) return 0;
+    log->syncs++;
+    return 1;
+}
+
+static void* historyFlusher(void* arg) {
+    HistoryLog* log = (HistoryLog*)arg;
+    pthread_mutex_lock(&log->lock);
+    while (1) {
+        while (log->running && log->pendingCount == 0) {
+            pthread_cond_wait(&log->wake, &log->lock);
+        }
+        if (log->pendingCount == 0) break;// stopped and drained
+        // group commit: let more events pile up until the oldest has waited maxLatencyMs
+        // (or the buffer is half full / we're shutting down)
+        struct timespec deadline = log->firstPendingAt;
+        deadline.tv_sec += log->maxLatencyMs / 1000;
+        deadline.tv_nsec += (long)(log->maxLatencyMs % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        while (log->running && log->pendingCount < log->bufferCapacity / 2) {
+            if (pthread_cond_timedwait(&log->wake, &log->lock, &deadline) == ETIMEDOUT) break;
+        }
+        // swap buffers and write without holding the lock, appends keep going meanwhile
+        HistoryRecord* batch = log->pending;
+        int count = log->pendingCount;
+        log->pending = log->writing;
+        log->writing = batch;
+        log->pendingCount = 0;
+        pthread_cond_broadcast(&log->flushed);// room in the buffer again
+        pthread_mutex_unlock(&log->lock);
+        int ok = !log->failed && writeBatch(log, batch, count);
+        pthread_mutex_lock(&log->lock);
+        if (!ok && !log->failed) {
+            log->failed = 1;
+            fprintf(stderr, "History log write failed, history is no longer being saved\n");
+        }
+        log->durable += (unsigned long long)count;
+        pthread_cond_broadcast(&log->flushed);
+    }
+    pthread_mutex_unlock(&log->lock);
+    return NULL;
+}
+
+typedef struct ReplayContext {
+    LinkedList* list;
+    long long records;
+} ReplayContext;
+
+static void replayRecord(const HistoryRecord* rec, void* ctx) {
+    ReplayContext* r = (ReplayContext*)ctx;
+    char name[MAX_NAME];
+    memcpy(name, rec->medicineName, MAX_NAME);
+    name[MAX_NAME - 1] = 0;
+    insertHistoryEntry(r->list, rec->medicineId, name, rec->status, (time_t)rec->timestamp);
+    r->records++;
+}
+
+// Open the log: replay every segment into history (oldest first, so the newest ends up
+// at the head), then start a fresh segment and the flusher thread. history may be NULL.
+int openHistoryLog(HistoryLog* log, const char* prefix, int maxLatencyMs, LinkedList* history) {
+    memset(log, 0, sizeof(*log));
+    snprintf(log->prefix, sizeof(log->prefix), "%s", prefix);
+    log->maxLatencyMs = maxLatencyMs;
+    log->maxSegmentRecords = WAL_SEGMENT_RECORDS;
+    log->compactAfter = WAL_COMPACT_SEGMENTS;
+    log->retentionDays = WAL_RETENTION_DAYS;
+    log->bufferCapacity = 65536;
+    log->pending = (HistoryRecord*)malloc((size_t)log->bufferCapacity * sizeof(HistoryRecord));
+    log->writing = (HistoryRecord*)malloc((size_t)log->bufferCapacity * sizeof(HistoryRecord));
+    if (!log->pending || !log->writing) {
+        free(log->pending);
+        free(log->writing);
+        printf("Memory allocation failed!\n");
+        return 0;
+    }
+
+    int* numbers = NULL;
+    int count = listSegments(log, &numbers);
+    char* skip = (char*)calloc((size_t)count + 1, 1);
+    char path[300];
+    int lastCompacted = skip ? markCovered(log, numbers, count, skip) : 0;
+    ReplayContext replay = {history, 0};
+    log->firstSegment = 0;
+    for (int i = 0; i < count; i++) {
+        segmentPath(log, numbers[i], path, sizeof(path));
+        if (skip && skip[i]) {
+            remove(path);// leftover from a compaction that crashed before cleanup
+            continue;
+        }
+        if (log->firstSegment == 0) log->firstSegment = numbers[i];
+        if (history) scanSegment(path, replayRecord, &replay);
+    }
+    log->segment = count > 0 ? numbers[count - 1] + 1 : 1;
+    if (log->firstSegment == 0) log->firstSegment = log->segment;
+    log->compactFrom = lastCompacted > 0 ? lastCompacted + 1 : log->firstSegment;
+    free(skip);
+    free(numbers);
+    // every start opens a new segment, so fold small ones left by earlier runs
+    if (log->segment - log->compactFrom > log->compactAfter) compactHistoryLog(log);
+
+    segmentPath(log, log->segment, path, sizeof(path));
+    log->fd = openSegment(path, log->segment);
+    if (log->fd < 0) {
+        printf("Could not open history log %s\n", path);
+        free(log->pending);
+        free(log->writing);
+        return 0;
+    }
+    pthread_mutex_init(&log->lock, NULL);
+    pthread_cond_init(&log->wake, NULL);
+    pthread_cond_init(&log->flushed, NULL);
+    log->running = 1;
+    if (pthread_create(&log->flusher, NULL, historyFlusher, log) != 0) {
+        printf("Could not start history log thread\n");
+        close(log->fd);
+        free(log->pending);
+        free(log->writing);
+        return 0;
+    }
+    return 1;
+}
+
+// Log one event. Returns its sequence number (pass to waitHistoryLog to wait until it's on disk)
+unsigned long long appendHistoryLog(HistoryLog* log, MedicineId medId, const char* medName, int status, time_t timestamp) {
+    HistoryRecord rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.timestamp = (int64_t)timestamp;
+    rec.medicineId = medId;
+    rec.status = (uint8_t)status;
+    snprintf(rec.medicineName, MAX_NAME, "%s", medName);
+    rec.checksum = recordChecksum(&rec);
+
+    pthread_mutex_lock(&log->lock);
+    while (log->pendingCount == log->bufferCapacity) {
+        pthread_cond_wait(&log->flushed, &log->lock);// flusher is behind, wait for a swap
+    }
+    if (log->pendingCount == 0) {
+        clock_gettime(CLOCK_REALTIME, &log->firstPendingAt);
+        pthread_cond_signal(&log->wake);
+    }
+    log->pending[log->pendingCount++] = rec;
+    unsigned long long seq = ++log->appended;
+    pthread_mutex_unlock(&log->lock);
+    return seq;
+}
+
+// Block until every event up to seq is on disk. Returns 0 if the log failed
+int waitHistoryLog(HistoryLog* log, unsigned long long seq) {
+    pthread_mutex_lock(&log->lock);
+    while (log->durable < seq && !log->failed) {
+        pthread_cond_wait(&log->flushed, &log->lock);
+    }
+    int ok = !log->failed;
+    pthread_mutex_unlock(&log->lock);
+    return ok;
+}
+
+// Flush whatever is pending, stop the flusher and close the segment
+void closeHistoryLog(HistoryLog* log) {
+    pthread_mutex_lock(&log->lock);
+    log->running = 0;
+    pthread_cond_signal(&log->wake);
+    pthread_mutex_unlock(&log->lock);
+    pthread_join(log->flusher, NULL);
+    close(log->fd);
+    log->fd = -1;
+    pthread_mutex_destroy(&log->lock);
+    pthread_cond_destroy(&log->wake);
+    pthread_cond_destroy(&log->flushed);
+    free(log->pending);
+    free(log->writing);
+    log->pending = NULL;
+    log->writing = NULL;
+}
+
+// BATCH MODE - ./pillpilot batch [file]  (stdin when no file or "-")
+// One command per line, comma or tab separated (CSV quoting allowed):
+//   <id>,<name>,<dosage>,<HH:MM>,<instructions>[,<repeat>]   add a medicine (a plain medicines CSV works as is)
+//   add,<id>,<name>,<dosage>,<HH:MM>,<instructions>[,<repeat>]   repeat as in the menu, e.g. "every 8h for 10 days"
+//   taken,<id>  missed,<id>  delete,<id>  reschedule,<id>,<HH:MM>
+//   get,<id>  list  schedule[,<k>] (by next dose)  stats  history,<days>[,<id>[,<taken|missed>]]
+//   find,<name>[,<k>]  (any case; "Amox*" = every name starting with Amox)
+// Output is tab separated, one record per line: medicine / history / stats rows for queries,
+// "error <line> <message>" for rejected lines and a final "done <lines> <errors> <seconds>".
+// Runs of adds are bulk loaded: appended to the heap and name index unsorted, put in order once at the end
+
+#define BATCH_BUFFER_SIZE 65536
+#define BATCH_MAX_FIELDS 8
+
+// Buffered line reader - lines are handed out in place, nothing is allocated per line
+typedef struct LineReader {
+    int fd;
+    char buf[BATCH_BUFFER_SIZE + 1];// +1 for the terminator of a last line with no newline
+    size_t start;// next unread byte
+    size_t end;// bytes in buf
+    int eof;
+    int skipping;// discarding the rest of an over-long line
+    long long lineNo;
+} LineReader;
+
+static void initLineReader(LineReader* r, int fd) {
+    r->fd = fd;
+    r->start = 0;
+    r->end = 0;
+    r->eof = 0;
+    r->skipping = 0;
+    r->lineNo = 0;
+}
+
+// Next line with the newline (and any \r) stripped, or NULL at end of input.
+// *tooLong is set when a line didn't fit in the buffer (the line is then dropped)
+static char* readLine(LineReader* r, int* tooLong) {
+    *tooLong = 0;
+    while (1) {
+        char* line = r->buf + r->start;
+        char* nl = (char*)memchr(line, '\n', r->end - r->start);
+        if (nl || (r->eof && r->start < r->end)) {
+            char* stop = nl ? nl : r->buf + r->end;
+            r->start = nl ? (size_t)(nl - r->buf) + 1 : r->end;
+            if (r->skipping) {// tail of an over-long line
+                r->skipping = 0;
+                continue;
+            }
+            if (stop > line && stop[-1] == '\r') stop--;
+            *stop = 0;
+            r->lineNo++;
+            return line;
+        }
+        if (r->eof) return NULL;
+        if (r->start > 0) {// keep the partial line, refill behind it
+            memmove(r->buf, r->buf + r->start, r->end - r->start);
+            r->end -= r->start;
+            r->start = 0;
+        }
+        if (r->end == BATCH_BUFFER_SIZE) {// no newline in a whole buffer
+            if (!r->skipping) {
+                r->lineNo++;
+                *tooLong = 1;
+            }
+            r->skipping = 1;
+            r->end = 0;
+            if (*tooLong) return r->buf;
+            continue;
+        }
+        ssize_t got = read(r->fd, r->buf + r->end, BATCH_BUFFER_SIZE - r->end);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) r->eof = 1;
+        else r->end += (size_t)got;
+    }
+}
+
+// Split a line in place on delim; quoted fields ("a, b" with "" for a quote) are unquoted.
+// Unquoted fields are trimmed. Returns the field count, or -1 if there are too many
+static int splitFields(char* line, char delim, char** fields, int maxFields) {
+    int count = 0;
+    char* p = line;
+    while (1) {
+        if (count == maxFields) return -1;
+        while (*p == ' ') p++;
+        char* field = p;
+        if (*p == '"') {// quoted: copy down over the quotes as we go
+            char* out = field;
+            p++;
+            while (*p) {
+                if (*p == '"') {
+                    if (p[1] != '"') {
+                        p++;
+                        break;
+                    }
+                    p++;// "" -> "
+                }
+                *out++ = *p++;
+            }
+            while (*p && *p != delim) p++;// junk after the closing quote is dropped
+            fields[count++] = field;
+            if (!*p) {
+                *out = 0;
+                return count;
+            }
+            *out = 0;
+            p++;
+            continue;
+        }
+        while (*p && *p != delim) p++;
+        char* stop = p;
+        while (stop > field && stop[-1] == ' ') stop--;
+        fields[count++] = field;
+        if (!*p) {
+            *stop = 0;
+            return count;
+        }
+        *stop = 0;
+        p++;
+    }
+}
+
+// Strict non-negative decimal number up to max
+static int parseNumber(const char* s, long long max, long long* out) {
+    long long value = 0;
+    if (!*s) return 0;
+    for (; *s; s++) {
+        if (*s < '0' || *s > '9') return 0;
+        if (value > (max - (*s - '0')) / 10) return 0;// would pass max
+        value = value * 10 + (*s - '0');
+    }
+    *out = value;
+    return 1;
+}
+
+static int parseId(const char* s, MedicineId* id) {
+    return parseNumber(s, 0x7fffffffffffffffLL, id);
+}
+
+static int parseCount(const char* s, int* count) {
+    long long value;
+    if (!parseNumber(s, 2147483647LL, &value)) return 0;
+    *count = (int)value;
+    return 1;
+}
+
+// Strict HH:MM (H:MM allowed); minutes from midnight, -1 if invalid
+static int parseTime(const char* s) {
+    int hours = 0, minutes = 0, digits = 0;
+    while (*s >= '0' && *s <= '9' && digits < 2) hours = hours * 10 + (*s++ - '0'), digits++;
+    if (digits == 0 || *s++ != ':') return -1;
+    if (s[0] < '0' || s[0] > '9' || s[1] < '0' || s[1] > '9' || s[2]) return -1;
+    minutes = (s[0] - '0') * 10 + (s[1] - '0');
+    if (hours > 23 || minutes > 59) return -1;
+    return hours * 60 + minutes;
+}
+
+// Copy a field into a fixed-size buffer, truncating; tabs become spaces so output stays TSV
+static void copyField(char* dst, size_t size, const char* src) {
+    size_t len = strnlen(src, size - 1);
+    for (size_t i = 0; i < len; i++) dst[i] = src[i] == '\t' ? ' ' : src[i];
+    dst[len] = 0;
+}
+
+typedef struct BatchContext {
+    MedicineStore* store;
+    HashMap* map;
+    PriorityQueue* pq;
+    LinkedList* history;
+    NameIndex* names;
+    HistoryLog* log;// NULL = events aren't logged
+    IdAllocator* ids;// NULL = rows must bring their own ID
+    IdBatch idBatch;
+    FILE* out;
+    int bulkFrom;// heap index of the first unsorted append, -1 when the heap is in order
+    time_t now;// rules start from here (read once, not per row)
+    long long lines;
+    long long errors;
+} BatchContext;
+
+static void batchError(BatchContext* b, long long lineNo, const char* message) {
+    fprintf(b->out, "error\t%lld\t%s\n", lineNo, message);
+    b->errors++;
+}
+
+// Heap and name index back in order before anything reads or reshapes them
+static void finishBulk(BatchContext* b) {
+    if (b->bulkFrom >= 0) {
+        buildHeapPQ(b->pq, b->bulkFrom);
+        buildNameIndex(b->names, b->store);
+        b->bulkFrom = -1;
+    }
+}
+
+static void printMedicineRow(BatchContext* b, int handle) {
+    MedicineText* text = &b->store->text[handle];
+    fprintf(b->out, "medicine\t%lld\t%s\t%s\t%s\t%s\n", b->store->ids[handle], text->name, text->dosage,
+            text->time, text->instructions);
+}
+
+static int printHistoryRow(const HistoryEntry* entry, void* ctx) {
+    BatchContext* b = (BatchContext*)ctx;
+    fprintf(b->out, "history\t%lld\t%lld\t%s\t%s\n", (long long)entry->timestamp, entry->medicineId,
+            entry->medicineName, historyStatusName(entry->status));
+    return 1;
+}
+
+// Add one medicine from fields id,name,dosage,time,instructions,repeat
+static void batchAdd(BatchContext* b, long long lineNo, char** f, int n) {
+    Medicine med;
+    RecurrenceRule rule;
+    if (n < 4 || n > 6) {
+        batchError(b, lineNo, "expected id,name,dosage,time[,instructions[,repeat]]");
+        return;
+    }
+    if (*f[0] == 0 && b->ids) {// no ID given, allocate one
+        med.id = nextId(b->ids, &b->idBatch, ID_BATCH_SIZE);
+        if (med.id < 0) {
+            batchError(b, lineNo, "out of medicine ids");
+            return;
+        }
+    } else if (!parseId(f[0], &med.id)) {
+        batchError(b, lineNo, "bad medicine id");
+        return;
+    }
+    med.priority = parseTime(f[3]);
+    if (med.priority < 0) {
+        batchError(b, lineNo, "bad time, expected HH:MM");
+        return;
+    }
+    if (!parseRecurrence(n > 5 ? f[5] : "", med.priority, b->now, &rule)) {
+        batchError(b, lineNo, "bad repeat rule");
+        return;
+    }
+    if (searchMedicine(b->map, med.id) >= 0) {
+        batchError(b, lineNo, "medicine id already exists");
+        return;
+    }
+    copyField(med.name, MAX_NAME, f[1]);
+    copyField(med.dosage, MAX_DOSAGE, f[2]);
+    snprintf(med.time, sizeof(med.time), "%02u:%02u", (unsigned)med.priority / 60 % 24, (unsigned)med.priority % 60);
+    copyField(med.instructions, MAX_INSTRUCTIONS, n > 4 ? f[4] : "");
+    int handle = addToStore(b->store, &med);
+    if (handle < 0 || !insertMedicine(b->map, med.id, handle)) {
+        if (handle >= 0) removeFromStore(b->store, handle);
+        batchError(b, lineNo, "out of memory");
+        return;
+    }
+    b->store->rules[handle] = rule;
+    time_t next = nextOccurrence(&rule, b->now);
+    if (b->bulkFrom < 0) b->bulkFrom = b->pq->size;
+    if (!appendNameIndex(b->names, handle) || (next >= 0 && !appendPQ(b->pq, handle, doseKey(next)))) {
+        deleteMedicine(b->map, med.id);// (a finished course isn't queued)
+        removeNameIndex(b->names, b->store, handle);
+        removeFromStore(b->store, handle);
+        batchError(b, lineNo, "out of memory");
+        return;
+    }
+    if (b->ids) {// allocated IDs must stay clear of imported ones
+        raiseIdFloor(b->ids, med.id);
+        if (*f[0] != 0 && med.id >= b->idBatch.next && med.id < b->idBatch.end) {
+            b->idBatch.next = b->idBatch.end;// the rest of our reserved batch may collide, drop it
+        }
+    }
+    if (*f[0] == 0) fprintf(b->out, "added\t%lld\n", med.id);
+}
+
+// Run one command line
+static void batchLine(BatchContext* b, long long lineNo, char* line) {
+    char* f[BATCH_MAX_FIELDS];
+    char delim = strchr(line, '\t') ? '\t' : ',';
+    int n = splitFields(line, delim, f, BATCH_MAX_FIELDS);
+    if (n < 0) {
+        batchError(b, lineNo, "too many fields");
+        return;
+    }
+    const char* cmd = f[0];
+    if ((*cmd >= '0' && *cmd <= '9') || (*cmd == 0 && n >= 4)) {// bare medicine row (empty ID = allocate one)
+        batchAdd(b, lineNo, f, n);
+        return;
+    }
+    if (strcmp(cmd, "add") == 0) {
+        batchAdd(b, lineNo, f + 1, n - 1);
+        return;
+    }
+    if (b->lines == 1 && (strcmp(cmd, "id") == 0 || strcmp(cmd, "ID") == 0)) return;// CSV header
+    finishBulk(b);
+    MedicineId id = 0;
+    int handle = -1;
+    int wantsId = strcmp(cmd, "taken") == 0 || strcmp(cmd, "missed") == 0 || strcmp(cmd, "delete") == 0 ||
+                  strcmp(cmd, "reschedule") == 0 || strcmp(cmd, "get") == 0;
+    if (wantsId) {
+        if (n < 2 || !parseId(f[1], &id)) {
+            batchError(b, lineNo, "bad medicine id");
+            return;
+        }
+        handle = searchMedicine(b->map, id);
+        if (handle < 0) {
+            batchError(b, lineNo, "medicine not found");
+            return;
+        }
+    }
+    if (strcmp(cmd, "taken") == 0 || strcmp(cmd, "missed") == 0) {
+        int status = cmd[0] == 't' ? HISTORY_TAKEN : HISTORY_MISSED;
+        time_t when = insertAtHead(b->history, id, b->store->text[handle].name, status);
+        if (when == (time_t)-1) {
+            batchError(b, lineNo, "out of memory");
+        } else if (b->log) {
+            appendHistoryLog(b->log, id, b->store->text[handle].name, status, when);
+        }
+    } else if (strcmp(cmd, "delete") == 0) {
+        deleteMedicine(b->map, id);
+        removeFromPQ(b->pq, handle);
+        removeNameIndex(b->names, b->store, handle);
+        removeFromStore(b->store, handle);
+    } else if (strcmp(cmd, "reschedule") == 0) {
+        int priority = n == 3 ? parseTime(f[2]) : -1;
+        if (priority < 0) {
+            batchError(b, lineNo, "bad time, expected HH:MM");
+            return;
+        }
+        MedicineText* text = &b->store->text[handle];
+        snprintf(text->time, sizeof(text->time), "%02u:%02u", (unsigned)priority / 60 % 24, (unsigned)priority % 60);
+        rescheduleRule(&b->store->rules[handle], b->store->priorities[handle], priority);
+        b->store->priorities[handle] = priority;
+        scheduleNextDose(b->pq, b->store, handle, time(NULL));// not b->now - a stdin stream can run for hours
+    } else if (strcmp(cmd, "get") == 0) {
+        printMedicineRow(b, handle);
+    } else if (strcmp(cmd, "list") == 0) {
+        for (int h = 0; h < b->store->used; h++) {
+            if (b->store->flags[h] & MED_LIVE) printMedicineRow(b, h);
+        }
+    } else if (strcmp(cmd, "schedule") == 0) {
+        int k = b->pq->size;
+        if (n > 1 && !parseCount(f[1], &k)) {
+            batchError(b, lineNo, "bad count");
+            return;
+        }
+        catchUpDoses(b->pq, b->store, time(NULL));
+        ScheduleIterator it;
+        PQNode node;
+        initScheduleIterator(&it, b->pq);
+        for (int i = 0; i < k && nextScheduled(&it, &node); i++) printMedicineRow(b, node.handle);
+        freeScheduleIterator(&it);
+    } else if (strcmp(cmd, "find") == 0) {
+        int k = 100;
+        if (n < 2 || !*f[1] || (n > 2 && !parseCount(f[2], &k))) {
+            batchError(b, lineNo, "expected find,<name>[,<k>]");
+            return;
+        }
+        size_t length = strlen(f[1]);
+        int mode = f[1][length - 1] == '*' ? NAME_PREFIX : NAME_ANY_CASE;
+        if (mode == NAME_PREFIX) f[1][length - 1] = 0;
+        int* found = (int*)malloc((size_t)(k > 0 ? k : 1) * sizeof(int));
+        if (!found) {
+            batchError(b, lineNo, "out of memory");
+            return;
+        }
+        int count = findMedicinesByName(b->names, b->store, f[1], mode, found, k);
+        for (int i = 0; i < count; i++) printMedicineRow(b, found[i]);
+        free(found);
+    } else if (strcmp(cmd, "stats") == 0) {
+        int taken, missed;
+        getStatistics(b->history, &taken, &missed);
+        fprintf(b->out, "stats\t%d\t%d\n", taken, missed);
+    } else if (strcmp(cmd, "history") == 0) {
+        int days, status = 0;
+        MedicineId medId = -1;
+        if (n < 2 || !parseCount(f[1], &days) || days <= 0) {
+            batchError(b, lineNo, "bad number of days");
+            return;
+        }
+        if (n > 2 && *f[2] && !parseId(f[2], &medId)) {
+            batchError(b, lineNo, "bad medicine id");
+            return;
+        }
+        if (n > 3) {
+            if (strcmp(f[3], "taken") == 0) status = HISTORY_TAKEN;
+            else if (strcmp(f[3], "missed") == 0) status = HISTORY_MISSED;
+            else {
+                batchError(b, lineNo, "bad status, expected taken or missed");
+                return;
+            }
+        }
+        time_t now = time(NULL);
+        queryHistory(b->history, localDayStart(now, 1 - days), localDayStart(now, 1), medId, status,
+                     printHistoryRow, b);
+    } else {
+        batchError(b, lineNo, "unknown command");
+    }
+}
+
+// Run a batch file (or stdin) against the loaded data; returns 0 if every line went through
+int runBatch(const char* path, MedicineStore* store, HashMap* map, PriorityQueue* pq, LinkedList* history,
+             NameIndex* names, HistoryLog* log, IdAllocator* ids, FILE* out) {
+    int fd = 0;// stdin
+    if (path && strcmp(path, "-") != 0) {
+        fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            fprintf(out, "error\t0\tcannot open %s: %s\n", path, strerror(errno));
+            return 1;
+        }
+    }
+    LineReader* reader = (LineReader*)malloc(sizeof(LineReader));// one buffer for the whole run
+    if (!reader) {
+        if (fd > 0) close(fd);
+        return 1;
+    }
+    initLineReader(reader, fd);
+    BatchContext b = {store, map, pq, history, names, log, ids, {0, 0}, out, -1, time(NULL), 0, 0};
+    double t0 = nowSeconds();
+    char* line;
+    int tooLong;
+    while ((line = readLine(reader, &tooLong)) != NULL) {
+        if (tooLong) {
+            batchError(&b, reader->lineNo, "line too long");
+            continue;
+        }
+        if (line[0] == 0 || line[0] == '#') continue;
+        b.lines++;
+        batchLine(&b, reader->lineNo, line);
+    }
+    finishBulk(&b);
+    if (ids) releaseIdBatch(ids, &b.idBatch);
+    fprintf(out, "done\t%lld\t%lld\t%.3f\n", b.lines, b.errors, nowSeconds() - t0);
+    fflush(out);
+    free(reader);
+    if (fd > 0) close(fd);
+    return b.errors ? 1 : 0;
+}
+
+// BENCHMARKS - ./pillpilot bench [name] [n]
+// Quick throughput numbers so we can check the complexity claims instead of guessing
+
+// xorshift64 - fast repeatable random numbers for workloads
+static unsigned long long benchRand(unsigned long long* state) {
+    unsigned long long x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+// Shuffle so lookups don't just walk the table in insert order
+static void shuffleInts(int* a, int n, unsigned long long* state) {
+    for (int i = n - 1; i > 0; i--) {
+        int j = (int)(benchRand(state) % (unsigned long long)(i + 1));
+        int t = a[i];
+        a[i] = a[j];
+        a[j] = t;
+    }
+}
+
+static void printRate(const char* label, long long ops, double secs) {
+    printf("%-34s %12lld ops %9.3f s %10.2f Mops/s %12.1f ns/op\n", label, ops, secs,
+           secs > 0 ? ops / secs / 1e6 : 0.0, ops > 0 ? secs * 1e9 / ops : 0.0);
+}
+
+// Old-style slot: the whole Medicine embedded by value, like HashMap/PQ used to store it
+typedef struct FatHashNode {
+    Medicine medicine;
+    int isOccupied;
+} FatHashNode;
+
+// The old fixed 100-slot table (id % 100, stops probing at the first free slot),
+// kept here only as the baseline the new HashMap is measured against
+typedef struct LegacyHashMap {
+    FatHashNode table[TABLE_SIZE];
+    int count;
+} LegacyHashMap;
+
+static int legacyInsert(LegacyHashMap* map, Medicine* med) {
+    int index = med->id % TABLE_SIZE;
+    int originalIndex = index;
+    while (map->table[index].isOccupied) {
+        index = (index + 1) % TABLE_SIZE;
+        if (index == originalIndex) return 0;
+    }
+    map->table[index].medicine = *med;
+    map->table[index].isOccupied = 1;
+    map->count++;
+    return 1;
+}
+
+static int legacyFind(LegacyHashMap* map, int id) {
+    int index = id % TABLE_SIZE;
+    int originalIndex = index;
+    while (map->table[index].isOccupied) {
+        if (map->table[index].medicine.id == id) return index;
+        index = (index + 1) % TABLE_SIZE;
+        if (index == originalIndex) break;
+    }
+    return -1;
+}
+
+static int legacyDelete(LegacyHashMap* map, int id) {
+    int index = legacyFind(map, id);
+    if (index < 0) return 0;
+    map->table[index].isOccupied = 0;
+    map->count--;
+    return 1;
+}
+
+// Insert / lookup / delete at a load the old table can hold (90 of 100 slots), both tables
+static void benchSmallTables(void) {
+    enum { N = 90, ROUNDS = 20000 };
+    int ids[N];
+    unsigned long long seed = 42;
+    Medicine med;
+    memset(&med, 0, sizeof(med));
+    for (int i = 0; i < N; i++) ids[i] = i * 37 + 1;
+    shuffleInts(ids, N, &seed);
+
+    LegacyHashMap* legacy = (LegacyHashMap*)calloc(1, sizeof(LegacyHashMap));
+    HashMap map;
+    if (!legacy || !initHashMap(&map)) {
+        free(legacy);
+        return;
+    }
+    long long found = 0;
+    double tIns[2] = {0, 0}, tFind[2] = {0, 0}, tDel[2] = {0, 0};
+    for (int r = 0; r < ROUNDS; r++) {
+        double t0 = nowSeconds();
+        for (int i = 0; i < N; i++) { med.id = ids[i]; legacyInsert(legacy, &med); }
+        double t1 = nowSeconds();
+        for (int i = 0; i < N; i++) found += legacyFind(legacy, ids[i]) >= 0;
+        double t2 = nowSeconds();
+        for (int i = 0; i < N; i++) legacyDelete(legacy, ids[i]);
+        double t3 = nowSeconds();
+        for (int i = 0; i < N; i++) insertMedicine(&map, ids[i], i);
+        double t4 = nowSeconds();
+        for (int i = 0; i < N; i++) found += searchMedicine(&map, ids[i]) >= 0;
+        double t5 = nowSeconds();
+        for (int i = 0; i < N; i++) deleteMedicine(&map, ids[i]);
+        double t6 = nowSeconds();
+        tIns[0] += t1 - t0; tFind[0] += t2 - t1; tDel[0] += t3 - t2;
+        tIns[1] += t4 - t3; tFind[1] += t5 - t4; tDel[1] += t6 - t5;
+    }
+    long long ops = (long long)N * ROUNDS;
+    printf("\n-- 90 entries, %d rounds (old table is capped at %d) --\n", ROUNDS, TABLE_SIZE);
+    printRate("old fixed table insert", ops, tIns[0]);
+    printRate("old fixed table lookup", ops, tFind[0]);
+    printRate("old fixed table delete", ops, tDel[0]);
+    printRate("growable HashMap insert", ops, tIns[1]);
+    printRate("growable HashMap lookup", ops, tFind[1]);
+    printRate("growable HashMap delete", ops, tDel[1]);
+    if (found != 2 * ops) printf("!! lookups missed entries (%lld of %lld)\n", found, 2 * ops);
+    freeHashMap(&map);
+    free(legacy);
+}
+
+// Insert / lookup / delete throughput for n medicines in the growable HashMap
+static void benchLargeTable(int n) {
+    int* ids = (int*)malloc((size_t)n * sizeof(int));
+    HashMap map;
+    if (!ids || !initHashMap(&map)) {
+        free(ids);
+        return;
+    }
+    unsigned long long seed = 7;
+    for (int i = 0; i < n; i++) ids[i] = i + 1;
+    shuffleInts(ids, n, &seed);
+
+    printf("\n-- %d entries, growable HashMap --\n", n);
+    double t0 = nowSeconds();
+    for (int i = 0; i < n; i++) insertMedicine(&map, ids[i], i);
+    double t1 = nowSeconds();
+    printRate("insert (with resizes)", n, t1 - t0);
+
+    shuffleInts(ids, n, &seed);
+    long long found = 0;
+    t0 = nowSeconds();
+    for (int i = 0; i < n; i++) found += searchMedicine(&map, ids[i]) >= 0;
+    t1 = nowSeconds();
+    printRate("lookup hit", n, t1 - t0);
+
+    t0 = nowSeconds();
+    for (int i = 0; i < n; i++) found += searchMedicine(&map, n + 1 + ids[i]) >= 0;
+    t1 = nowSeconds();
+    printRate("lookup miss", n, t1 - t0);
+
+    // delete half, then check the other half is still reachable past the tombstones
+    t0 = nowSeconds();
+    for (int i = 0; i < n / 2; i++) deleteMedicine(&map, ids[i]);
+    t1 = nowSeconds();
+    printRate("delete", n / 2, t1 - t0);
+
+    t0 = nowSeconds();
+    for (int i = n / 2; i < n; i++) found += searchMedicine(&map, ids[i]) >= 0;
+    t1 = nowSeconds();
+    printRate("lookup hit after deletes", n - n / 2, t1 - t0);
+
+    if (found != n + (n - n / 2)) printf("!! lookups went wrong (%lld found)\n", found);
+    printf("capacity %d, live %d, tombstones %d\n", map.capacity, map.count, map.tombstones);
+    freeHashMap(&map);
+    free(ids);
+}
+
+// Hardware cache-miss counter for the calling thread (Linux perf events), -1 if unavailable
+static int openCacheMissCounter(void) {
+#ifdef __linux__
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    return -1;
+#endif
+}
+
+static long long readCounter(int fd) {
+    long long value = -1;
+#ifdef __linux__
+    if (fd < 0 || read(fd, &value, sizeof(value)) != (ssize_t)sizeof(value)) return -1;
+#endif
+    return value;
+}
+
+static void closeCounter(int fd) {
+#ifdef __linux__
+    if (fd >= 0) close(fd);
+#endif
+}
+
+static void printMisses(const char* label, long long ops, double secs, long long misses) {
+    printRate(label, ops, secs);
+    if (misses >= 0) printf("%-34s %12.2f cache misses/op\n", "", (double)misses / ops);
+}
+
+// Old layout vs struct-of-arrays at n medicines: lookups and heap inserts
+static void benchLayout(int n) {
+    int capacity = INITIAL_CAPACITY;
+    while ((long long)n * 100 > (long long)capacity * MAX_LOAD_PERCENT) capacity *= 2;
+    int* ids = (int*)malloc((size_t)n * sizeof(int));
+    FatHashNode* fatTable = (FatHashNode*)calloc((size_t)capacity, sizeof(FatHashNode));
+    Medicine* fatHeap = (Medicine*)malloc((size_t)n * sizeof(Medicine));
+    MedicineStore store;
+    HashMap map;
+    PriorityQueue pq;
+    // init all three so whatever they did allocate can be freed (a failed store / queue init
+    // is safe to free; a failed HashMap init has no table)
+    int storeOk = initMedicineStore(&store);
+    int mapOk = initHashMap(&map);
+    int pqOk = initPriorityQueue(&pq);
+    if (!ids || !fatTable || !fatHeap || !storeOk || !mapOk || !pqOk) {
+        printf("Not enough memory for %d medicines\n", n);
+        free(ids);
+        free(fatTable);
+        free(fatHeap);
+        freeMedicineStore(&store);
+        if (mapOk) freeHashMap(&map);
+        freePriorityQueue(&pq);
+        return;
+    }
+    unsigned long long seed = 11;
+    Medicine med;
+    memset(&med, 0, sizeof(med));
+    strcpy(med.name, "Paracetamol");
+    strcpy(med.dosage, "500mg");
+    strcpy(med.instructions, "After food");
+    for (int i = 0; i < n; i++) ids[i] = i + 1;
+    shuffleInts(ids, n, &seed);
+
+    // fill both layouts with the same medicines
+    int mask = capacity - 1;
+    for (int i = 0; i < n; i++) {
+        med.id = ids[i];
+        med.priority = (int)(benchRand(&seed) % 1440);
+        int index = hashFunction(med.id, capacity);
+        while (fatTable[index].isOccupied) index = (index + 1) & mask;
+        fatTable[index].medicine = med;
+        fatTable[index].isOccupied = 1;
+        fatHeap[i] = med;
+        insertMedicine(&map, med.id, addToStore(&store, &med));
+    }
+    shuffleInts(ids, n, &seed);
+    printf("\n-- %d medicines: embedded Medicine vs struct-of-arrays store --\n", n);
+
+    int fd = openCacheMissCounter();
+    if (fd < 0) printf("(hardware cache-miss counter not available here)\n");
+    long long found = 0, prioritySum = 0;
+    long long m0 = readCounter(fd);
+    double t0 = nowSeconds();
+    for (int i = 0; i < n; i++) {
+        int index = hashFunction(ids[i], capacity);
+        while (fatTable[index].isOccupied && fatTable[index].medicine.id != ids[i]) index = (index + 1) & mask;
+        if (fatTable[index].isOccupied) { found++; prioritySum += fatTable[index].medicine.priority; }
+    }
+    double t1 = nowSeconds();
+    long long m1 = readCounter(fd);
+    printMisses("embedded lookup", n, t1 - t0, fd < 0 ? -1 : m1 - m0);
+
+    m0 = readCounter(fd);
+    t0 = nowSeconds();
+    for (int i = 0; i < n; i++) {
+        int h = searchMedicine(&map, ids[i]);
+        if (h >= 0) { found++; prioritySum -= store.priorities[h]; }
+    }
+    t1 = nowSeconds();
+    m1 = readCounter(fd);
+    printMisses("store lookup", n, t1 - t0, fd < 0 ? -1 : m1 - m0);
+
+    // heap inserts: old nodes swapped ~190 bytes per level, new ones move 8
+    int size = 0;
+    m0 = readCounter(fd);
+    t0 = nowSeconds();
+    for (int i = 0; i < n; i++) {
+        Medicine moving = fatHeap[i];
+        int index = size++;
+        fatHeap[index] = moving;
+        while (index > 0 && fatHeap[index].priority < fatHeap[(index - 1) / 2].priority) {
+            Medicine temp = fatHeap[index];
+            fatHeap[index] = fatHeap[(index - 1) / 2];
+            fatHeap[(index - 1) / 2] = temp;
+            index = (index - 1) / 2;
+        }
+    }
+    t1 = nowSeconds();
+    m1 = readCounter(fd);
+    printMisses("embedded heap insert", n, t1 - t0, fd < 0 ? -1 : m1 - m0);
+
+    m0 = readCounter(fd);
+    t0 = nowSeconds();
+    for (int h = 0; h < n; h++) enqueuePQ(&pq, h, store.priorities[h]);
+    t1 = nowSeconds();
+    m1 = readCounter(fd);
+    printMisses("store heap insert", n, t1 - t0, fd < 0 ? -1 : m1 - m0);
+
+    if (found != 2LL * n || prioritySum != 0) printf("!! layouts disagree\n");
+    closeCounter(fd);
+    freePriorityQueue(&pq);
+    freeHashMap(&map);
+    freeMedicineStore(&store);
+    free(fatHeap);
+    free(fatTable);
+    free(ids);
+}
+
+// Indexed heap: reschedule / remove / pop at n medicines, vs rebuilding the queue per reschedule
+static void benchHeap(int n) {
+    PriorityQueue pq;
+    int* priorities = (int*)malloc((size_t)n * sizeof(int));
+    if (!priorities || !initPriorityQueue(&pq)) {
+        free(priorities);
+        return;
+    }
+    unsigned long long seed = 5;
+    for (int h = 0; h < n; h++) priorities[h] = (int)(benchRand(&seed) % 1440);
+    printf("\n-- %d queued medicines, indexed heap --\n", n);
+
+    double t0 = nowSeconds();
+    for (int h = 0; h < n; h++) enqueuePQ(&pq, h, priorities[h]);
+    double t1 = nowSeconds();
+    printRate("enqueue", n, t1 - t0);
+
+    t0 = nowSeconds();
+    for (int i = 0; i < n; i++) {
+        int h = (int)(benchRand(&seed) % (unsigned long long)n);
+        priorities[h] = (int)(benchRand(&seed) % 1440);
+        updatePriorityPQ(&pq, h, priorities[h]);
+    }
+    t1 = nowSeconds();
+    printRate("updatePriority (reschedule)", n, t1 - t0);
+
+    // old way: the only option was to rebuild the whole queue for each reschedule
+    int rebuilds = 20;
+    PriorityQueue rebuilt;
+    initPriorityQueue(&rebuilt);
+    t0 = nowSeconds();
+    for (int r = 0; r < rebuilds; r++) {
+        freePriorityQueue(&rebuilt);
+        initPriorityQueue(&rebuilt);
+        for (int h = 0; h < n; h++) enqueuePQ(&rebuilt, h, priorities[h]);
+    }
+    t1 = nowSeconds();
+    printRate("reschedule by rebuild", rebuilds, t1 - t0);
+    freePriorityQueue(&rebuilt);
+
+    t0 = nowSeconds();
+    for (int h = 0; h < n; h += 2) removeFromPQ(&pq, h);
+    t1 = nowSeconds();
+    printRate("removeFromPQ", (n + 1) / 2, t1 - t0);
+
+    PQNode node;
+    int last = -1, popped = 0, ordered = 1;
+    t0 = nowSeconds();
+    while (popMinPQ(&pq, &node)) {
+        if (node.priority < last || node.priority != priorities[node.handle] || node.handle % 2 == 0) ordered = 0;
+        last = node.priority;
+        popped++;
+    }
+    t1 = nowSeconds();
+    printRate("popMin", popped, t1 - t0);
+    if (!ordered || popped != n / 2) printf("!! heap order broken\n");
+    freePriorityQueue(&pq);
+    free(priorities);
+}
+
+static int comparePQNodes(const void* a, const void* b) {
+    int pa = ((const PQNode*)a)->priority, pb = ((const PQNode*)b)->priority;
+    return (pa > pb) - (pa < pb);
+}
+
+// Next-k doses: lazy top-k walk vs copying the heap and sorting it
+static void benchTopK(int n) {
+    PriorityQueue pq;
+    PQNode* out = (PQNode*)malloc((size_t)n * sizeof(PQNode));
+    PQNode* copy = (PQNode*)malloc((size_t)n * sizeof(PQNode));
+    if (!out || !copy || !initPriorityQueue(&pq)) {
+        free(out);
+        free(copy);
+        return;
+    }
+    unsigned long long seed = 3;
+    for (int h = 0; h < n; h++) enqueuePQ(&pq, h, (int)(benchRand(&seed) % 1440));
+    printf("\n-- next-k doses over %d queued medicines --\n", n);
+
+    int ks[] = {10, 100, 1000, n};
+    for (int i = 0; i < 4; i++) {
+        int k = ks[i] < n ? ks[i] : n;
+        int reps = k <= 1000 ? 200 : 3;
+        char label[64];
+        double t0 = nowSeconds();
+        for (int r = 0; r < reps; r++) topKPQ(&pq, k, out);
+        double t1 = nowSeconds();
+        snprintf(label, sizeof(label), "top-%d lazy walk", k);
+        printRate(label, reps, t1 - t0);
+
+        reps = 3;// copy+sort costs the same for every k
+        t0 = nowSeconds();
+        for (int r = 0; r < reps; r++) {
+            memcpy(copy, pq.heap, (size_t)pq.size * sizeof(PQNode));
+            qsort(copy, (size_t)pq.size, sizeof(PQNode), comparePQNodes);
+        }
+        t1 = nowSeconds();
+        snprintf(label, sizeof(label), "top-%d copy+sort", k);
+        printRate(label, reps, t1 - t0);
+
+        for (int j = 0; j < k; j++) {
+            if (out[j].priority != copy[j].priority) {
+                printf("!! top-k order differs from sort at %d\n", j);
+                break;
+            }
+        }
+    }
+    freePriorityQueue(&pq);
+    free(copy);
+    free(out);
+}
+
+// Startup cost: mmap'd snapshot vs re-importing the same medicines from a CSV file
+static void benchSnapshot(int n) {
+    const char* snapPath = "pillpilot_bench.snap";
+    const char* csvPath = "pillpilot_bench.csv";
+    MedicineStore store;
+    HashMap map;
+    PriorityQueue pq;
+    int storeOk = initMedicineStore(&store);
+    int mapOk = initHashMap(&map);
+    int pqOk = initPriorityQueue(&pq);
+    FILE* csv = storeOk && mapOk && pqOk ? fopen(csvPath, "w") : NULL;
+    if (!csv) {
+        if (storeOk && mapOk && pqOk) printf("Can't write %s\n", csvPath);
+        freeMedicineStore(&store);
+        if (mapOk) freeHashMap(&map);
+        freePriorityQueue(&pq);
+        return;
+    }
+    unsigned long long seed = 9;
+    Medicine med;
+    memset(&med, 0, sizeof(med));
+    for (int i = 0; i < n; i++) {
+        med.id = i + 1;
+        med.priority = (int)(benchRand(&seed) % 1440);
+        snprintf(med.name, MAX_NAME, "Medicine-%d", i);
+        snprintf(med.dosage, MAX_DOSAGE, "%dmg", 100 + i % 900);
+        snprintf(med.time, sizeof(med.time), "%02u:%02u", (unsigned)med.priority / 60 % 24, (unsigned)med.priority % 60);
+        snprintf(med.instructions, MAX_INSTRUCTIONS, "After food, batch %d", i % 97);
+        int h = addToStore(&store, &med);
+        insertMedicine(&map, med.id, h);
+        enqueuePQ(&pq, h, med.priority);
+        fprintf(csv, "%lld,%s,%s,%s,%s\n", med.id, med.name, med.dosage, med.time, med.instructions);
+    }
+    fclose(csv);
+    printf("\n-- startup with %d medicines --\n", n);
+    double t0 = nowSeconds();
+    saveSnapshot(snapPath, &store, &map, &pq);
+    double t1 = nowSeconds();
+    printf("%-34s %10.1f ms\n", "save snapshot", (t1 - t0) * 1e3);
+    freePriorityQueue(&pq);
+    freeHashMap(&map);
+    freeMedicineStore(&store);
+
+    // text re-import: parse every line and rebuild all three structures
+    initMedicineStore(&store);
+    initHashMap(&map);
+    initPriorityQueue(&pq);
+    char line[256];
+    t0 = nowSeconds();
+    csv = fopen(csvPath, "r");
+    while (csv && fgets(line, sizeof(line), csv)) {
+        char* fields[5];
+        char* p = line;
+        for (int f = 0; f < 5; f++) {
+            fields[f] = p;
+            p += strcspn(p, ",\n");
+            if (*p) *p++ = 0;
+        }
+        med.id = atoi(fields[0]);
+        snprintf(med.name, MAX_NAME, "%s", fields[1]);
+        snprintf(med.dosage, MAX_DOSAGE, "%s", fields[2]);
+        snprintf(med.time, sizeof(med.time), "%s", fields[3]);
+        snprintf(med.instructions, MAX_INSTRUCTIONS, "%s", fields[4]);
+        med.priority = calculatePriority(med.time);
+        int h = addToStore(&store, &med);
+        insertMedicine(&map, med.id, h);
+        enqueuePQ(&pq, h, med.priority);
+    }
+    if (csv) fclose(csv);
+    t1 = nowSeconds();
+    printf("%-34s %10.1f ms  (%d medicines)\n", "CSV import", (t1 - t0) * 1e3, map.count);
+    freePriorityQueue(&pq);
+    freeHashMap(&map);
+    freeMedicineStore(&store);
+
+    for (int verify = 0; verify <= 1; verify++) {
+        Snapshot snap = {NULL, 0};
+        initMedicineStore(&store);
+        initHashMap(&map);
+        initPriorityQueue(&pq);
+        t0 = nowSeconds();
+        int ok = loadSnapshot(snapPath, &snap, &store, &map, &pq, verify);
+        t1 = nowSeconds();
+        // lookups are served from the mapping right away
+        long long found = 0;
+        for (int i = 0; i < 1000; i++) found += searchMedicine(&map, (int)(benchRand(&seed) % n) + 1) >= 0;
+        printf("%-34s %10.1f ms  (%s, %lld/1000 lookups hit)\n",
+               verify ? "snapshot load + text checksum" : "snapshot load (mmap)", (t1 - t0) * 1e3,
+               ok ? "ok" : "FAILED", found);
+        freePriorityQueue(&pq);
+        freeHashMap(&map);
+        freeMedicineStore(&store);
+        closeSnapshot(&snap);
+    }
+    remove(snapPath);
+    remove(csvPath);
+}
+
+// History log: events/sec with group commit vs one fsync per event, then replay speed
+static void benchHistoryLog(int n) {
+    const char* prefix = "pillpilot_bench.wal";
+    HistoryLog log;
+    int* numbers = NULL;
+    char path[300];
+    printf("\n-- history log, %d events (target: 500k+ events/sec) --\n", n);
+
+    // one fsync per event, the naive way (only a couple hundred, it is slow)
+    int naive = n < 200 ? n : 200;
+    if (!openHistoryLog(&log, prefix, WAL_MAX_LATENCY_MS, NULL)) return;
+    double t0 = nowSeconds();
+    for (int i = 0; i < naive; i++) {
+        unsigned long long seq = appendHistoryLog(&log, i % 1000, "Paracetamol", HISTORY_TAKEN, time(NULL));
+        waitHistoryLog(&log, seq);
+    }
+    double t1 = nowSeconds();
+    printRate("fsync per event", naive, t1 - t0);
+    printf("%-34s %12llu fsyncs\n", "", log.syncs);
+    closeHistoryLog(&log);
+
+    // group commit: fire and forget, durable within WAL_MAX_LATENCY_MS
+    if (!openHistoryLog(&log, prefix, WAL_MAX_LATENCY_MS, NULL)) return;
+    log.maxSegmentRecords = n / 10 + 1;// force a few rotations + a compaction
+    log.compactAfter = 4;
+    time_t now = time(NULL);
+    t0 = nowSeconds();
+    unsigned long long seq = 0;
+    for (int i = 0; i < n; i++) {
+        seq = appendHistoryLog(&log, i % 1000, "Paracetamol", (i % 5) ? HISTORY_TAKEN : HISTORY_MISSED, now);
+    }
+    waitHistoryLog(&log, seq);
+    t1 = nowSeconds();
+    printRate("group commit (incl. final fsync)", n, t1 - t0);
+    printf("%-34s %12llu fsyncs, %d segments rotated\n", "", log.syncs, log.segment - 1);
+    closeHistoryLog(&log);
+
+    LinkedList history;
+    initLinkedList(&history);
+    t0 = nowSeconds();
+    if (!openHistoryLog(&log, prefix, WAL_MAX_LATENCY_MS, &history)) return;
+    t1 = nowSeconds();
+    printRate("replay into history list", history.count, t1 - t0);
+    if (history.count != naive + n) printf("!! replayed %d events, expected %d\n", history.count, naive + n);
+    closeHistoryLog(&log);
+    freeLinkedList(&history);
+
+    // clean up the bench log files
+    HistoryLog lister;
+    snprintf(lister.prefix, sizeof(lister.prefix), "%s", prefix);
+    int count = listSegments(&lister, &numbers);
+    for (int i = 0; i < count; i++) {
+        segmentPath(&lister, numbers[i], path, sizeof(path));
+        remove(path);
+    }
+    free(numbers);
+}
+
+// Resident memory right now, in bytes (0 if we can't tell on this system)
+static long long currentRss(void) {
+    long long pages = 0, resident = 0;
+    FILE* fp = fopen("/proc/self/statm", "r");
+    if (!fp) return 0;
+    if (fscanf(fp, "%lld %lld", &pages, &resident) != 2) resident = 0;
+    fclose(fp);
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+// Hand freed heap memory back to the OS so the next RSS measurement starts clean
+static void releaseFreedMemory(void) {
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif
+}
+
+// The old one-malloc-per-event history node, kept as the baseline
+typedef struct LegacyHistoryNode {
+    int medicineId;
+    char medicineName[MAX_NAME];
+    char status[10];
+    time_t timestamp;
+    struct LegacyHistoryNode* next;
+} LegacyHistoryNode;
+
+// History: build / scan / RSS for n events, one malloc per node vs the block list
+static void benchHistory(int n) {
+    printf("\n-- history, %d events --\n", n);
+    time_t now = time(NULL);
+    long long taken = 0;
+
+    releaseFreedMemory();
+    long long rss0 = currentRss();
+    LegacyHistoryNode* head = NULL;
+    double t0 = nowSeconds();
+    for (int i = 0; i < n; i++) {
+        LegacyHistoryNode* node = (LegacyHistoryNode*)malloc(sizeof(LegacyHistoryNode));
+        if (!node) break;
+        node->medicineId = i % 1000;
+        strcpy(node->medicineName, "Paracetamol");
+        strcpy(node->status, (i % 5) ? "taken" : "missed");
+        node->timestamp = now + i;
+        node->next = head;
+        head = node;
+    }
+    double t1 = nowSeconds();
+    long long rss1 = currentRss();
+    printRate("linked list build", n, t1 - t0);
+    t0 = nowSeconds();
+    for (LegacyHistoryNode* node = head; node; node = node->next) {
+        taken += strcmp(node->status, "taken") == 0;
+    }
+    t1 = nowSeconds();
+    printRate("linked list scan", n, t1 - t0);
+    printf("%-34s %12.1f MB (%.1f bytes/event)\n", "linked list RSS", (rss1 - rss0) / 1e6,
+           (double)(rss1 - rss0) / n);
+    while (head) {
+        LegacyHistoryNode* next = head->next;
+        free(head);
+        head = next;
+    }
+
+    releaseFreedMemory();
+    rss0 = currentRss();
+    LinkedList list;
+    initLinkedList(&list);
+    t0 = nowSeconds();
+    for (int i = 0; i < n; i++) {
+        insertHistoryEntry(&list, i % 1000, "Paracetamol", (i % 5) ? HISTORY_TAKEN : HISTORY_MISSED, now + i);
+    }
+    t1 = nowSeconds();
+    rss1 = currentRss();
+    printRate("block list build", n, t1 - t0);
+    t0 = nowSeconds();
+    for (HistoryBlock* block = list.head; block; block = block->older) {
+        for (int i = 0; i < block->count; i++) taken -= block->statuses[i] == HISTORY_TAKEN;
+    }
+    t1 = nowSeconds();
+    printRate("block list scan", n, t1 - t0);
+    printf("%-34s %12.1f MB (%.1f bytes/event)\n", "block list RSS", (rss1 - rss0) / 1e6,
+           (double)(rss1 - rss0) / n);
+    t0 = nowSeconds();
+    int dropped = trimHistory(&list, now + n / 2);
+    t1 = nowSeconds();
+    printRate("trim oldest half (block by block)", dropped, t1 - t0);
+    if (taken != 0) printf("!! scans disagree\n");
+    freeLinkedList(&list);
+}
+
+// Statistics: the old full rescan (localtime per entry) vs the running counters.
+// Events are spread over the last 30 days so "today" is a small slice; try n = 50000000
+static void benchStats(int n) {
+    printf("\n-- statistics, %d events --\n", n);
+    time_t now = time(NULL);
+    LinkedList list;
+    initLinkedList(&list);
+    long long span = 30LL * 24 * 3600;
+    double t0 = nowSeconds();
+    for (int i = 0; i < n; i++) {
+        time_t ts = now - span + (time_t)(span * (long long)i / n);
+        insertHistoryEntry(&list, i % 1000, "Paracetamol", (i % 5) ? HISTORY_TAKEN : HISTORY_MISSED, ts);
+    }
+    double t1 = nowSeconds();
+    printRate("build (with counters)", n, t1 - t0);
+
+    // what getStatistics used to do
+    int scanTaken = 0, scanMissed = 0;
+    t0 = nowSeconds();
+    struct tm today;
+    localtime_r(&now, &today);
+    for (HistoryBlock* block = list.head; block; block = block->older) {
+        for (int i = 0; i < block->count; i++) {
+            struct tm entryTime;
+            time_t ts = historyTime(block, i);
+            localtime_r(&ts, &entryTime);
+            if (entryTime.tm_year == today.tm_year && entryTime.tm_yday == today.tm_yday) {
+                if (block->statuses[i] == HISTORY_TAKEN) scanTaken++;
+                else scanMissed++;
+            }
+        }
+    }
+    t1 = nowSeconds();
+    printRate("full rescan, localtime per entry", n, t1 - t0);
+
+    int reps = 100000;
+    int taken = 0, missed = 0;
+    t0 = nowSeconds();
+    for (int r = 0; r < reps; r++) getStatistics(&list, &taken, &missed);
+    t1 = nowSeconds();
+    printRate("counters (per query)", reps, t1 - t0);
+    if (taken != scanTaken || missed != scanMissed) {
+        printf("!! counters disagree: %d/%d vs %d/%d\n", taken, missed, scanTaken, scanMissed);
+    } else {
+        printf("today: %d taken, %d missed (matches rescan)\n", taken, missed);
+    }
+    freeLinkedList(&list);
+}
+
+// History queries: "missed doses of one medicine in the last 30 days" over a year of history,
+// walking the whole linked list vs the columnar day blocks
+static void benchQuery(int n) {
+    printf("\n-- history query, %d events over 365 days --\n", n);
+    time_t now = time(NULL);
+    long long span = 365LL * 24 * 3600;
+    int medicines = 1000;
+    int queries = 20;
+    time_t from = now - 30LL * 24 * 3600;
+
+    LegacyHistoryNode* head = NULL;
+    LinkedList list;
+    initLinkedList(&list);
+    for (int i = 0; i < n; i++) {
+        time_t ts = now - span + (time_t)(span * (long long)i / n);
+        int status = (i % 5) ? HISTORY_TAKEN : HISTORY_MISSED;
+        LegacyHistoryNode* node = (LegacyHistoryNode*)malloc(sizeof(LegacyHistoryNode));
+        if (!node) break;
+        node->medicineId = i % medicines;
+        strcpy(node->medicineName, "Paracetamol");
+        strcpy(node->status, status == HISTORY_TAKEN ? "taken" : "missed");
+        node->timestamp = ts;
+        node->next = head;
+        head = node;
+        insertHistoryEntry(&list, i % medicines, "Paracetamol", status, ts);
+    }
+
+    long long listMatches = 0, blockMatches = 0;
+    double t0 = nowSeconds();
+    for (int q = 0; q < queries; q++) {
+        int medId = q * 37 % medicines;
+        for (LegacyHistoryNode* node = head; node; node = node->next) {
+            if (node->medicineId == medId && node->timestamp >= from && node->timestamp <= now &&
+                strcmp(node->status, "missed") == 0) listMatches++;
+        }
+    }
+    double t1 = nowSeconds();
+    double listTime = (t1 - t0) / queries;
+    t0 = nowSeconds();
+    for (int q = 0; q < queries; q++) {
+        blockMatches += queryHistory(&list, from, now + 1, q * 37 % medicines, HISTORY_MISSED, NULL, NULL);
+    }
+    t1 = nowSeconds();
+    double blockTime = (t1 - t0) / queries;
+    printf("%-34s %12.3f ms per query\n", "linked list traversal", listTime * 1e3);
+    printf("%-34s %12.3f ms per query (%.0fx)\n", "columnar day blocks", blockTime * 1e3,
+           blockTime > 0 ? listTime / blockTime : 0.0);
+    // whole-history query for comparison: every block is in range, no skipping
+    t0 = nowSeconds();
+    int all = queryHistory(&list, now - span, now + 1, -1, HISTORY_MISSED, NULL, NULL);
+    t1 = nowSeconds();
+    printRate("all missed, whole year (columns)", list.count, t1 - t0);
+    printf("matches: %lld (%d missed in total)\n", blockMatches, all);
+    if (listMatches != blockMatches) printf("!! queries disagree: %lld vs %lld\n", listMatches, blockMatches);
+
+    while (head) {
+        LegacyHistoryNode* next = head->next;
+        free(head);
+        head = next;
+    }
+    freeLinkedList(&list);
+}
+
+// Adherence kernels: every SIMD path must match the scalar one exactly (random columns,
+// odd lengths, ranges cutting through), then throughput of each over n events. Returns failures
+static int benchSimd(int n) {
+    printf("\n-- adherence kernels, %d events --\n", n);
+    int failures = 0;
+    unsigned char statuses[1031];
+    int32_t offsets[1031];
+    unsigned long long seed = 42;
+    for (int round = 0; round < 2000; round++) {
+        int len = (int)(benchRand(&seed) % 1031);
+        for (int i = 0; i < len; i++) {
+            statuses[i] = (unsigned char)(benchRand(&seed) % 4);// include codes that match neither
+            offsets[i] = (int32_t)(benchRand(&seed) % SECONDS_PER_DAY);
+        }
+        int32_t lo = (int32_t)(benchRand(&seed) % SECONDS_PER_DAY);
+        int32_t hi = lo + (int32_t)(benchRand(&seed) % (SECONDS_PER_DAY - lo + 1));
+        int start = len ? (int)(benchRand(&seed) % 4) : 0;// unaligned starts too
+        if (start > len) start = len;
+        int wantT = 0, wantM = 0, wantRangeT = 0, wantRangeM = 0;
+        countStatusScalar(statuses + start, len - start, &wantT, &wantM);
+        countStatusRangeScalar(statuses + start, offsets + start, len - start, lo, hi, &wantRangeT, &wantRangeM);
+        for (int k = 1; k < ADHERENCE_KERNEL_COUNT; k++) {
+            if (!adherenceKernelSupported(k)) continue;
+            int t = 0, m = 0, rt = 0, rm = 0;
+            adherenceKernels[k].countStatus(statuses + start, len - start, &t, &m);
+            adherenceKernels[k].countStatusRange(statuses + start, offsets + start, len - start, lo, hi, &rt, &rm);
+            if (t != wantT || m != wantM || rt != wantRangeT || rm != wantRangeM) {
+                if (failures++ < 5) {
+                    printf("!! %s differs (len %d): %d/%d %d/%d vs %d/%d %d/%d\n", adherenceKernels[k].name, len,
+                           t, m, rt, rm, wantT, wantM, wantRangeT, wantRangeM);
+                }
+            }
+        }
+    }
+
+    time_t now = time(NULL);
+    int days = 365;
+    long long span = (long long)days * SECONDS_PER_DAY;
+    LinkedList list;
+    initLinkedList(&list);
+    for (int i = 0; i < n; i++) {
+        time_t ts = now - span + (time_t)(span * (long long)i / n);
+        insertHistoryEntry(&list, i % 1000, "Paracetamol", (benchRand(&seed) % 5) ? HISTORY_TAKEN : HISTORY_MISSED, ts);
+    }
+    time_t firstDay = localDayStart(now, 1 - days);
+    SlotCount* want = (SlotCount*)malloc((size_t)days * sizeof(SlotCount));
+    SlotCount* got = (SlotCount*)malloc((size_t)days * sizeof(SlotCount));
+    const AdherenceKernels* previous = getAdherenceKernels();
+    for (int k = 0; k < ADHERENCE_KERNEL_COUNT && want && got; k++) {
+        char label[64];
+        if (!adherenceKernelSupported(k)) {
+            printf("%-34s not supported on this CPU\n", adherenceKernels[k].name);
+            continue;
+        }
+        selectAdherenceKernels(adherenceKernels[k].name);
+        int reps = 5;
+        double t0 = nowSeconds();
+        for (int r = 0; r < reps; r++) adherenceByDay(&list, firstDay, days, k == 0 ? want : got);
+        double t1 = nowSeconds();
+        snprintf(label, sizeof(label), "%s per-day histogram", adherenceKernels[k].name);
+        printRate(label, (long long)list.count * reps, t1 - t0);
+        t0 = nowSeconds();
+        int missed = 0;
+        for (int r = 0; r < reps; r++) missed = queryHistory(&list, now - span, now + 1, -1, HISTORY_MISSED, NULL, NULL);
+        t1 = nowSeconds();
+        snprintf(label, sizeof(label), "%s count missed", adherenceKernels[k].name);
+        printRate(label, (long long)list.count * reps, t1 - t0);
+        if (k > 0 && memcmp(want, got, (size_t)days * sizeof(SlotCount)) != 0) {
+            printf("!! %s histogram differs from scalar\n", adherenceKernels[k].name);
+            failures++;
+        }
+        (void)missed;
+    }
+    activeKernels = previous;
+    printf("kernel check: %s\n", failures ? "FAILED" : "scalar and SIMD paths agree");
+    free(want);
+    free(got);
+    freeLinkedList(&list);
+    return failures;
+}
+
+// Bulk import: n medicine rows from a CSV through batch mode (records/sec), plus the heap
+// build on its own - Floyd's O(n) heapify vs n x enqueuePQ. Try n = 10000000
+static void benchImport(int n) {
+    printf("\n-- bulk import, %d rows --\n", n);
+    const char* path = "pillpilot_bench_import.csv";
+    FILE* csv = fopen(path, "w");
+    if (!csv) {
+        printf("cannot write %s\n", path);
+        return;
+    }
+    unsigned long long seed = 7;
+    fprintf(csv, "id,name,dosage,time,instructions\n");
+    for (int i = 0; i < n; i++) {
+        unsigned minute = (unsigned)(benchRand(&seed) % 1440);
+        fprintf(csv, "%d,Medicine %d,500mg,%02u:%02u,\"After food, with water\"\n", i + 1, i, minute / 60, minute % 60);
+    }
+    fclose(csv);
+
+    MedicineStore store;
+    HashMap map;
+    PriorityQueue pq;
+    LinkedList history;
+    NameIndex names;
+    if (!initMedicineStore(&store) || !initHashMap(&map) || !initPriorityQueue(&pq) || !initNameIndex(&names)) return;
+    initLinkedList(&history);
+    double t0 = nowSeconds();
+    runBatch(path, &store, &map, &pq, &history, &names, NULL, NULL, stdout);
+    double t1 = nowSeconds();
+    printRate("batch import (parse + load)", map.count, t1 - t0);
+    for (int i = 1; i < pq.size; i++) {
+        if (pq.heap[(i - 1) / 2].priority > pq.heap[i].priority) {
+            printf("!! heap order broken at %d\n", i);
+            break;
+        }
+    }
+
+    // heap construction alone, same priorities in file order
+    PriorityQueue one;
+    initPriorityQueue(&one);
+    t0 = nowSeconds();
+    for (int h = 0; h < store.used; h++) enqueuePQ(&one, h, store.priorities[h]);
+    t1 = nowSeconds();
+    printRate("heap: n x enqueuePQ", store.used, t1 - t0);
+    freePriorityQueue(&one);
+    initPriorityQueue(&one);
+    t0 = nowSeconds();
+    for (int h = 0; h < store.used; h++) appendPQ(&one, h, store.priorities[h]);
+    buildHeapPQ(&one, 0);
+    t1 = nowSeconds();
+    printRate("heap: append + Floyd heapify", store.used, t1 - t0);
+    freePriorityQueue(&one);
+
+    freeNameIndex(&names);
+    freeLinkedList(&history);
+    freeHashMap(&map);
+    freePriorityQueue(&pq);
+    freeMedicineStore(&store);
+    remove(path);
+}
+
+// ID allocator stress: threads pull n IDs in total and mark each one in a shared bitmap,
+// so any ID handed out twice shows up. Then a clean restart and a "crash" (the ID file as it is
+// on disk while the allocator is still running) must both continue above everything seen.
+// Try n = 100000000
+#define ID_BENCH_THREADS 8
+typedef struct IdBenchWorker {
+    IdAllocator* alloc;
+    unsigned long long* seen;// bitmap over sequences
+    unsigned long long bits;
+    long long count;
+    long long duplicates;
+    long long outOfOrder;
+    MedicineId max;
+} IdBenchWorker;
+
+static void* idBenchThread(void* arg) {
+    IdBenchWorker* w = (IdBenchWorker*)arg;
+    IdBatch batch = {0, 0};
+    MedicineId last = -1;
+    for (long long i = 0; i < w->count; i++) {
+        MedicineId id = nextId(w->alloc, &batch, ID_BATCH_SIZE);
+        unsigned long long sequence = (unsigned long long)id & ((1ULL << ID_SEQUENCE_BITS) - 1);
+        if (id < 0 || sequence >= w->bits) {
+            w->duplicates++;// out of range counts as a failure too
+            continue;
+        }
+        unsigned long long mask = 1ULL << (sequence & 63);
+        if (__atomic_fetch_or(&w->seen[sequence >> 6], mask, __ATOMIC_RELAXED) & mask) w->duplicates++;
+        if (id <= last) w->outOfOrder++;// each writer's IDs only go up
+        last = id;
+    }
+    w->max = last;
+    return NULL;
+}
+
+// Returns the number of failures
+static int benchIds(int n) {
+    printf("\n-- id allocator, %d ids over %d threads --\n", n, ID_BENCH_THREADS);
+    const char* path = "pillpilot_bench.ids";
+    remove(path);
+    IdAllocator alloc;
+    if (openIdAllocator(&alloc, path, 3) < 0) return 1;
+    unsigned long long bits = (unsigned long long)n + (unsigned long long)ID_BENCH_THREADS * ID_BATCH_SIZE + 64;
+    unsigned long long* seen = (unsigned long long*)calloc((size_t)(bits / 64 + 1), sizeof(unsigned long long));
+    if (!seen) {
+        closeIdAllocator(&alloc);
+        return 1;
+    }
+    IdBenchWorker workers[ID_BENCH_THREADS];
+    pthread_t threads[ID_BENCH_THREADS];
+    double t0 = nowSeconds();
+    for (int t = 0; t < ID_BENCH_THREADS; t++) {
+        workers[t] = (IdBenchWorker){&alloc, seen, bits, n / ID_BENCH_THREADS + (t < n % ID_BENCH_THREADS), 0, 0, -1};
+        pthread_create(&threads[t], NULL, idBenchThread, &workers[t]);
+    }
+    long long duplicates = 0, outOfOrder = 0;
+    MedicineId max = -1;
+    for (int t = 0; t < ID_BENCH_THREADS; t++) {
+        pthread_join(threads[t], NULL);
+        duplicates += workers[t].duplicates;
+        outOfOrder += workers[t].outOfOrder;
+        if (workers[t].max > max) max = workers[t].max;
+    }
+    double t1 = nowSeconds();
+    printRate("batched ids (all threads)", n, t1 - t0);
+    printf("%-34s %lld duplicates, %lld out of order, node %lld\n", "uniqueness", duplicates, outOfOrder,
+           max >> ID_SEQUENCE_BITS);
+    int failures = duplicates != 0 || outOfOrder != 0;
+
+    // crash: copy the ID file as it is right now, before the allocator writes its final state
+    const char* crashPath = "pillpilot_bench_crash.ids";
+    IdFileHeader onDisk;
+    int copied = pread(alloc.fd, &onDisk, sizeof(onDisk), 0) == (ssize_t)sizeof(onDisk);
+    int crashFd = open(crashPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    copied = copied && crashFd >= 0 && write(crashFd, &onDisk, sizeof(onDisk)) == (ssize_t)sizeof(onDisk);
+    if (crashFd >= 0) close(crashFd);
+    IdAllocator crashed;
+    MedicineId afterCrash = -1;
+    if (copied && openIdAllocator(&crashed, crashPath, -1) == 1 && reserveIds(&crashed, 1, &afterCrash)) {
+        printf("%-34s first id %lld (> %lld)\n", "after crash", afterCrash, max);
+        failures += afterCrash <= max;
+        closeIdAllocator(&crashed);
+    } else {
+        failures++;
+    }
+    remove(crashPath);
+
+    // clean restart continues exactly where the first allocator stopped
+    MedicineId stopped = ((MedicineId)alloc.node << ID_SEQUENCE_BITS) | (MedicineId)alloc.next;
+    closeIdAllocator(&alloc);
+    MedicineId afterRestart = -1;
+    if (openIdAllocator(&alloc, path, -1) == 1 && reserveIds(&alloc, 1, &afterRestart)) {
+        printf("%-34s first id %lld (expected %lld)\n", "after restart", afterRestart, stopped);
+        failures += afterRestart != stopped;
+    } else {
+        failures++;
+    }
+    closeIdAllocator(&alloc);
+    remove(path);
+
+    // batch import mixing allocated and explicit IDs: an explicit ID inside the batch of IDs
+    // already reserved must not be handed out again, and a row with an empty ID gets one too
+    const char* inputPath = "pillpilot_bench_ids.txt";
+    FILE* in = fopen(inputPath, "w");
+    MedicineStore store;
+    HashMap map;
+    PriorityQueue pq;
+    LinkedList history;
+    NameIndex names;
+    int ready = in != NULL && openIdAllocator(&alloc, path, 0) >= 0;
+    if (ready) {
+        fputs("add,,A,1mg,08:00\n5,B,1mg,08:00\nadd,,C,1mg,08:00\nadd,,D,1mg,08:00\nadd,,E,1mg,08:00\n"
+              "add,,F,1mg,08:00\nadd,,G,1mg,08:00\n,H,1mg,08:00,from a CSV with no IDs\n", in);
+        fclose(in);
+        in = NULL;
+        int storeOk = initMedicineStore(&store);
+        int mapOk = initHashMap(&map);
+        int pqOk = initPriorityQueue(&pq);
+        int namesOk = initNameIndex(&names);
+        initLinkedList(&history);
+        FILE* out = storeOk && mapOk && pqOk && namesOk ? fopen("/dev/null", "w") : NULL;
+        int errors = out ? runBatch(inputPath, &store, &map, &pq, &history, &names, NULL, &alloc, out) : 1;
+        if (out) fclose(out);
+        printf("%-34s %d medicines, %s\n", "import with explicit ids", mapOk ? map.count : 0,
+               errors ? "errors" : "no errors");
+        failures += errors != 0 || !mapOk || map.count != 8;
+        freeNameIndex(&names);
+        freeLinkedList(&history);
+        if (mapOk) freeHashMap(&map);
+        freePriorityQueue(&pq);
+        freeMedicineStore(&store);
+        closeIdAllocator(&alloc);
+    } else {
+        failures++;
+    }
+    if (in) fclose(in);
+    remove(inputPath);
+    printf("id check: %s\n", failures ? "FAILED" : "all ids unique");
+    free(seen);
+    remove(path);
+    return failures;
+}
+
+// Concurrent map throughput: n keys preloaded, then 1..8 threads run n operations between
+// them. Reads hit random preloaded keys (and check the handle), writes add and remove keys
+// owned by the thread, so a good share of them move the table through growth and tombstone
+// clean-ups. Compared against the plain HashMap behind one pthread rwlock. Try n = 2000000
+#define CONCURRENT_BENCH_MAX_THREADS 8
+typedef struct ConcurrentBenchWorker {
+    ConcurrentHashMap* map;// NULL = the rwlock baseline
+    HashMap* locked;
+    pthread_rwlock_t* lock;
+    int reader;
+    int preload;
+    long long ops;
+    int writePercent;
+    MedicineId ownKeys;// first of this thread's write keys
+    unsigned long long seed;
+    long long wrong;
+    long long held;// own keys still in at the end
+} ConcurrentBenchWorker;
+
+static void* concurrentBenchThread(void* arg) {
+    ConcurrentBenchWorker* w = (ConcurrentBenchWorker*)arg;
+    MedicineId added = 0, removed = 0;// own keys [ownKeys + removed, ownKeys + added) are in
+    for (long long i = 0; i < w->ops; i++) {
+        unsigned long long r = benchRand(&w->seed);
+        if ((int)(r % 100) < w->writePercent) {
+            // alternate adding a new key and dropping the oldest, so the map keeps its size
+            int add = added == removed || (r >> 8 & 1);
+            MedicineId id = w->ownKeys + (add ? added : removed);
+            if (w->map) {
+                if (add ? !insertMedicineConcurrent(w->map, id, (int)(id & 0x3fffffff))
+                        : deleteMedicineConcurrent(w->map, id) < 0) w->wrong++;
+            } else {
+                pthread_rwlock_wrlock(w->lock);
+                if (add) insertMedicine(w->locked, id, (int)(id & 0x3fffffff));
+                else deleteMedicine(w->locked, id);
+                pthread_rwlock_unlock(w->lock);
+            }
+            if (add) added++;
+            else removed++;
+        } else {
+            int key = (int)((r >> 8) % (unsigned long long)w->preload);
+            int handle;
+            if (w->map) {
+                handle = searchMedicineConcurrent(w->map, w->reader, key + 1);
+            } else {
+                pthread_rwlock_rdlock(w->lock);
+                handle = searchMedicine(w->locked, key + 1);
+                pthread_rwlock_unlock(w->lock);
+            }
+            if (handle != key) w->wrong++;
+        }
+    }
+    w->held = added - removed;
+    return NULL;
+}
+
+// Returns the number of failures
+static int benchConcurrent(int n) {
+    printf("\n-- concurrent hashmap, %d keys, %d ops per run --\n", n, n);
+    int failures = 0;
+    int mixes[2] = {5, 50};
+    for (int m = 0; m < 2; m++) {
+        for (int baseline = 0; baseline < 2; baseline++) {
+            for (int threads = 1; threads <= CONCURRENT_BENCH_MAX_THREADS; threads *= 2) {
+                ConcurrentHashMap* map = NULL;
+                HashMap locked;
+                pthread_rwlock_t lock;
+                if (!baseline) {
+                    map = (ConcurrentHashMap*)malloc(sizeof(ConcurrentHashMap));
+                    if (!map || !initConcurrentHashMap(map)) {
+                        free(map);
+                        return failures + 1;
+                    }
+                    for (int i = 0; i < n; i++) insertMedicineConcurrent(map, i + 1, i);
+                } else {
+                    if (!initHashMap(&locked)) return failures + 1;
+                    for (int i = 0; i < n; i++) insertMedicine(&locked, i + 1, i);
+                    pthread_rwlock_init(&lock, NULL);
+                }
+                ConcurrentBenchWorker workers[CONCURRENT_BENCH_MAX_THREADS];
+                pthread_t ids[CONCURRENT_BENCH_MAX_THREADS];
+                double t0 = nowSeconds();
+                for (int t = 0; t < threads; t++) {
+                    workers[t] = (ConcurrentBenchWorker){map, &locked, &lock, map ? registerMapReader(map) : -1, n,
+                                                         n / threads + (t < n % threads), mixes[m],
+                                                         ((MedicineId)(t + 1) << 40), 0x9e3779b97f4a7c15ULL * (t + 1), 0, 0};
+                    pthread_create(&ids[t], NULL, concurrentBenchThread, &workers[t]);
+                }
+                long long wrong = 0;
+                for (int t = 0; t < threads; t++) {
+                    pthread_join(ids[t], NULL);
+                    wrong += workers[t].wrong;
+                }
+                double t1 = nowSeconds();
+                char label[64];
+                snprintf(label, sizeof(label), "%s %d/%d, %d thread%s", baseline ? "rwlock" : "concurrent",
+                         100 - mixes[m], mixes[m], threads, threads > 1 ? "s" : "");
+                printRate(label, n, t1 - t0);
+                if (map) {
+                    // every preloaded key still points at its handle, lock-free and through the
+                    // locked path readers past MAP_MAX_READERS get (reader -1)
+                    int reader = registerMapReader(map);
+                    for (int i = 0; i < n; i++) {
+                        if (searchMedicineConcurrent(map, reader, i + 1) != i) wrong++;
+                        if (searchMedicineConcurrent(map, -1, i + 1) != i) wrong++;
+                    }
+                    long long expected = n;
+                    for (int t = 0; t < threads; t++) expected += workers[t].held;
+                    if (concurrentHashMapCount(map) != expected) wrong++;
+                    freeConcurrentHashMap(map);
+                    free(map);
+                } else {
+                    freeHashMap(&locked);
+                    pthread_rwlock_destroy(&lock);
+                }
+                if (wrong) printf("  %lld wrong results\n", wrong);
+                failures += wrong != 0;
+            }
+        }
+    }
+    printf("concurrent check: %s\n", failures ? "FAILED" : "all lookups correct");
+    return failures;
+}
+
+// Reminder scheduler: O(1) arm / cancel with millions of timers, then the dispatch jitter
+// (how late a callback runs after its tick) with the thread running. A run arms timers spread
+// over 2 seconds, cancels every tenth one and checks each of the rest fires exactly once and
+// never early. Try n = 5000000
+typedef struct ReminderBenchState {
+    long long* lateNs;// per handle, -1 until fired
+    int* fires;
+    long long fired;// atomic
+} ReminderBenchState;
+
+static void reminderBenchCallback(void* ctx, const ReminderFired* fired) {
+    ReminderBenchState* state = (ReminderBenchState*)ctx;
+    state->lateNs[fired->handle] = fired->firedNs - fired->dueNs;
+    state->fires[fired->handle]++;
+    __atomic_fetch_add(&state->fired, 1, __ATOMIC_RELEASE);
+}
+
+static int compareLongLong(const void* a, const void* b) {
+    long long x = *(const long long*)a, y = *(const long long*)b;
+    return (x > y) - (x < y);
+}
+
+// Returns the number of failures
+static int reminderJitterRun(const char* label, int timers, int spreadMs) {
+    ReminderScheduler s;
+    ReminderBenchState state = {NULL, NULL, 0};
+    state.lateNs = (long long*)malloc((size_t)timers * sizeof(long long));
+    state.fires = (int*)calloc((size_t)timers, sizeof(int));
+    if (!state.lateNs || !state.fires || !initReminderScheduler(&s, reminderBenchCallback, &state)) {
+        free(state.lateNs);
+        free(state.fires);
+        return 1;
+    }
+    if (!startReminderScheduler(&s)) {
+        freeReminderScheduler(&s);
+        free(state.lateNs);
+        free(state.fires);
+        return 1;
+    }
+    unsigned long long seed = 0x243f6a8885a308d3ULL;
+    long long start = monotonicNs() + 100000000LL;// first one 100 ms out
+    long long expected = 0;
+    for (int h = 0; h < timers; h++) {
+        state.lateNs[h] = -1;
+        long long due = start + (long long)(benchRand(&seed) % ((unsigned long long)spreadMs * 1000000));
+        armReminderAt(&s, h, h + 1, due);
+    }
+    for (int h = 0; h < timers; h += 10) cancelReminder(&s, h);// cancelled before they're due
+    expected = timers - (timers + 9) / 10;
+    long long deadline = start + (long long)spreadMs * 1000000 + 10000000000LL;
+    while (__atomic_load_n(&state.fired, __ATOMIC_ACQUIRE) < expected && monotonicNs() < deadline) {
+        usleep(10000);
+    }
+    usleep(20000);// anything firing twice would show up by now
+    freeReminderScheduler(&s);
+
+    int failures = 0;
+    long long count = 0, early = 0, wrong = 0;
+    for (int h = 0; h < timers; h++) {
+        int shouldFire = h % 10 != 0;
+        if (state.fires[h] != shouldFire) wrong++;
+        if (state.fires[h] && state.lateNs[h] < 0) early++;
+        if (state.fires[h]) state.lateNs[count++] = state.lateNs[h];// pack the fired ones to the front
+    }
+    qsort(state.lateNs, (size_t)count, sizeof(long long), compareLongLong);
+    if (count > 0) {
+        printf("%-34s %9lld fired  p50 %7.1f us  p90 %7.1f us  p99 %7.1f us  p99.9 %7.1f us  max %8.1f us\n", label,
+               count, state.lateNs[count * 50 / 100] / 1e3, state.lateNs[count * 90 / 100] / 1e3,
+               state.lateNs[count * 99 / 100] / 1e3, state.lateNs[count * 999 / 1000] / 1e3,
+               state.lateNs[count - 1] / 1e3);
+    }
+    if (wrong || early) {
+        printf("  %lld timers fired the wrong number of times, %lld early\n", wrong, early);
+        failures++;
+    }
+    free(state.lateNs);
+    free(state.fires);
+    return failures;
+}
+
+static int benchReminders(int n) {
+    printf("\n-- reminder scheduler, %d timers --\n", n);
+    ReminderScheduler s;
+    if (!initReminderScheduler(&s, reminderBenchCallback, NULL)) return 1;
+    unsigned long long seed = 0x13198a2e03707344ULL;
+    long long base = monotonicNs();
+    int* order = (int*)malloc((size_t)n * sizeof(int));
+    if (!order) {
+        freeReminderScheduler(&s);
+        return 1;
+    }
+    double t0 = nowSeconds();
+    for (int h = 0; h < n; h++) {// one dose time each, anywhere in the next 24 hours
+        armReminderAt(&s, h, h + 1, base + (long long)(benchRand(&seed) % 86400000ULL) * 1000000);
+    }
+    double t1 = nowSeconds();
+    printRate("arm (daily spread)", n, t1 - t0);
+    for (int h = 0; h < n; h++) order[h] = h;
+    shuffleInts(order, n, &seed);
+    t0 = nowSeconds();
+    for (int h = 0; h < n; h++) cancelReminder(&s, order[h]);
+    t1 = nowSeconds();
+    printRate("cancel (random order)", n, t1 - t0);
+    int failures = s.pending != 0;
+    free(order);
+    freeReminderScheduler(&s);
+
+    // catching up: a repeating reminder whose next dose is already past goes out on the very
+    // next tick, not a wheel turn later. Ticks are run by hand, no thread
+    if (!initReminderScheduler(&s, reminderBenchCallback, NULL)) return failures + 1;
+    RecurrenceRule everyMinute;
+    time_t missed = time(NULL) / 60 * 60 - 600;// ten doses ago
+    dailyRule(&everyMinute, 0);
+    everyMinute.interval = 1;
+    everyMinute.start = missed;
+    pthread_mutex_lock(&s.lock);
+    setReminderLocked(&s, 0, 1, monotonicMsAt(missed), &everyMinute, missed);
+    for (int tick = 0; tick < 3; tick++) runWheelTick(&s);
+    pthread_mutex_unlock(&s.lock);
+    printf("%-34s %d of 3 ticks fired a missed dose\n", "catch-up", s.firedCount);
+    failures += s.firedCount != 3;
+    freeReminderScheduler(&s);
+
+    failures += reminderJitterRun("jitter, 2000 over 2 s", 2000, 2000);
+    int dense = n < 1000000 ? n : 1000000;
+    char label[64];
+    snprintf(label, sizeof(label), "jitter, %d over 2 s", dense);
+    failures += reminderJitterRun(label, dense, 2000);
+    printf("reminder check: %s\n", failures ? "FAILED" : "every timer fired once, none early");
+    return failures;
+}
+
+// Recurrence rules: lazy expansion against brute force, then a month of doses for n
+// prescriptions dispatched through the queue with popDueDose. The queue never holds more
+// than one node per prescription, however many doses go through it. Try n = 100000
+static void randomRule(RecurrenceRule* rule, time_t now, unsigned long long* seed) {
+    dailyRule(rule, (int)(benchRand(seed) % 1440));
+    int kind = (int)(benchRand(seed) % 4);
+    if (kind == 1) {// several times a day
+        int extra = 1 + (int)(benchRand(seed) % (MAX_DOSE_TIMES - 1));
+        for (int i = 0; i < extra; i++) addDoseTime(rule, (int)(benchRand(seed) % 1440));
+    } else if (kind == 2) {// every few hours (or minutes) from some time in the last day
+        int intervals[5] = {30, 240, 360, 480, 720};
+        rule->interval = intervals[benchRand(seed) % 5];
+        rule->start = now - (time_t)(benchRand(seed) % 86400) / 60 * 60;
+    }
+    if (benchRand(seed) % 3 == 0) rule->weekdays = (uint8_t)(1 + benchRand(seed) % EVERY_DAY);
+    if (benchRand(seed) % 3 == 0) rule->end = now + (time_t)(1 + benchRand(seed) % 20) * 86400;
+}
+
+// Is there a dose of the rule at exactly t (a whole minute)? The slow, obvious way
+static int isDoseAt(const RecurrenceRule* rule, time_t t) {
+    struct tm tmAt;
+    localtime_r(&t, &tmAt);
+    int days = rule->weekdays & EVERY_DAY ? rule->weekdays & EVERY_DAY : EVERY_DAY;
+    if (!(days & (1 << tmAt.tm_wday)) || (rule->end && t >= rule->end) || t < rule->start) return 0;
+    if (rule->interval > 0) return (t - rule->start) % ((time_t)rule->interval * 60) == 0;
+    time_t hourBefore = t - 3600;
+    struct tm tmBefore;
+    localtime_r(&hourBefore, &tmBefore);
+    if (tmBefore.tm_hour == tmAt.tm_hour && tmBefore.tm_min == tmAt.tm_min) return 0;// clocks went back: once is enough
+    for (int i = 0; i < rule->timeCount; i++) {
+        if (rule->times[i] == tmAt.tm_hour * 60 + tmAt.tm_min) return 1;
+    }
+    return 0;
+}
+
+// Returns the number of failures
+static int benchRecurrence(int n) {
+    printf("\n-- recurrence rules, %d prescriptions --\n", n);
+    time_t now = time(NULL) / 60 * 60;
+    unsigned long long seed = 0xa4093822299f31d0ULL;
+    int failures = 0;
+
+    // every dose over 10 days from nextOccurrence, minute by minute from brute force
+    int checkRules = 200;
+    long long checked = 0;
+    for (int r = 0; r < checkRules; r++) {
+        RecurrenceRule rule;
+        randomRule(&rule, now, &seed);
+        time_t t = nextOccurrence(&rule, now - 1);
+        for (time_t m = now; m < now + 10 * 86400; m += 60) {
+            int expected = isDoseAt(&rule, m);
+            int got = t == m;
+            if (expected != got) {
+                char text[160];
+                formatRecurrence(&rule, text, sizeof(text));
+                printf("  mismatch at %lld for \"%s\" (next dose said %lld)\n", (long long)m, text, (long long)t);
+                failures++;
+                break;
+            }
+            if (got) t = nextOccurrence(&rule, t);
+            checked++;
+        }
+    }
+    const char* samples[] = {"", "08:00,14:00,20:00", "every 8h for 10 days", "mon wed fri until 2030-01-31",
+                             "weekdays 07:30", "every 90m from 2026-01-01 for 3 days"};
+    const char* bad[] = {"every", "every 0h", "sometimes", "25:00", "for -1 days", "until 2026-13-01",
+                         "09:00 every 8h"};
+    for (int i = 0; i < (int)(sizeof(samples) / sizeof(samples[0])); i++) {
+        RecurrenceRule rule;
+        char text[160];
+        if (!parseRecurrence(samples[i], 8 * 60, now, &rule)) {
+            printf("  rejected \"%s\"\n", samples[i]);
+            failures++;
+            continue;
+        }
+        formatRecurrence(&rule, text, sizeof(text));
+        printf("  %-36s -> %s\n", *samples[i] ? samples[i] : "(empty)", text);
+    }
+    for (int i = 0; i < (int)(sizeof(bad) / sizeof(bad[0])); i++) {
+        RecurrenceRule rule;
+        if (parseRecurrence(bad[i], 8 * 60, now, &rule)) {
+            printf("  accepted \"%s\"\n", bad[i]);
+            failures++;
+        }
+    }
+    printf("%-34s %lld minutes over %d rules, %d mismatches\n", "expansion vs brute force", checked, checkRules,
+           failures);
+
+    // rescheduling a multi-dose medicine moves its own time, not the earliest one
+    const char* moves[][4] = {// rule, medicine's time, new time, expected
+        {"08:00,14:00", "20:00", "21:00", "08:00,14:00,21:00"},
+        {"08:00,14:00", "20:00", "07:00", "07:00,08:00,14:00"},
+        {"", "09:30", "10:15", "daily 10:15"},
+        {"12:00", "06:00", "12:00", "daily 12:00"},
+    };
+    for (int i = 0; i < (int)(sizeof(moves) / sizeof(moves[0])); i++) {
+        RecurrenceRule rule;
+        char text[160];
+        int from = calculatePriority((char*)moves[i][1]), to = calculatePriority((char*)moves[i][2]);
+        if (!parseRecurrence(moves[i][0], from, now, &rule)) {
+            printf("  rejected \"%s\"\n", moves[i][0]);
+            failures++;
+            continue;
+        }
+        rescheduleRule(&rule, from, to);
+        formatRecurrence(&rule, text, sizeof(text));
+        if (strcmp(text, moves[i][3]) != 0) {
+            printf("  \"%s\" at %s moved to %s gave %s, expected %s\n", moves[i][0], moves[i][1], moves[i][2], text,
+                   moves[i][3]);
+            failures++;
+        }
+    }
+    printf("%-34s %d rules checked\n", "reschedule keeps the other doses", (int)(sizeof(moves) / sizeof(moves[0])));
 
-// HashMap Structure - main storage for medicines
-typedef struct HashMap {
-    HashNode table[TABLE_SIZE]; //Array of HashNodes
-    int count;
-} HashMap;
+    // a month of doses through the queue
+    MedicineStore store;
+    PriorityQueue pq;
+    if (!initMedicineStore(&store) || !initPriorityQueue(&pq)) return failures + 1;
+    Medicine med;
+    memset(&med, 0, sizeof(med));
+    for (int i = 0; i < n; i++) {
+        med.id = i + 1;
+        int handle = addToStore(&store, &med);
+        if (handle < 0) break;
+        randomRule(&store.rules[handle], now, &seed);
+        time_t next = nextOccurrence(&store.rules[handle], now);
+        if (next >= 0) appendPQ(&pq, handle, doseKey(next));
+    }
+    buildHeapPQ(&pq, 0);
+    int queued = pq.size, largest = pq.size;
+    long long doses = 0;
+    PQNode node;
+    double t0 = nowSeconds();
+    for (time_t clock = now; clock < now + 30 * 86400; clock += 60) {// one tick a minute
+        while (popDueDose(&pq, &store, clock, &node)) doses++;
+        if (pq.size > largest) largest = pq.size;
+    }
+    double t1 = nowSeconds();
+    printRate("dispatch 30 days (pop + next dose)", doses, t1 - t0);
+    printf("%-34s %d queued at start, %d at most, %d left; %lld doses went through\n", "queue size", queued,
+           largest, pq.size, doses);
+    failures += largest > n;
+    freePriorityQueue(&pq);
+    freeMedicineStore(&store);
+    printf("recurrence check: %s\n", failures ? "FAILED" : "lazy expansion matches");
+    return failures;
+}
 
-// Priority Queue Node  (for scheduling reminders)
-typedef struct PQNode {
-    Medicine medicine; // Medicine data
-    int priority;// Priority based on time; Using a min-heap for the priority queue
-} PQNode;
+// Events for one bench pass, bucketed by shard (counting sort: shard s owns events
+// order[start[s]] .. order[start[s + 1] - 1])
+typedef struct WardBenchEvents {
+    const PatientId* patients;
+    const MedicineId* medicines;
+    const unsigned char* statuses;
+    const int* order;
+    const int* start;
+    time_t now;
+    long long* dosesPerShard;
+} WardBenchEvents;
 
-// Priority Queue (Min-Heap) -keeps medicines sorted by time
-typedef struct PriorityQueue {
-    PQNode heap[TABLE_SIZE];// Array-based heap
-    int size;
-    //heap[0] is root, for node at index i:
-    //left child at 2*i+1
-    //right child at 2*i+2  
-    //parent at (i-1)/2
-} PriorityQueue;
+// Shard task: record the shard's events in its history, then send out its next day of doses
+static void wardBenchTask(PatientShard* shard, int shardIndex, void* ctx) {
+    WardBenchEvents* ev = (WardBenchEvents*)ctx;
+    pthread_mutex_lock(&shard->lock);
+    for (int i = ev->start[shardIndex]; i < ev->start[shardIndex + 1]; i++) {
+        int e = ev->order[i];
+        int handle = searchMedicine(&shard->map, ev->medicines[e]);
+        if (handle < 0 || shard->patients[handle] != ev->patients[e]) continue;
+        insertHistoryEntry(&shard->history, ev->medicines[e], shard->store.text[handle].name, ev->statuses[e],
+                           ev->now + e % 86400);
+    }
+    long long doses = 0;
+    while (popDueDose(&shard->pq, &shard->store, ev->now + 86400, NULL)) doses++;
+    ev->dosesPerShard[shardIndex] = doses;
+    pthread_mutex_unlock(&shard->lock);
+}
 
-// History Node (Linked List) -for tracking taken/missed medicines
-typedef struct HistoryNode {
-    int medicineId;// Medicine ID
-    char medicineName[MAX_NAME];// Medicine name
-    char status[10];  // "taken" or "missed"
-    time_t timestamp;// Time of entry
-    struct HistoryNode* next;// Pointer to next node
-    //New entries are added at the head for O(1) insertion
-} HistoryNode;
+#define WARD_BENCH_PATIENTS 20000
+#define WARD_BENCH_MEDS 4 //medicines per patient
+#define WARD_BENCH_SHARDS 256
 
-//Linked List Structure -for history tracking
-typedef struct LinkedList {
-    HistoryNode* head;// Pointer to head node
-    int count;// Count of history entries
-} LinkedList;
+// Fill a fresh ward: every patient gets WARD_BENCH_MEDS medicines with random rules
+// (on failure the ward is freed again)
+static int fillBenchWard(Ward* ward, time_t now) {
+    if (!initWard(ward, WARD_BENCH_SHARDS)) {
+        freeWard(ward);
+        return 0;
+    }
+    unsigned long long seed = 0x3c6ef372fe94f82bULL;
+    Medicine med;
+    memset(&med, 0, sizeof(med));
+    for (PatientId p = 1; p <= WARD_BENCH_PATIENTS; p++) {
+        for (int k = 0; k < WARD_BENCH_MEDS; k++) {
+            RecurrenceRule rule;
+            randomRule(&rule, now, &seed);
+            med.id = p * WARD_BENCH_MEDS + k;
+            snprintf(med.name, MAX_NAME, "Med %d", k);
+            if (addWardMedicine(ward, p, &med, &rule, now) < 0) {
+                freeWard(ward);
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
 
-//HashMap -Hash tables give us fast lookup; way better than searching arrays!
-//Hash function -converts medicine ID to array index
-int hashFunction(int id) {
-    //using simple modulo for hashing
-    return id % TABLE_SIZE;
-    //basic hash function, could be improved
+// Returns the number of failures
+static int benchWard(int n) {
+    printf("\n-- ward, %d patients x %d medicines in %d shards, %d events --\n", WARD_BENCH_PATIENTS,
+           WARD_BENCH_MEDS, WARD_BENCH_SHARDS, n);
+    time_t now = time(NULL) / 60 * 60;
+    int failures = 0;
+    PatientId* patients = (PatientId*)malloc((size_t)n * sizeof(PatientId));
+    MedicineId* medicines = (MedicineId*)malloc((size_t)n * sizeof(MedicineId));
+    unsigned char* statuses = (unsigned char*)malloc((size_t)n);
+    int* order = (int*)malloc((size_t)n * sizeof(int));
+    int* start = (int*)calloc(WARD_BENCH_SHARDS + 1, sizeof(int));
+    long long* dosesPerShard = (long long*)calloc(WARD_BENCH_SHARDS, sizeof(long long));
+    int* fill = (int*)malloc(WARD_BENCH_SHARDS * sizeof(int));
+    Ward ward;
+    if (!patients || !medicines || !statuses || !order || !start || !dosesPerShard || !fill ||
+        !fillBenchWard(&ward, now)) {
+        free(patients);
+        free(medicines);
+        free(statuses);
+        free(order);
+        free(start);
+        free(dosesPerShard);
+        free(fill);
+        return 1;
+    }
+    // skewed load: a few patients (so a few shards) get most of the events
+    unsigned long long seed = 0x9b05688c2b3e6c1fULL;
+    for (int e = 0; e < n; e++) {
+        double u = (double)(benchRand(&seed) % 1000000) / 1000000.0;
+        patients[e] = 1 + (PatientId)(u * u * u * WARD_BENCH_PATIENTS);
+        medicines[e] = patients[e] * WARD_BENCH_MEDS + (MedicineId)(benchRand(&seed) % WARD_BENCH_MEDS);
+        statuses[e] = benchRand(&seed) % 5 ? HISTORY_TAKEN : HISTORY_MISSED;
+        start[wardShardOf(&ward, patients[e]) + 1]++;
+    }
+    for (int s = 0; s < WARD_BENCH_SHARDS; s++) start[s + 1] += start[s];
+    memcpy(fill, start, WARD_BENCH_SHARDS * sizeof(int));
+    for (int e = 0; e < n; e++) order[fill[wardShardOf(&ward, patients[e])]++] = e;
+    free(fill);
+    int busiest = 0;
+    for (int s = 0; s < WARD_BENCH_SHARDS; s++) {
+        if (start[s + 1] - start[s] > busiest) busiest = start[s + 1] - start[s];
+    }
+    printf("%-34s busiest shard has %d events (even split would be %d)\n", "load", busiest, n / WARD_BENCH_SHARDS);
+    WardBenchEvents events = {patients, medicines, statuses, order, start, now, dosesPerShard};
+
+    long long firstDoses = -1;
+    for (int workers = 1; workers <= CONCURRENT_BENCH_MAX_THREADS; workers *= 2) {
+        if (workers > 1 && !fillBenchWard(&ward, now)) {// every run starts from the same ward
+            failures++;
+            break;
+        }
+        WardPool pool;
+        if (!initWardPool(&pool, &ward, workers)) {
+            freeWardPool(&pool);
+            freeWard(&ward);
+            failures++;
+            break;
+        }
+        double t0 = nowSeconds();
+        runWardPass(&pool, wardBenchTask, &events);
+        double t1 = nowSeconds();
+        long long recorded = 0, doses = 0, steals = 0;
+        for (int s = 0; s < ward.shardCount; s++) {
+            recorded += ward.shards[s].history.count;
+            doses += dosesPerShard[s];
+        }
+        for (int w = 0; w < pool.workerCount; w++) steals += pool.workers[w].steals;
+        char label[48];
+        snprintf(label, sizeof(label), "%d worker%s (events + 24h doses)", workers, workers > 1 ? "s" : "");
+        printRate(label, n, t1 - t0);
+        printf("%-34s %lld recorded, %lld doses, %lld steals\n", "", recorded, doses, steals);
+        if (recorded != n || (firstDoses >= 0 && doses != firstDoses)) {
+            printf("  worker run %d lost work\n", workers);
+            failures++;
+        }
+        firstDoses = doses;
+        freeWardPool(&pool);
+        if (workers * 2 <= CONCURRENT_BENCH_MAX_THREADS) freeWard(&ward);
+    }
+
+    // ward-wide "due in the next 15 minutes": k-way merge vs counting every shard's heap
+    if (ward.shardCount > 0) {
+        int max = WARD_BENCH_PATIENTS * WARD_BENCH_MEDS;
+        WardDose* due = (WardDose*)malloc((size_t)max * sizeof(WardDose));
+        time_t at = now + 86400;// the queues sit a day ahead after the pass
+        int limit = doseKey(at) + 15, expected = 0, found = 0, rounds = 1000;
+        for (int s = 0; s < ward.shardCount; s++) {
+            for (int i = 0; i < ward.shards[s].pq.size; i++) expected += ward.shards[s].pq.heap[i].priority <= limit;
+        }
+        double t0 = nowSeconds();
+        for (int r = 0; r < rounds && due; r++) found = dueAcrossWard(&ward, at, 15, due, max);
+        double t1 = nowSeconds();
+        printRate("due in next 15 min (k-way merge)", rounds, t1 - t0);
+        int sorted = 1;
+        for (int i = 1; i < found; i++) sorted &= due[i - 1].key <= due[i].key;
+        printf("%-34s %d doses (brute force %d), %s\n", "", found, expected, sorted ? "in order" : "NOT in order");
+        failures += !due || found != expected || !sorted;
+        free(due);
+        freeWard(&ward);
+    }
+    free(patients);
+    free(medicines);
+    free(statuses);
+    free(order);
+    free(start);
+    free(dosesPerShard);
+    printf("ward check: %s\n", failures ? "FAILED" : "every event and dose accounted for");
+    return failures;
 }
 
-// Initialize empty HashMap
-void initHashMap(HashMap* map) {
-    // Set all slots to unoccupied
-    for (int i = 0; i < TABLE_SIZE; i++) {
-        map->table[i].isOccupied = 0;// Mark slot as free
+// A made-up but drug-like name: 2-4 syllables, sometimes a strength after it
+static void randomDrugName(char* out, unsigned long long* seed) {
+    static const char* syllables[] = {"am", "ox", "ci", "lin", "pa", "ra", "ce", "ta", "mol", "ibu", "pro", "fen",
+                                      "met", "for", "min", "ator", "va", "sta", "tin", "lo", "sar", "tan", "pra",
+                                      "zole", "ome", "cef", "ur", "ime", "dox", "cy", "cline", "ni", "dip", "ine"};
+    int count = (int)(sizeof(syllables) / sizeof(syllables[0]));
+    int parts = 2 + (int)(benchRand(seed) % 3);
+    int length = 0;
+    for (int i = 0; i < parts; i++) {
+        length += snprintf(out + length, MAX_NAME - length, "%s", syllables[benchRand(seed) % count]);
     }
-    map->count = 0;
+    out[0] = (char)(out[0] - 'a' + 'A');
+    if (benchRand(seed) % 2) snprintf(out + length, MAX_NAME - length, " %dmg", 5 << (benchRand(seed) % 8));
 }
 
-// Insert into HashMap
-int insertMedicine(HashMap* map, Medicine med) {
-    int index = hashFunction(med.id);// Get initial index
-    int originalIndex = index;// To keep track of where we started
-    
-    // Linear probing: find next free slot
-    while (map->table[index].isOccupied) {
-        index = (index + 1) % TABLE_SIZE;//move to next index
-        // If we looped back to original index, table is full
-        if (index == originalIndex) {
-            printf("HashMap is full!\n");
-            return 0;// Insertion failed
+// Matches the slow way, for checking the index
+static int scanNames(const MedicineStore* store, const char* text, int mode) {
+    size_t length = strlen(text);
+    int found = 0;
+    for (int h = 0; h < store->used; h++) {
+        if (!(store->flags[h] & MED_LIVE)) continue;
+        const char* name = store->text[h].name;
+        if (mode == NAME_PREFIX) found += strncasecmp(name, text, length) == 0;
+        else if (mode == NAME_ANY_CASE) found += strcasecmp(name, text) == 0;
+        else found += strcmp(name, text) == 0;
+    }
+    return found;
+}
+
+// Index order and lookups against a full scan; returns the number of mismatches
+static int checkNameIndex(const NameIndex* index, const MedicineStore* store, unsigned long long* seed,
+                          int* found) {
+    int failures = index->count != store->count || index->sortedCount != index->count;
+    for (int i = 1; i < index->count; i++) {
+        if (compareIndexedNames(store, index->handles[i - 1], index->handles[i]) >= 0) {
+            printf("  name index out of order at %d\n", i);
+            failures++;
+            break;
         }
     }
-    // Found free slot, insert medicine
-    map->table[index].medicine = med;// Copy medicine data
-    map->table[index].isOccupied = 1;// Mark slot as occupied
-    map->count++;
-    //printf("Inserted medicine ID %d at index %d\n", med.id, index); // Debugging line
-    return 1;// Insertion successful
+    for (int q = 0; q < 300; q++) {
+        char text[MAX_NAME];
+        int handle = index->handles[benchRand(seed) % index->count];
+        int mode = q % 3;
+        memcpy(text, store->text[handle].name, MAX_NAME);
+        if (mode == NAME_PREFIX) text[1 + benchRand(seed) % 4] = 0;
+        if (mode != NAME_EXACT) text[0] = (char)(text[0] - 'A' + 'a');// any case must still find it
+        int got = findMedicinesByName(index, store, text, mode, found, index->count);
+        if (got != scanNames(store, text, mode)) {
+            printf("  \"%s\" (mode %d): index found %d, scan %d\n", text, mode, got, scanNames(store, text, mode));
+            failures++;
+        }
+    }
+    return failures;
 }
 
-// Search in HashMap - return pointer to Medicine or NULL if not found
-Medicine* searchMedicine(HashMap* map, int id) {
-    int index = hashFunction(id);// Get initial index
-    int originalIndex = index;// To avoid infinite loops
-    // Linear probing to find the medicine
-    while (map->table[index].isOccupied) {
-        if (map->table[index].medicine.id == id) {
-            // found the medicine! return pointer to it
-            return &map->table[index].medicine;
+// Returns the number of failures
+static int benchNames(int n) {
+    printf("\n-- name index, %d medicines --\n", n);
+    MedicineStore store;
+    NameIndex index;
+    int* found = (int*)malloc((size_t)(n + 1) * sizeof(int));
+    long long* latency = (long long*)malloc(100000 * sizeof(long long));
+    if (!found || !latency || !initMedicineStore(&store) || !initNameIndex(&index)) {
+        free(found);
+        free(latency);
+        return 1;
+    }
+    unsigned long long seed = 0x510e527fade682d1ULL;
+    int failures = 0;
+    Medicine med;
+    memset(&med, 0, sizeof(med));
+    for (int i = 0; i < n; i++) {
+        med.id = i + 1;
+        randomDrugName(med.name, &seed);
+        if (addToStore(&store, &med) < 0) return failures + 1;
+    }
+
+    // bulk build, as after a snapshot load or a batch import
+    double t0 = nowSeconds();
+    rebuildNameIndex(&index, &store);
+    double t1 = nowSeconds();
+    printRate("bulk build (append + sort)", n, t1 - t0);
+    failures += checkNameIndex(&index, &store, &seed, found);
+
+    // lookups: exact, any case, and 3-letter autocomplete (first 20 matches)
+    const char* modes[3] = {"exact lookup", "any-case lookup", "prefix, 3 letters, top 20"};
+    int queries = 100000;
+    for (int mode = 0; mode < 3; mode++) {
+        long long matches = 0;
+        for (int q = 0; q < queries; q++) {
+            char text[MAX_NAME];
+            memcpy(text, store.text[benchRand(&seed) % n].name, MAX_NAME);
+            if (mode == NAME_ANY_CASE) text[0] = (char)(text[0] - 'A' + 'a');
+            if (mode == NAME_PREFIX) text[3] = 0;
+            long long start = monotonicNs();
+            matches += findMedicinesByName(&index, &store, text, mode, found, mode == NAME_PREFIX ? 20 : n);
+            latency[q] = monotonicNs() - start;
         }
-        index = (index + 1) % TABLE_SIZE;//move to next index
-        if (index == originalIndex) break;//not found
+        qsort(latency, (size_t)queries, sizeof(long long), compareLongLong);
+        printf("%-34s p50 %7.2f us  p99 %7.2f us  max %8.2f us  (%.1f matches each)\n", modes[mode],
+               latency[queries / 2] / 1e3, latency[queries * 99 / 100] / 1e3, latency[queries - 1] / 1e3,
+               (double)matches / queries);
+        failures += latency[queries * 99 / 100] > 1000000;// the target: well under a millisecond
     }
-    return NULL;// Not found
-    //printf("Medicine ID %d not found in HashMap\n", id); //Debugging line
+    int scans = 20;
+    long long scanned = 0;
+    t0 = nowSeconds();
+    for (int q = 0; q < scans; q++) scanned += scanNames(&store, "Amo", NAME_PREFIX);
+    t1 = nowSeconds();
+    printf("%-34s %7.2f us per query  (%lld matches each)\n", "prefix by full scan (before)",
+           (t1 - t0) / scans * 1e6, scanned / scans);
+
+    // live updates: new medicines and deletes one at a time, index kept in order
+    int updates = n < 20000 ? n / 2 : 10000;
+    int* handles = (int*)malloc((size_t)updates * sizeof(int));
+    if (!handles) return failures + 1;
+    t0 = nowSeconds();
+    for (int i = 0; i < updates; i++) {
+        med.id = n + i + 1;
+        randomDrugName(med.name, &seed);
+        handles[i] = addToStore(&store, &med);
+        insertNameIndex(&index, &store, handles[i]);
+    }
+    t1 = nowSeconds();
+    printRate("insert one at a time", updates, t1 - t0);
+    t0 = nowSeconds();
+    for (int i = 0; i < updates; i++) {
+        int handle = (int)(benchRand(&seed) % store.used);
+        if (!(store.flags[handle] & MED_LIVE)) continue;
+        removeNameIndex(&index, &store, handle);
+        removeFromStore(&store, handle);
+    }
+    t1 = nowSeconds();
+    printRate("delete one at a time", updates, t1 - t0);
+    failures += checkNameIndex(&index, &store, &seed, found);
+
+    free(handles);
+    free(found);
+    free(latency);
+    freeNameIndex(&index);
+    freeMedicineStore(&store);
+    printf("name index check: %s\n", failures ? "FAILED" : "matches a full scan");
+    return failures;
 }
 
-// Delete from HashMap by ID
-int deleteMedicine(HashMap* map, int id) {
-    int index = hashFunction(id);
-    int originalIndex = index;
-    while (map->table[index].isOccupied) {
-        if (map->table[index].medicine.id == id) {
-            map->table[index].isOccupied = 0;
-            map->count--;
-            return 1;// Deletion successful
+// History block as it was before names were interned: every event carries its own name copy
+typedef struct LegacyNameBlock {
+    int count;
+    long long day;
+    struct LegacyNameBlock* older;
+    int32_t offsets[HISTORY_BLOCK_ENTRIES];
+    MedicineId medicineIds[HISTORY_BLOCK_ENTRIES];
+    unsigned char statuses[HISTORY_BLOCK_ENTRIES];
+    char medicineNames[HISTORY_BLOCK_ENTRIES][MAX_NAME];
+} LegacyNameBlock;
+
+// Interned history names vs a name copy per event: RSS and build time for n events over
+// 1000 medicines with different names; try n = 10000000. Returns the number of failures
+static int benchIntern(int n) {
+    printf("\n-- string interning, %d history events --\n", n);
+    int medicines = 1000;
+    char (*names)[MAX_NAME] = (char (*)[MAX_NAME])malloc((size_t)medicines * MAX_NAME);
+    if (!names) return 1;
+    unsigned long long seed = 0x1f83d9abfb41bd6bULL;
+    for (int m = 0; m < medicines; m++) randomDrugName(names[m], &seed);
+    time_t now = time(NULL);
+    int failures = 0;
+
+    releaseFreedMemory();
+    long long rss0 = currentRss();
+    LegacyNameBlock* head = NULL;
+    AdherenceCounters stats;// kept up to date here too, so both builds do the same work
+    memset(&stats, 0, sizeof(stats));
+    double t0 = nowSeconds();
+    for (int i = 0; i < n; i++) {
+        time_t ts = now + i;
+        long long day = ts / SECONDS_PER_DAY;
+        if (!head || head->count == HISTORY_BLOCK_ENTRIES || head->day != day) {
+            LegacyNameBlock* block = (LegacyNameBlock*)malloc(sizeof(LegacyNameBlock));
+            if (!block) break;
+            block->count = 0;
+            block->day = day;
+            block->older = head;
+            head = block;
+        }
+        int j = head->count++;
+        const char* name = names[i % medicines];
+        size_t len = strnlen(name, MAX_NAME - 1);
+        head->offsets[j] = (int32_t)(ts - day * SECONDS_PER_DAY);
+        head->medicineIds[j] = i % medicines;
+        head->statuses[j] = (i % 5) ? HISTORY_TAKEN : HISTORY_MISSED;
+        memcpy(head->medicineNames[j], name, len);
+        head->medicineNames[j][len] = 0;
+        countHistoryEvent(&stats, head->medicineIds[j], head->statuses[j], ts, 1);
+    }
+    double t1 = nowSeconds();
+    long long legacyRss = currentRss() - rss0;
+    double legacyTime = t1 - t0;
+    while (head) {
+        LegacyNameBlock* older = head->older;
+        free(head);
+        head = older;
+    }
+    free(stats.slots);
+    free(stats.medIds);
+    free(stats.medCounts);
+
+    releaseFreedMemory();
+    rss0 = currentRss();
+    uint64_t tableBytes = stringTable.used;
+    LinkedList list;
+    initLinkedList(&list);
+    t0 = nowSeconds();
+    for (int i = 0; i < n; i++) {
+        insertHistoryEntry(&list, i % medicines, names[i % medicines], (i % 5) ? HISTORY_TAKEN : HISTORY_MISSED,
+                           now + i);
+    }
+    t1 = nowSeconds();
+    long long internRss = currentRss() - rss0;
+    double internTime = t1 - t0;
+    tableBytes = stringTable.used - tableBytes;
+
+    printRate("name copy per event, build", n, legacyTime);
+    printRate("interned names, build", n, internTime);
+    printf("%-34s %12.1f MB (%.1f bytes/event)\n", "name copy per event, RSS", legacyRss / 1e6,
+           (double)legacyRss / n);
+    printf("%-34s %12.1f MB (%.1f bytes/event, %.0f%% less)\n", "interned names, RSS", internRss / 1e6,
+           (double)internRss / n, legacyRss > 0 ? 100.0 * (legacyRss - internRss) / legacyRss : 0.0);
+    printf("%-34s %u strings, %llu bytes of text added\n", "string table", stringTable.count,
+           (unsigned long long)tableBytes);
+    long long checked = 0;
+    for (HistoryBlock* block = list.head; block; block = block->older) {
+        for (int i = 0; i < block->count; i++, checked++) {
+            if (strcmp(stringAt(block->medicineNames[i]), names[block->medicineIds[i]]) != 0) {
+                if (!failures) printf("  wrong name for medicine %lld\n", block->medicineIds[i]);
+                failures++;
+            }
         }
-        index = (index + 1) % TABLE_SIZE;
-        if (index == originalIndex) break;// Came full circle
     }
-    return 0;//Not found
-    //printf("Medicine ID %d not found for deletion\n", id); //Debugging
+    failures += checked != n || list.count != n;
+    freeLinkedList(&list);
+    free(names);
+    printf("interning check: %s\n", failures ? "FAILED" : "every event reads back its own name");
+    return failures;
 }
 
-// Display all meds
-void displayAllMedicines(HashMap* map) {
-    printf("\n=== ALL MEDICINES ===\n");
-    printf("%-5s %-20s %-10s %-6s %-30s\n", "ID", "Name", "Dosage", "Time", "Instructions");
-    printf("--------------------------------------------------------------------------------\n");
-    // Iterate through the hash table and display occupied slots
-    for (int i = 0; i < TABLE_SIZE; i++) {
-        if (map->table[i].isOccupied) {
-            Medicine m = map->table[i].medicine;// Get medicine data
-            printf("%-5d %-20s %-10s %-6s %-30s\n", 
-                   m.id, m.name, m.dosage, m.time, m.instructions);
-        }
-    }
-    printf("\nTotal Medicines: %d\n", map->count);
-    //printf("Displayed all medicines in HashMap\n"); //Debugg
+// Harness - `bench sweep` measures the core operations of the three structures over a size
+// sweep, uniform vs clustered IDs and a delete-heavy mix; `bench scenarios` runs the test
+// cases of test_cases.txt through batch mode and checks the output. Both print a table, or
+// CSV / JSON with --csv / --json so runs can be diffed between releases.
+// Latency percentiles come from timing ops in batches of SWEEP_BATCH (one op is too short
+// to time on its own), so p99 is "the slowest 1% of batches", per op
+#define SWEEP_BATCH 32
+#define PROBE_BUCKETS 7 //probe lengths 1, 2, 3-4, 5-8, 9-16, 17-32, 33+
+enum { BENCH_TEXT, BENCH_CSV, BENCH_JSON };
+static int benchFormat = BENCH_TEXT;
+static int benchRows = 0;// rows printed so far (CSV header / JSON commas)
+
+typedef struct SweepRow {
+    const char* structure;
+    const char* op;
+    const char* ids;// "uniform" / "clustered" / "-"
+    int size;
+    long long ops;
+    double nsPerOp;
+    double p50, p90, p99, max;// ns per op
+    const long long* probes;// PROBE_BUCKETS counts, or NULL
+    int heapDepth;// 0 when it doesn't apply
+} SweepRow;
+
+static void printSweepRow(const SweepRow* r) {
+    static const char* buckets[PROBE_BUCKETS] = {"1", "2", "3-4", "5-8", "9-16", "17-32", "33+"};
+    if (benchFormat == BENCH_CSV) {
+        if (benchRows == 0) {
+            printf("structure,op,ids,size,ops,ns_per_op,p50_ns,p90_ns,p99_ns,max_ns,heap_depth,probe_hist\n");
+        }
+        printf("%s,%s,%s,%d,%lld,%.2f,%.2f,%.2f,%.2f,%.2f,%d,", r->structure, r->op, r->ids, r->size, r->ops,
+               r->nsPerOp, r->p50, r->p90, r->p99, r->max, r->heapDepth);
+        for (int b = 0; r->probes && b < PROBE_BUCKETS; b++) printf("%s%s:%lld", b ? ";" : "", buckets[b], r->probes[b]);
+        printf("\n");
+    } else if (benchFormat == BENCH_JSON) {
+        printf("%s{\"structure\":\"%s\",\"op\":\"%s\",\"ids\":\"%s\",\"size\":%d,\"ops\":%lld,\"ns_per_op\":%.2f,"
+               "\"p50_ns\":%.2f,\"p90_ns\":%.2f,\"p99_ns\":%.2f,\"max_ns\":%.2f",
+               benchRows ? ",\n " : "[", r->structure, r->op, r->ids, r->size, r->ops, r->nsPerOp, r->p50, r->p90,
+               r->p99, r->max);
+        if (r->heapDepth) printf(",\"heap_depth\":%d", r->heapDepth);
+        if (r->probes) {
+            printf(",\"probe_hist\":{");
+            for (int b = 0; b < PROBE_BUCKETS; b++) printf("%s\"%s\":%lld", b ? "," : "", buckets[b], r->probes[b]);
+            printf("}");
+        }
+        printf("}");
+    } else {
+        printf("%-10s %-14s %-9s %9d  %8.1f ns/op  p50 %7.1f  p90 %7.1f  p99 %7.1f  max %9.1f", r->structure, r->op,
+               r->ids, r->size, r->nsPerOp, r->p50, r->p90, r->p99, r->max);
+        if (r->heapDepth) printf("  depth %d", r->heapDepth);
+        printf("\n");
+        if (r->probes) {
+            printf("%-36s probes:", "");
+            for (int b = 0; b < PROBE_BUCKETS; b++) printf(" %s=%lld", buckets[b], r->probes[b]);
+            printf("\n");
+        }
+    }
+    benchRows++;
 }
 
-//Priority Queue - O(log n) insertion and deletion //to manage reminders efficiently; for scheduling tasks.
+// Close the JSON array (if one was opened)
+static void finishBenchOutput(void) {
+    if (benchFormat == BENCH_JSON && benchRows > 0) printf("]\n");
+    benchRows = 0;
+}
 
-// Initialize empty Priority Queue
-void initPriorityQueue(PriorityQueue* pq) {
-    pq->size = 0;
+// Batch timer: call sweepLap after every op, it records one sample per SWEEP_BATCH ops
+typedef struct SweepTimer {
+    long long* samples;// ns per op of each batch
+    int count;
+    int inBatch;
+    long long batchStart;
+    long long start;
+    long long ops;
+} SweepTimer;
+
+static void sweepStart(SweepTimer* t) {
+    t->count = 0;
+    t->inBatch = 0;
+    t->ops = 0;
+    t->start = t->batchStart = monotonicNs();
 }
 
-// Swap two nodes
-void swap(PQNode* a, PQNode* b) {
-    PQNode temp = *a;
-    *a = *b;
-    *b = temp;
+static inline void sweepLap(SweepTimer* t) {
+    t->ops++;
+    if (++t->inBatch == SWEEP_BATCH) {
+        long long now = monotonicNs();
+        t->samples[t->count++] = (now - t->batchStart) / SWEEP_BATCH;
+        t->batchStart = now;
+        t->inBatch = 0;
+    }
 }
 
-// Heapify up - moves the node at index up to maintain heap property
-void heapifyUp(PriorityQueue* pq, int index) {
-    
-    while (index > 0) {
-        int parent = (index - 1) / 2;// Calculate parent index
-        // If current element has smaller priority than parent, swap
-        if (pq->heap[index].priority < pq->heap[parent].priority) {
-            swap(&pq->heap[index], &pq->heap[parent]);
-            index = parent;//move up to parent index
-        } else {
-            break;
+static void sweepRow(SweepTimer* t, const char* structure, const char* op, const char* ids, int size,
+                     const long long* probes, int heapDepth) {
+    double total = (double)(monotonicNs() - t->start);
+    SweepRow r = {structure, op, ids, size, t->ops, t->ops ? total / t->ops : 0, 0, 0, 0, 0, probes, heapDepth};
+    if (t->count > 0) {
+        qsort(t->samples, (size_t)t->count, sizeof(long long), compareLongLong);
+        r.p50 = t->samples[t->count / 2];
+        r.p90 = t->samples[t->count * 90 / 100];
+        r.p99 = t->samples[t->count * 99 / 100];
+        r.max = t->samples[t->count - 1];
+    }
+    printSweepRow(&r);
+}
+
+// Probe length of every live key: slots from its home slot to where it sits, plus one
+static void probeHistogram(const HashMap* map, long long* buckets) {
+    memset(buckets, 0, PROBE_BUCKETS * sizeof(long long));
+    int mask = map->capacity - 1;
+    for (int i = 0; i < map->capacity; i++) {
+        if (map->table[i].handle < 0) continue;
+        int length = ((i - hashFunction(map->table[i].id, map->capacity)) & mask) + 1;
+        int b = 0;
+        while (b < PROBE_BUCKETS - 1 && length > (1 << b)) b++;
+        buckets[b]++;
+    }
+}
+
+static int heapDepth(const PriorityQueue* pq) {
+    int depth = 0;
+    for (int size = pq->size; size > 0; size >>= 1) depth++;
+    return depth;
+}
+
+// ID i of a workload: uniform = random 62-bit, clustered = runs of 1000 consecutive IDs
+// (what the allocator hands out per node / import batch)
+static MedicineId sweepId(int clustered, int i, unsigned long long salt) {
+    if (clustered) return (MedicineId)((i / 1000 + 1) * 1000000007LL + i % 1000);
+    unsigned long long x = (unsigned long long)i * 0x9e3779b97f4a7c15ULL + salt;
+    x ^= x >> 31;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 29;
+    return (MedicineId)(x >> 2);
+}
+
+static int benchSweep(int n) {
+    if (benchFormat == BENCH_TEXT) printf("\n-- sweep, sizes up to %d --\n", n);
+    SweepTimer t;
+    t.samples = (long long*)malloc(((size_t)n / SWEEP_BATCH + 2) * sizeof(long long));
+    MedicineId* keys = (MedicineId*)malloc((size_t)n * sizeof(MedicineId));
+    if (!t.samples || !keys) {
+        free(t.samples);
+        free(keys);
+        return 1;
+    }
+    long long probes[PROBE_BUCKETS];
+    int failures = 0;
+    time_t now = time(NULL);
+    for (int size = n < 1000 ? n : 1000;; size = size * 10 < n ? size * 10 : n) {
+        // HashMap: insert, hits, misses, then a delete-heavy mix, for both ID patterns
+        for (int clustered = 0; clustered < 2; clustered++) {
+            const char* ids = clustered ? "clustered" : "uniform";
+            HashMap map;
+            if (!initHashMap(&map)) return failures + 1;
+            for (int i = 0; i < size; i++) keys[i] = sweepId(clustered, i, 1);
+            sweepStart(&t);
+            for (int i = 0; i < size; i++) {
+                insertMedicine(&map, keys[i], i);
+                sweepLap(&t);
+            }
+            probeHistogram(&map, probes);
+            sweepRow(&t, "hashmap", "insert", ids, size, probes, 0);
+            unsigned long long seed = 42;
+            long long found = 0;
+            sweepStart(&t);
+            for (int i = 0; i < size; i++) {
+                found += searchMedicine(&map, keys[benchRand(&seed) % size]) >= 0;
+                sweepLap(&t);
+            }
+            sweepRow(&t, "hashmap", "lookup-hit", ids, size, NULL, 0);
+            sweepStart(&t);
+            for (int i = 0; i < size; i++) {
+                found -= searchMedicine(&map, sweepId(clustered, size + i, 1)) >= 0;
+                sweepLap(&t);
+            }
+            sweepRow(&t, "hashmap", "lookup-miss", ids, size, NULL, 0);
+            if (found != size) {
+                printf("!! hashmap lookups wrong at size %d (%s)\n", size, ids);
+                failures++;
+            }
+            // delete-heavy: half deletes, a quarter re-inserts, a quarter lookups
+            int next = size;
+            sweepStart(&t);
+            for (int i = 0; i < size; i++) {
+                int k = (int)(benchRand(&seed) % size);
+                int kind = (int)(benchRand(&seed) % 4);
+                if (kind < 2) deleteMedicine(&map, keys[k]);
+                else if (kind == 2) insertMedicine(&map, sweepId(clustered, next++, 1), k);
+                else searchMedicine(&map, keys[k]);
+                sweepLap(&t);
+            }
+            probeHistogram(&map, probes);
+            sweepRow(&t, "hashmap", "delete-heavy", ids, size, probes, 0);
+            freeHashMap(&map);
+        }
+
+        // Priority queue: enqueue random times, reschedule, pop everything in order
+        PriorityQueue pq;
+        if (!initPriorityQueue(&pq)) return failures + 1;
+        unsigned long long seed = 7;
+        sweepStart(&t);
+        for (int i = 0; i < size; i++) {
+            enqueuePQ(&pq, i, (int)(benchRand(&seed) % (1440 * 30)));
+            sweepLap(&t);
+        }
+        sweepRow(&t, "heap", "enqueue", "-", size, NULL, heapDepth(&pq));
+        sweepStart(&t);
+        for (int i = 0; i < size; i++) {
+            updatePriorityPQ(&pq, (int)(benchRand(&seed) % size), (int)(benchRand(&seed) % (1440 * 30)));
+            sweepLap(&t);
+        }
+        sweepRow(&t, "heap", "reschedule", "-", size, NULL, heapDepth(&pq));
+        int last = -1;
+        PQNode node;
+        sweepStart(&t);
+        for (int i = 0; i < size && popMinPQ(&pq, &node); i++) {
+            if (node.priority < last) failures++;
+            last = node.priority;
+            sweepLap(&t);
+        }
+        sweepRow(&t, "heap", "pop", "-", size, NULL, 0);
+        if (pq.size != 0) failures++;
+        freePriorityQueue(&pq);
+
+        // History list: inserts over the last 30 days, then today's statistics
+        LinkedList list;
+        initLinkedList(&list);
+        sweepStart(&t);
+        for (int i = 0; i < size; i++) {
+            insertHistoryEntry(&list, i % 1000, "Paracetamol", (i % 5) ? HISTORY_TAKEN : HISTORY_MISSED,
+                               now - 30LL * 86400 + (time_t)(30LL * 86400 * i / size));
+            sweepLap(&t);
         }
+        sweepRow(&t, "history", "insert", "-", size, NULL, 0);
+        int taken, missed, queries = size < 100000 ? size : 100000;
+        sweepStart(&t);
+        for (int i = 0; i < queries; i++) {
+            getStatistics(&list, &taken, &missed);
+            sweepLap(&t);
+        }
+        sweepRow(&t, "history", "statistics", "-", size, NULL, 0);
+        freeLinkedList(&list);
+        if (size == n) break;
     }
+    finishBenchOutput();
+    free(t.samples);
+    free(keys);
+    if (failures) printf("sweep check: FAILED (%d)\n", failures);
+    return failures;
 }
 
-// Heapify down: moves the element at index down to maintain heap property
-void heapifyDown(PriorityQueue* pq, int index) {
-    while (1) {// continue until no swaps are needed
-        int smallest = index;// Assume current index is smallest
-        int left = 2 * index + 1;// Left child index
-        int right = 2 * index + 2;// Right child index
-        // Check if left child exists and is smaller
-        if (left < pq->size && pq->heap[left].priority < pq->heap[smallest].priority) {
-            smallest = left;
-        }// Check if right child exists and is smaller
-        if (right < pq->size && pq->heap[right].priority < pq->heap[smallest].priority) {
-            smallest = right;
+// The cases in test_cases.txt, as batch commands. They run in order on one set of
+// structures, like the manual walkthrough. expect: lines that must appear in the output, in
+// that order (as substrings); a line starting with '!' must not appear anywhere
+typedef struct BenchScenario {
+    const char* name;
+    const char* input;
+    const char* expect;
+    int reload;// save a snapshot and load it back into fresh structures first (the exit / restart case)
+    int (*check)(const char* output, time_t now);// extra check, or NULL
+} BenchScenario;
+
+// Schedule rows must come in order of their next dose, counting from now
+static int scheduleInOrder(const char* output, time_t now) {
+    struct tm tmNow;
+    localtime_r(&now, &tmNow);
+    int minuteNow = tmNow.tm_hour * 60 + tmNow.tm_min;
+    int last = -1, rows = 0;
+    for (const char* line = output; line && *line; line = strchr(line, '\n') ? strchr(line, '\n') + 1 : NULL) {
+        if (strncmp(line, "medicine\t", 9) != 0) continue;
+        const char* field = line;
+        for (int f = 0; f < 4 && field; f++) field = strchr(field, '\t') ? strchr(field, '\t') + 1 : NULL;
+        if (!field) return 0;
+        int minute = parseTime(field);
+        int ahead = (minute - minuteNow + 1440 - 1) % 1440;// a dose at this exact minute is tomorrow's
+        if (ahead < last) return 0;
+        last = ahead;
+        rows++;
+    }
+    return rows == 4;
+}
+
+static const BenchScenario benchScenarios[] = {
+    {"Test 1: Add Medicine - Basic", "1,Paracetamol,500mg,08:30,Take after breakfast\nget,1\n",
+     "medicine\t1\tParacetamol\t500mg\t08:30\tTake after breakfast\ndone\t2\t0", 0, NULL},
+    {"Test 2: Add Multiple Medicines",
+     "2,Aspirin,100mg,12:45,After lunch\n3,Vitamin D,1000IU,20:00,Before sleep\n4,Ibuprofen,400mg,09:00,With food\n",
+     "done\t3\t0", 0, NULL},
+    {"Test 3: View All Medicines (HashMap)", "list\n",
+     "medicine\t1\tParacetamol\nmedicine\t2\tAspirin\nmedicine\t3\tVitamin D\nmedicine\t4\tIbuprofen\ndone\t1\t0", 0,
+     NULL},
+    {"Test 4: View Schedule (Priority Queue)", "schedule\n", "done\t1\t0", 0, scheduleInOrder},
+    {"Test 4b: Multi-dose Medicine", "add,5,Amoxicillin,250mg,06:00,With water,every 8h for 10 days\nget,5\n",
+     "medicine\t5\tAmoxicillin\t250mg\t06:00\tWith water\ndone\t2\t0", 0, NULL},
+    {"Test 5: Search Medicine by ID", "get,1\n", "medicine\t1\tParacetamol\t500mg\t08:30", 0, NULL},
+    {"Test 5b: Search Medicine by Name", "find,paracetamol\nfind,Para*\n",
+     "medicine\t1\tParacetamol\nmedicine\t1\tParacetamol\ndone\t2\t0", 0, NULL},
+    {"Test 6: Mark as Taken", "taken,1\n", "done\t1\t0", 0, NULL},
+    {"Test 7: View History (Linked List)", "history,1\n", "\t1\tParacetamol\ttaken\n!Aspirin", 0, NULL},
+    {"Test 8: Mark as Missed", "missed,2\n", "done\t1\t0", 0, NULL},
+    {"Test 9: View Updated History", "history,1\n", "\t2\tAspirin\tmissed\n\t1\tParacetamol\ttaken", 0, NULL},
+    {"Test 10: View Statistics", "stats\n", "stats\t1\t1", 0, NULL},
+    {"Test 11: Delete Medicine", "delete,4\nlist\n", "medicine\t1\tParacetamol\n!Ibuprofen\ndone\t2\t0", 0, NULL},
+    {"Test 12: Search Deleted Medicine", "get,4\n", "error\t1\tmedicine not found", 0, NULL},
+    {"Test 13: Edge Case - Invalid ID Search", "get,9999\n", "error\t1\tmedicine not found", 0, NULL},
+    {"Test 14: Edge Case - Wrong Menu Option", "fly\n", "error\t1\tunknown command", 0, NULL},
+    {"Test 15: Exit Program", "list\nfind,Amox*\n",
+     "medicine\t1\tParacetamol\nmedicine\t5\tAmoxicillin\n!Ibuprofen\ndone\t2\t0", 1, NULL},
+};
+
+// Does the output have the expected lines? Returns 1 if so
+static int scenarioOutputMatches(const char* output, const char* expect) {
+    const char* at = output;
+    char line[256];
+    while (*expect) {
+        size_t length = strcspn(expect, "\n");
+        snprintf(line, sizeof(line), "%.*s", (int)length, expect);
+        expect += length + (expect[length] == '\n');
+        if (line[0] == '!') {
+            if (strstr(output, line + 1)) return 0;
+            continue;
         }
-        // If smallest is not current index, swap and continue
-        if (smallest != index) {
-            swap(&pq->heap[index], &pq->heap[smallest]);
-            index = smallest;
+        const char* found = strstr(at, line);
+        if (!found) return 0;
+        at = found + strlen(line);
+    }
+    return 1;
+}
+
+static int benchScenariosRun(void) {
+    if (benchFormat == BENCH_TEXT) printf("\n-- test_cases.txt scenarios (batch mode) --\n");
+    const char* path = "pillpilot_bench_scenario.txt";
+    const char* snapPath = "pillpilot_bench_scenario.snap";
+    MedicineStore store;
+    HashMap map;
+    PriorityQueue pq;
+    LinkedList history;
+    NameIndex names;
+    Snapshot snap = {NULL, 0};
+    if (!initMedicineStore(&store) || !initHashMap(&map) || !initPriorityQueue(&pq) || !initNameIndex(&names)) {
+        return 1;
+    }
+    initLinkedList(&history);
+    int count = (int)(sizeof(benchScenarios) / sizeof(benchScenarios[0]));
+    int failures = 0;
+    for (int i = 0; i < count; i++) {
+        const BenchScenario* sc = &benchScenarios[i];
+        int ok = 1;
+        if (sc->reload) {
+            ok = saveSnapshot(snapPath, &store, &map, &pq);
+            freeHashMap(&map);
+            freePriorityQueue(&pq);
+            freeMedicineStore(&store);
+            closeSnapshot(&snap);
+            if (!initMedicineStore(&store) || !initHashMap(&map) || !initPriorityQueue(&pq)) return failures + 1;
+            ok = ok && loadSnapshot(snapPath, &snap, &store, &map, &pq, 1) && rebuildNameIndex(&names, &store);
+        }
+        FILE* in = fopen(path, "w");
+        if (!in) {
+            printf("cannot write %s\n", path);
+            return failures + 1;
+        }
+        fputs(sc->input, in);
+        fclose(in);
+        char* output = NULL;
+        size_t outputSize = 0;
+        FILE* out = open_memstream(&output, &outputSize);
+        if (!out) return failures + 1;
+        time_t now = time(NULL);
+        runBatch(path, &store, &map, &pq, &history, &names, NULL, NULL, out);
+        fclose(out);
+        ok = ok && scenarioOutputMatches(output, sc->expect) && (!sc->check || sc->check(output, now));
+        failures += !ok;
+        if (benchFormat == BENCH_CSV) {
+            if (benchRows++ == 0) printf("scenario,result\n");
+            printf("\"%s\",%s\n", sc->name, ok ? "pass" : "fail");
+        } else if (benchFormat == BENCH_JSON) {
+            printf("%s{\"scenario\":\"%s\",\"result\":\"%s\"}", benchRows++ ? ",\n " : "[", sc->name,
+                   ok ? "pass" : "fail");
         } else {
-            break;//break if heap property is satisfied
+            printf("%s  %s\n", ok ? "pass" : "FAIL", sc->name);
+            if (!ok) printf("%s", output);
         }
+        free(output);
     }
-    //printf("Heapified down from index %d\n", index); //Debugg
+    finishBenchOutput();
+    freeNameIndex(&names);
+    freeLinkedList(&history);
+    freeHashMap(&map);
+    freePriorityQueue(&pq);
+    freeMedicineStore(&store);
+    closeSnapshot(&snap);
+    remove(path);
+    remove(snapPath);
+    if (benchFormat == BENCH_TEXT) printf("scenarios: %d of %d passed\n", count - failures, count);
+    return failures;
 }
 
-// Insert medicine into Priority Queue
-void enqueuePQ(PriorityQueue* pq, Medicine med) {
-    // Check if queue is full
-    if (pq->size >= TABLE_SIZE) {
-        printf("Priority Queue is full!\n");
-        return;
+// The listings as they were: one fprintf per row, localtime + strftime per timestamp
+static void legacyAllMedicines(FILE* out, HashMap* map, MedicineStore* store) {
+    fprintf(out, "\n=== ALL MEDICINES ===\n");
+    fprintf(out, "%-5s %-20s %-10s %-6s %-30s\n", "ID", "Name", "Dosage", "Time", "Instructions");
+    fprintf(out, "--------------------------------------------------------------------------------\n");
+    for (int h = 0; h < store->used; h++) {
+        if (store->flags[h] & MED_LIVE) {
+            MedicineText* t = &store->text[h];
+            fprintf(out, "%-5lld %-20s %-10s %-6s %-30s\n", store->ids[h], t->name, t->dosage, t->time,
+                    t->instructions);
+        }
     }
-    // Insert at the end
-    pq->heap[pq->size].medicine = med;
-    pq->heap[pq->size].priority = med.priority;
-    heapifyUp(pq, pq->size);//move up to maintain heap prop
-    pq->size++;
-    //printf("Enqueued medicine ID %d with priority %d\n", med.id,med.priority); //Debugg
+    fprintf(out, "\nTotal Medicines: %d\n", map->count);
 }
 
-// Display today's schedule sorted by time
-void displayPriorityQueue(PriorityQueue* pq) {
-    printf("\n=== TODAY'S SCHEDULE (Sorted by Time) ===\n");
-    printf("%-6s %-20s %-10s %-30s\n", "Time", "Medicine", "Dosage", "Instructions");
-    printf("--------------------------------------------------------------------------------\n");
-    // Create a temporary array to hold sorted medicines
-    for (int i = 0; i < pq->size; i++) {
-        Medicine m = pq->heap[i].medicine;
-        printf("%-6s %-20s %-10s %-30s\n", 
-               m.time, m.name, m.dosage, m.instructions);
+static void legacyPriorityQueue(FILE* out, PriorityQueue* pq, MedicineStore* store, time_t now) {
+    fprintf(out, "\n=== UPCOMING DOSES - NEXT 24 HOURS (Sorted by Time) ===\n");
+    fprintf(out, "%-10s %-20s %-10s %-30s\n", "Time", "Medicine", "Dosage", "Instructions");
+    fprintf(out, "--------------------------------------------------------------------------------\n");
+    catchUpDoses(pq, store, now);
+    int limit = doseKey(now + 86400);
+    PriorityQueue upcoming;
+    if (!initPriorityQueue(&upcoming)) return;
+    ScheduleIterator it;
+    PQNode node;
+    initScheduleIterator(&it, pq);
+    while (nextScheduled(&it, &node) && node.priority <= limit) enqueuePQ(&upcoming, node.handle, node.priority);
+    freeScheduleIterator(&it);
+    while (popMinPQ(&upcoming, &node)) {
+        MedicineText* t = &store->text[node.handle];
+        time_t dose = (time_t)node.priority * 60;
+        struct tm tmDose;
+        char when[16];
+        localtime_r(&dose, &tmDose);
+        strftime(when, sizeof(when), "%a %H:%M", &tmDose);
+        fprintf(out, "%-10s %-20s %-10s %-30s\n", when, t->name, t->dosage, t->instructions);
+        time_t next = nextOccurrence(&store->rules[node.handle], dose);
+        if (next >= 0 && doseKey(next) <= limit) enqueuePQ(&upcoming, node.handle, doseKey(next));
     }
-    //TODO: sort display o/p later
+    freePriorityQueue(&upcoming);
 }
 
-// LinkedList; good for history tracking; dynamic data where we frequently add/remove entries!
-void initLinkedList(LinkedList* list) {
-    list->head = NULL;// Empty list
-    list->count = 0;
+static void legacyHistory(FILE* out, LinkedList* list) {
+    fprintf(out, "\n=== MEDICATION HISTORY ===\n");
+    fprintf(out, "%-20s %-10s %-30s\n", "Medicine", "Status", "Timestamp");
+    fprintf(out, "--------------------------------------------------------------------------------\n");
+    for (HistoryBlock* block = list->head; block != NULL; block = block->older) {
+        for (int i = block->count - 1; i >= 0; i--) {
+            time_t t = historyTime(block, i);
+            char timeStr[26];
+            struct tm timeInfo;
+            localtime_r(&t, &timeInfo);
+            strftime(timeStr, sizeof(timeStr), "%Y-%m-%d %H:%M:%S", &timeInfo);
+            fprintf(out, "%-20s %-10s %-30s\n", stringAt(block->medicineNames[i]),
+                    historyStatusName(block->statuses[i]), timeStr);
+        }
+    }
+    fprintf(out, "\nTotal Entries: %d\n", list->count);
+    if (list->count == 0) fprintf(out, "No medication history recorded yet.\n");
 }
 
-// Insert new history entry at head (most recent first)
-void insertAtHead(LinkedList* list, int medId, char* medName, char* status) {
-    HistoryNode* newNode = (HistoryNode*)malloc(sizeof(HistoryNode));// Allocate memory for new node
-    if (!newNode) {// Check for memory allocation failure
-        printf("Memory allocation failed!\n");
-        return;
-    }// Initialize new node
-    newNode->medicineId = medId;
-    strcpy(newNode->medicineName, medName);// Copy medicine name
-    strcpy(newNode->status, status);
-    newNode->timestamp = time(NULL);// Current time
-    // Insert at head
-    newNode->next = list->head;// Point new node to old head
-    list->head = newNode;
-    list->count++;
+// FNV-1a of a whole file, to check the two versions wrote the same bytes
+static unsigned long long fileChecksum(const char* path, long long* size) {
+    unsigned long long hash = 1469598103934665603ULL;
+    *size = 0;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    static char chunk[1 << 16];
+    ssize_t got;
+    while ((got = read(fd, chunk, sizeof(chunk))) > 0) {
+        for (ssize_t i = 0; i < got; i++) hash = (hash ^ (unsigned char)chunk[i]) * 1099511628211ULL;
+        *size += got;
+    }
+    close(fd);
+    return hash;
 }
 
-// Display history -most recent first
-void displayHistory(LinkedList* list) {
-    printf("\n=== MEDICATION HISTORY ===\n");
-    printf("%-20s %-10s %-30s\n", "Medicine", "Status", "Timestamp");
-    printf("--------------------------------------------------------------------------------\n");
-    // Traverse the list and display entries
-    HistoryNode* current = list->head;
-    while (current != NULL) {
-        // Format timestamp
-        char timeStr[26];// Buffer for formatted time
-        struct tm* timeInfo = localtime(&current->timestamp);
-        strftime(timeStr, sizeof(timeStr), "%Y-%m-%d %H:%M:%S", timeInfo);
-        
-        printf("%-20s %-10s %-30s\n", 
-               current->medicineName, current->status, timeStr);
-        current = current->next;//move to next node
+#define REPORT_BENCH_FILE "pillpilot_report.tmp"
+
+// One listing, old way then new way, into a file; both must write the same bytes
+static int benchReportListing(const char* label, int listing, HashMap* map, MedicineStore* store,
+                              PriorityQueue* pq, LinkedList* list, time_t now) {
+    FILE* out = fopen(REPORT_BENCH_FILE, "w");
+    if (!out) {
+        printf("  can't write %s\n", REPORT_BENCH_FILE);
+        return 1;
     }
-    printf("\nTotal Entries: %d\n", list->count);
-    if(list->count == 0) {
-        printf("No medication history recorded yet.\n");
+    double t0 = nowSeconds();
+    if (listing == 0) legacyAllMedicines(out, map, store);
+    if (listing == 1) legacyPriorityQueue(out, pq, store, now);
+    if (listing == 2) legacyHistory(out, list);
+    fclose(out);
+    double t1 = nowSeconds();
+    long long oldSize, newSize;
+    unsigned long long oldHash = fileChecksum(REPORT_BENCH_FILE, &oldSize);
+
+    ReportWriter w;
+    int fd = open(REPORT_BENCH_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || !openReport(&w, fd, 0)) {
+        if (fd >= 0) close(fd);
+        unlink(REPORT_BENCH_FILE);
+        return 1;
     }
+    double t2 = nowSeconds();
+    if (listing == 0) writeAllMedicines(&w, map, store);
+    if (listing == 1) writePriorityQueue(&w, pq, store, now);
+    if (listing == 2) writeHistory(&w, list);
+    closeReport(&w);
+    close(fd);
+    double t3 = nowSeconds();
+    unsigned long long newHash = fileChecksum(REPORT_BENCH_FILE, &newSize);
+    unlink(REPORT_BENCH_FILE);
+
+    char line[80];
+    snprintf(line, sizeof(line), "%s, printf per row", label);
+    printRate(line, w.rows, t1 - t0);
+    snprintf(line, sizeof(line), "%s, report writer", label);
+    printRate(line, w.rows, t3 - t2);
+    printf("%-34s %.0f -> %.0f rows/s (%.1fx), first rows out after %.0f us, %s output\n", "", w.rows / (t1 - t0),
+           w.rows / (t3 - t2), (t1 - t0) / (t3 - t2), (w.firstOutNs - w.startNs) / 1e3,
+           oldHash == newHash && oldSize == newSize ? "same" : "DIFFERENT");
+    return oldHash != newHash || oldSize != newSize || w.failed;
 }
 
-// Get statistics for today: total taken, total missed
-void getStatistics(LinkedList* list, int* taken, int* missed) {
-    *taken = 0;//counter initialization
-    *missed = 0;
-    
-    time_t now = time(NULL);//current time
-    struct tm* nowTm = localtime(&now);// Local time structure
-    // Traverse the list and count today's entries
-    HistoryNode* current = list->head;
-    while (current != NULL) {
-        struct tm* entryTm = localtime(&current->timestamp);
-        
-        // Check if entry is from today // Compare year and day of year
-        if (nowTm->tm_year == entryTm->tm_year &&
-            nowTm->tm_yday == entryTm->tm_yday) {//same day
-            if (strcmp(current->status, "taken") == 0) {
-                (*taken)++;
-            } else {
-                (*missed)++;
-            }
+// Rows/s for the three long listings before and after the report writer, written to a file.
+// Returns the number of listings whose output changed
+static int benchReport(int n) {
+    printf("\n-- report rendering, %d medicines / %d history events --\n", n, n);
+    time_t now = time(NULL) / 60 * 60;
+    unsigned long long seed = 0x2545f4914f6cdd1dULL;
+    MedicineStore store;
+    HashMap map;
+    PriorityQueue pq;
+    LinkedList list;
+    if (!initMedicineStore(&store) || !initHashMap(&map) || !initPriorityQueue(&pq)) return 1;
+    initLinkedList(&list);
+    Medicine med;
+    memset(&med, 0, sizeof(med));
+    static const char* dosages[] = {"500mg", "1 tablet", "10ml", "2 puffs"};
+    static const char* notes[] = {"After food", "Before breakfast", "With water", ""};
+    for (int i = 0; i < n; i++) {
+        med.id = i + 1;
+        randomDrugName(med.name, &seed);
+        snprintf(med.dosage, sizeof(med.dosage), "%s", dosages[i % 4]);
+        med.priority = (int)(benchRand(&seed) % 1440);
+        snprintf(med.time, sizeof(med.time), "%02d:%02d", med.priority / 60, med.priority % 60);
+        snprintf(med.instructions, sizeof(med.instructions), "%s", notes[(i / 4) % 4]);
+        int handle = addToStore(&store, &med);
+        if (handle < 0 || !insertMedicine(&map, med.id, handle)) break;
+        randomRule(&store.rules[handle], now, &seed);
+        time_t next = nextOccurrence(&store.rules[handle], now);
+        if (next >= 0) appendPQ(&pq, handle, doseKey(next));
+    }
+    buildHeapPQ(&pq, 0);
+    // a year's worth of history, oldest first, a few seconds apart
+    time_t t = now - 365 * 86400;
+    for (int i = 0; i < n; i++) {
+        int h = (int)(benchRand(&seed) % (unsigned long long)store.used);
+        t += 1 + (time_t)(benchRand(&seed) % (2 * 365 * 86400ULL / (unsigned long long)n + 1));
+        if (!insertHistoryEntry(&list, store.ids[h], store.text[h].name, i % 5 ? HISTORY_TAKEN : HISTORY_MISSED, t)) {
+            break;
         }
-        current = current->next;
     }
+    int failures = 0;
+    failures += benchReportListing("all medicines", 0, &map, &store, &pq, &list, now);
+    failures += benchReportListing("next 24 hours", 1, &map, &store, &pq, &list, now);
+    failures += benchReportListing("history", 2, &map, &store, &pq, &list, now);
+    freeLinkedList(&list);
+    freePriorityQueue(&pq);
+    freeHashMap(&map);
+    freeMedicineStore(&store);
+    return failures;
 }
 
-// UTIL FUNCS
-// Calculate priority from time string (HH:MM)
-int calculatePriority(char* time) {
-    int hours, minutes;
-    sscanf(time, "%d:%d", &hours, &minutes);
-    return hours * 60 + minutes;// Convert to total minutes from midnight
-    //e.g., 08:30 = 8*60 + 30 = 510min
+// Hot-path cost with whatever metrics setting this binary was built with: run it from a plain
+// build and a -DPILLPILOT_METRICS=1 build and compare. With metrics in, also checks the
+// histograms saw every op and writes a sample dump. Returns the number of failures
+static int benchMetrics(int n) {
+    printf("\n-- metrics (%s), %d ops each --\n", PILLPILOT_METRICS ? "built in" : "compiled out", n);
+    HashMap map;
+    PriorityQueue pq;
+    LinkedList list;
+    if (!initHashMap(&map) || !initPriorityQueue(&pq)) return 1;
+    initLinkedList(&list);
+    int failures = 0;
+#if PILLPILOT_METRICS
+    unsigned long long inserts0 = metricCount(MET_MAP_INSERT_PROBES), lookups0 = metricCount(MET_MAP_LOOKUP_PROBES);
+#endif
+    double t0 = nowSeconds();
+    for (int i = 0; i < n; i++) insertMedicine(&map, i + 1, i);
+    double t1 = nowSeconds();
+    printRate("hashmap insert", n, t1 - t0);
+    unsigned long long seed = 99;
+    long long found = 0;
+    t0 = nowSeconds();
+    for (int i = 0; i < n; i++) found += searchMedicine(&map, 1 + (MedicineId)(benchRand(&seed) % (2ULL * n))) >= 0;
+    t1 = nowSeconds();
+    printRate("hashmap lookup (half miss)", n, t1 - t0);
+    t0 = nowSeconds();
+    for (int i = 0; i < n; i++) enqueuePQ(&pq, i, (int)(benchRand(&seed) % 100000));
+    t1 = nowSeconds();
+    printRate("heap enqueue", n, t1 - t0);
+    time_t now = time(NULL);
+    t0 = nowSeconds();
+    for (int i = 0; i < n; i++) insertHistoryEntry(&list, i % 1000, "Paracetamol", HISTORY_TAKEN, now + i / 1000);
+    t1 = nowSeconds();
+    printRate("history append", n, t1 - t0);
+#if PILLPILOT_METRICS
+    unsigned long long inserts = metricCount(MET_MAP_INSERT_PROBES) - inserts0;
+    unsigned long long lookups = metricCount(MET_MAP_LOOKUP_PROBES) - lookups0;
+    printf("%-34s %llu inserts, %llu lookups seen (%lld hits)\n", "probe histograms", inserts, lookups, found);
+    failures += inserts != (unsigned long long)n || lookups != (unsigned long long)n;
+    const char* path = "pillpilot_bench.metrics";
+    if (dumpMetrics(path)) {
+        printf("%-34s %s (cat it for the Prometheus text)\n", "dump written to", path);
+    } else {
+        printf("  could not write %s\n", path);
+        failures++;
+    }
+#else
+    (void)found;
+    printf("build with -DPILLPILOT_METRICS=1 (make METRICS=1) and run again to see the overhead\n");
+#endif
+    freeLinkedList(&list);
+    freePriorityQueue(&pq);
+    freeHashMap(&map);
+    return failures;
+}
+
+int runBenchmarks(int argc, char* argv[]) {
+    const char* args[2] = {NULL, NULL};// [name] [n], options can go anywhere
+    int positional = 0;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "--csv") == 0) benchFormat = BENCH_CSV;
+        else if (strcmp(argv[i], "--json") == 0) benchFormat = BENCH_JSON;
+        else if (positional < 2) args[positional++] = argv[i];
+    }
+    const char* name = args[0] ? args[0] : "all";
+    int n = args[1] ? atoi(args[1]) : 1000000;
+    int all = strcmp(name, "all") == 0;
+    int ran = 0;
+    int failed = 0;
+    if (n <= 0) n = 1000000;
+    if (all || strcmp(name, "hashmap") == 0) {
+        benchSmallTables();
+        benchLargeTable(n);
+        ran = 1;
+    }
+    if (all || strcmp(name, "layout") == 0) {
+        benchLayout(n);
+        ran = 1;
+    }
+    if (all || strcmp(name, "heap") == 0) {
+        benchHeap(n);
+        ran = 1;
+    }
+    if (all || strcmp(name, "topk") == 0) {
+        benchTopK(n);
+        ran = 1;
+    }
+    if (all || strcmp(name, "snapshot") == 0) {
+        benchSnapshot(n);
+        ran = 1;
+    }
+    if (all || strcmp(name, "wal") == 0) {
+        benchHistoryLog(n);
+        ran = 1;
+    }
+    if (all || strcmp(name, "history") == 0) {
+        benchHistory(n);
+        ran = 1;
+    }
+    if (all || strcmp(name, "stats") == 0) {
+        benchStats(n);
+        ran = 1;
+    }
+    if (all || strcmp(name, "query") == 0) {
+        benchQuery(n);
+        ran = 1;
+    }
+    if (all || strcmp(name, "import") == 0) {
+        benchImport(n);
+        ran = 1;
+    }
+    if (all || strcmp(name, "ids") == 0) {
+        failed |= benchIds(n) != 0;
+        ran = 1;
+    }
+    if (all || strcmp(name, "simd") == 0) {
+        failed |= benchSimd(n) != 0;
+        ran = 1;
+    }
+    if (all || strcmp(name, "concurrent") == 0) {
+        failed |= benchConcurrent(n) != 0;
+        ran = 1;
+    }
+    if (all || strcmp(name, "reminders") == 0) {
+        failed |= benchReminders(n) != 0;
+        ran = 1;
+    }
+    if (all || strcmp(name, "recurrence") == 0) {
+        failed |= benchRecurrence(n) != 0;
+        ran = 1;
+    }
+    if (all || strcmp(name, "ward") == 0) {
+        failed |= benchWard(n) != 0;
+        ran = 1;
+    }
+    if (all || strcmp(name, "names") == 0) {
+        failed |= benchNames(n) != 0;
+        ran = 1;
+    }
+    if (all || strcmp(name, "intern") == 0) {
+        failed |= benchIntern(n) != 0;
+        ran = 1;
+    }
+    if (all || strcmp(name, "sweep") == 0) {
+        failed |= benchSweep(n) != 0;
+        ran = 1;
+    }
+    if (all || strcmp(name, "scenarios") == 0) {
+        failed |= benchScenariosRun() != 0;
+        ran = 1;
+    }
+    if (all || strcmp(name, "report") == 0) {
+        failed |= benchReport(n) != 0;
+        ran = 1;
+    }
+    if (all || strcmp(name, "metrics") == 0) {
+        failed |= benchMetrics(n) != 0;
+        ran = 1;
+    }
+    if (!ran) {
+        printf("Unknown benchmark '%s'. Try: hashmap, layout, heap, topk, snapshot, wal, history, stats, query, import, ids, simd, concurrent, reminders, recurrence, ward, names, intern, sweep, scenarios, report, metrics\n", name);
+        return 1;
+    }
+    return failed;
 }
 
-// simple unique ID generation based on current time (dummy implementation)
-int generateId() {
-    return (int)time(NULL) % 10000;// Last 4 digits of current time
-    // In real application there's a database for unique IDs or UUIDs
+// Reminder callback for the menu: runs on the scheduler thread, so it only prints what the timer carries
+static void printReminder(void* ctx, const ReminderFired* fired) {
+    (void)ctx;
+    struct tm dose;
+    localtime_r(&fired->doseTime, &dose);
+    printf("\n⏰ Reminder: time to take medicine ID %lld (%02d:%02d)\n", fired->id, dose.tm_hour, dose.tm_min);
+    fflush(stdout);
 }
 
-int main() {//declare main data structures
-    HashMap medicineMap;// Main storage for medicines
+int main(int argc, char* argv[]) {
+    // ./pillpilot bench [name] [n] runs the micro-benchmarks instead of the menu
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        return runBenchmarks(argc - 2, argv + 2);
+    }
+    //declare main data structures
+    MedicineStore medicineStore;// Main storage for medicines
+    HashMap medicineMap;// ID -> store handle index
     PriorityQueue reminderQueue;// For scheduling reminders
     LinkedList history;// For tracking taken/missed medicines
+    NameIndex medicineNames;// medicines sorted by name, for search by name
     
-    initHashMap(&medicineMap);// Initialize data structures
-    initPriorityQueue(&reminderQueue);
+    // Initialize data structures
+    if (!initMedicineStore(&medicineStore) || !initHashMap(&medicineMap) ||
+        !initPriorityQueue(&reminderQueue) || !initNameIndex(&medicineNames)) {
+        return 1;
+    }
+    // ./pillpilot batch [file] runs commands non-interactively (output is for programs, not people)
+    int batch = argc > 1 && strcmp(argv[1], "batch") == 0;
+    // Metrics builds (-DPILLPILOT_METRICS=1) dump to this file on exit and on SIGUSR1
+    const char* metricsPath = getenv("PILLPILOT_METRICS_FILE") ? getenv("PILLPILOT_METRICS_FILE") : METRICS_FILE;
+    startMetricsExport(metricsPath);// before any other thread starts
+    // Pick up where we left off - the snapshot is mapped and used in place
+    Snapshot snapshot = {NULL, 0};
+    if (loadSnapshot(SNAPSHOT_FILE, &snapshot, &medicineStore, &medicineMap, &reminderQueue, 0) && !batch) {
+        printf("Loaded %d medicines from %s\n", medicineMap.count, SNAPSHOT_FILE);
+    }
+    rebuildNameIndex(&medicineNames, &medicineStore);// not saved, sorting it again is quick
     initLinkedList(&history);
+    // Replay the history log - every taken/missed event is appended to it
+    HistoryLog historyLog;
+    int historyLogOpen = openHistoryLog(&historyLog, HISTORY_LOG_PREFIX, WAL_MAX_LATENCY_MS, &history);
+    if (WAL_RETENTION_DAYS > 0) {// same retention window as the log, whole blocks at a time
+        trimHistory(&history, time(NULL) - (time_t)WAL_RETENTION_DAYS * 86400);
+    }
+    if (historyLogOpen && history.count > 0 && !batch) {
+        printf("Loaded %d history entries from %s\n", history.count, HISTORY_LOG_PREFIX);
+    }
+    // New medicine IDs come from the ID allocator (PILLPILOT_NODE picks the node prefix)
+    IdAllocator idAllocator;
+    IdBatch idBatch = {0, 0};
+    const char* node = getenv("PILLPILOT_NODE");
+    int idFileFound = openIdAllocator(&idAllocator, ID_FILE, node ? atoi(node) : -1);
+    for (int h = 0; h < medicineStore.used; h++) raiseIdFloor(&idAllocator, medicineStore.ids[h]);
+    if (idFileFound == 0) {// first run with an ID file: don't reuse IDs that only live in history
+        for (HistoryBlock* block = history.head; block; block = block->older) {
+            for (int i = 0; i < block->count; i++) raiseIdFloor(&idAllocator, block->medicineIds[i]);
+        }
+    }
+    if (batch) {
+        int rc = runBatch(argc > 2 ? argv[2] : NULL, &medicineStore, &medicineMap, &reminderQueue, &history,
+                          &medicineNames, historyLogOpen ? &historyLog : NULL, idFileFound >= 0 ? &idAllocator : NULL, stdout);
+        saveSnapshot(SNAPSHOT_FILE, &medicineStore, &medicineMap, &reminderQueue);
+        if (historyLogOpen) closeHistoryLog(&historyLog);
+        if (idFileFound >= 0) closeIdAllocator(&idAllocator);
+        dumpMetrics(metricsPath);
+        freeNameIndex(&medicineNames);
+        freeLinkedList(&history);
+        freeHashMap(&medicineMap);
+        freePriorityQueue(&reminderQueue);
+        freeMedicineStore(&medicineStore);
+        closeSnapshot(&snapshot);
+        return rc;
+    }
     
+    // Reminders fire from a background thread at each medicine's time, every day
+    ReminderScheduler reminders;
+    int remindersOn = initReminderScheduler(&reminders, printReminder, NULL);
+    if (remindersOn) {
+        for (int h = 0; h < medicineStore.used; h++) {
+            if (medicineStore.flags[h] & MED_LIVE) {
+                armReminder(&reminders, h, medicineStore.ids[h], &medicineStore.rules[h]);
+            }
+        }
+        remindersOn = startReminderScheduler(&reminders);
+    }
+
     int choice;
     
     printf("\n");
@@ -357,23 +7666,26 @@ int main() {//declare main data structures
         printf("\n========== MAIN MENU ==========\n");
         printf("1. Add New Medicine\n");
         printf("2. View All Medicines (HashMap Demo)\n");
-        printf("3. View Today's Schedule (Priority Queue Demo)\n");
+        printf("3. View Upcoming Doses (Priority Queue Demo)\n");
         printf("4. Mark Medicine as Taken\n");
         printf("5. Mark Medicine as Missed\n");
         printf("6. View Medication History (Linked List Demo)\n");
         printf("7. View Today's Statistics\n");
         printf("8. Search Medicine by ID (HashMap Lookup)\n");
         printf("9. Delete Medicine\n");
+        printf("10. Reschedule Medicine\n");
+        printf("11. Search History (last N days)\n");
+        printf("12. Search Medicine by Name\n");
         printf("0. Exit Program\n");
         printf("===============================\n");
-        printf("Enter your choice (0-9): ");
+        printf("Enter your choice (0-12): ");
         scanf("%d", &choice);
         getchar(); // Consume newline after scanf
         
         switch (choice) {
             case 1: {
                 Medicine med;
-                med.id = generateId();// Generate unique ID
+                med.id = idFileFound >= 0 ? nextId(&idAllocator, &idBatch, 1) : -1;// Generate unique ID
                 printf("\n--- Adding New Medicine ---\n");
                 printf("\nEnter medicine name: ");
                 fgets(med.name, MAX_NAME, stdin);
@@ -393,32 +7705,49 @@ int main() {//declare main data structures
                 med.instructions[strcspn(med.instructions, "\n")] = 0;
                 
                 med.priority = calculatePriority(med.time);
-                // Insert into HashMap and Priority Queue
-                if (insertMedicine(&medicineMap, med)) {
-                    enqueuePQ(&reminderQueue, med);
-                    printf("\n✓ Medicine added successfully! ID: %d\n", med.id);
+                char repeat[128];
+                RecurrenceRule rule;
+                printf("Repeat (Enter = daily; e.g. 08:00,20:00 / every 8h for 10 days / mon,wed,fri): ");
+                if (!fgets(repeat, sizeof(repeat), stdin)) repeat[0] = 0;
+                repeat[strcspn(repeat, "\n")] = 0;
+                if (!parseRecurrence(repeat, med.priority, time(NULL), &rule)) {
+                    printf("✗ Didn't understand that, it's daily at %s\n", med.time);
+                    dailyRule(&rule, med.priority);
+                }
+                // Insert into HashMap and Priority Queue (the queue holds its next dose only)
+                int handle = med.id >= 0 ? addToStore(&medicineStore, &med) : -1;
+                if (handle >= 0 && insertMedicine(&medicineMap, med.id, handle)) {
+                    insertNameIndex(&medicineNames, &medicineStore, handle);
+                    medicineStore.rules[handle] = rule;
+                    scheduleNextDose(&reminderQueue, &medicineStore, handle, time(NULL));
+                    if (remindersOn) armReminder(&reminders, handle, med.id, &rule);
+                    printf("\n✓ Medicine added successfully! ID: %lld\n", med.id);
                 } else {
+                    if (handle >= 0) removeFromStore(&medicineStore, handle);
                     printf("\n✗ Failed to add medicine.\n");
                 }
                 break;
             }
             
             case 2:
-                displayAllMedicines(&medicineMap);
+                displayAllMedicines(&medicineMap, &medicineStore);
                 break;
             
             case 3:
-                displayPriorityQueue(&reminderQueue);
+                displayPriorityQueue(&reminderQueue, &medicineStore);
                 break;
             
             case 4: {
-                int id;
+                MedicineId id;
                 printf("\nEnter medicine ID: ");
-                scanf("%d", &id);
+                scanf("%lld", &id);
                 
-                Medicine* med = searchMedicine(&medicineMap, id);  // Lookup in HashMap
-                if (med != NULL) {
-                    insertAtHead(&history, med->id, med->name, "taken");
+                int handle = searchMedicine(&medicineMap, id);  // Lookup in HashMap
+                if (handle >= 0) {
+                    time_t when = insertAtHead(&history, id, medicineStore.text[handle].name, HISTORY_TAKEN);
+                    if (historyLogOpen && when != (time_t)-1) {
+                        appendHistoryLog(&historyLog, id, medicineStore.text[handle].name, HISTORY_TAKEN, when);
+                    }
                     printf("\n✓ Marked as taken!\n");
                 } else {
                     printf("\n✗ Medicine not found!\n");
@@ -427,13 +7756,16 @@ int main() {//declare main data structures
             }
             
             case 5: {
-                int id;
+                MedicineId id;
                 printf("\nEnter medicine ID to mark as missed: ");
-                scanf("%d", &id);
+                scanf("%lld", &id);
                 
-                Medicine* med = searchMedicine(&medicineMap, id);
-                if (med != NULL) {
-                    insertAtHead(&history, med->id, med->name, "missed");
+                int handle = searchMedicine(&medicineMap, id);
+                if (handle >= 0) {
+                    time_t when = insertAtHead(&history, id, medicineStore.text[handle].name, HISTORY_MISSED);
+                    if (historyLogOpen && when != (time_t)-1) {
+                        appendHistoryLog(&historyLog, id, medicineStore.text[handle].name, HISTORY_MISSED, when);
+                    }
                     printf("\n✓ Marked as missed!\n");
                 } else {
                     printf("\n✗ Medicine not found!\n");
@@ -467,56 +7799,154 @@ int main() {//declare main data structures
                 }else {
                     printf("No medication taken or missed today yet.\n");
                 }
+                SlotCount week[7];// last 7 days, oldest first
+                adherenceByDay(&history, localDayStart(time(NULL), -6), 7, week);
+                printf("\nLast 7 days (taken / missed):");
+                for (int d = 0; d < 7; d++) printf(" %d/%d", week[d].taken, week[d].missed);
+                printf("\n");
                 break;
             }
             
             case 8: {
-                int id;
+                MedicineId id;
                 printf("\nEnter medicine ID to search: ");
-                scanf("%d", &id);
+                scanf("%lld", &id);
                 
-                Medicine* med = searchMedicine(&medicineMap, id);
-                if (med != NULL) {
+                int handle = searchMedicine(&medicineMap, id);
+                if (handle >= 0) {
+                    Medicine m;
+                    Medicine* med = &m;
+                    getMedicine(&medicineStore, handle, med);// pull the text out of the cold arena
                     printf("\n=== MEDICINE FOUND ===\n");
-                    printf("ID: %d\n", med->id);
+                    printf("ID: %lld\n", med->id);
                     printf("Name: %s\n", med->name);
                     printf("Dosage: %s\n", med->dosage);
                     printf("Scheduled Time: %s\n", med->time);
                     printf("Instructions: %s\n", med->instructions);
                     printf("Priority Value: %d minutes from midnight\n",med->priority);
+                    char rule[160];
+                    formatRecurrence(&medicineStore.rules[handle], rule, sizeof(rule));
+                    printf("Schedule: %s\n", rule);
+                    time_t next = nextOccurrence(&medicineStore.rules[handle], time(NULL));
+                    if (next >= 0) {
+                        char when[32];
+                        struct tm tmNext;
+                        localtime_r(&next, &tmNext);
+                        strftime(when, sizeof(when), "%a %Y-%m-%d %H:%M", &tmNext);
+                        printf("Next Dose: %s\n", when);
+                    } else {
+                        printf("Next Dose: none, the course is finished\n");
+                    }
+                    int taken, missed;
+                    getMedicineStatistics(&history, med->id, &taken, &missed);
+                    printf("Doses Taken / Missed: %d / %d\n", taken, missed);
                 } else {
-                    printf("\n✗ No Medicine found with ID %d\n",id);
+                    printf("\n✗ No Medicine found with ID %lld\n",id);
                     printf("  Double-check the ID or use option 2 to list all medicines.\n");
                 }
                 break;
             }
             
             case 9: {
-                int id;
+                MedicineId id;
                 printf("\nEnter medicine ID to delete: ");
-                scanf("%d", &id);
+                scanf("%lld", &id);
                 //confirm deletion
-                Medicine* med = searchMedicine(&medicineMap, id);
-                if (med != NULL) {
+                int handle = searchMedicine(&medicineMap, id);
+                if (handle >= 0) {
+                    MedicineText* med = &medicineStore.text[handle];
                     printf("Found medicine: %s (%s)\n", med->name, med->dosage);
                     printf("Are you sure you want to delete this? (y/n): ");
                     char confirm;
                     scanf(" %c", &confirm);
                     if (confirm == 'y' || confirm == 'Y') {
-                        if (deleteMedicine(&medicineMap, id)) {
-                            printf("\n✓ Medicine ID %d deleted successfully!\n", id);
+                        if (deleteMedicine(&medicineMap, id) >= 0) {
+                            removeFromPQ(&reminderQueue, handle);// no stale reminder left behind
+                            if (remindersOn) cancelReminder(&reminders, handle);
+                            removeNameIndex(&medicineNames, &medicineStore, handle);
+                            removeFromStore(&medicineStore, handle);
+                            printf("\n✓ Medicine ID %lld deleted successfully!\n", id);
                         } else {
-                            printf("\n✗ Failed to delete medicine ID %d\n", id);
+                            printf("\n✗ Failed to delete medicine ID %lld\n", id);
                         }
                     } else {
                         printf("\n✗ Deletion cancelled.\n");
                     }
                 } else {
-                    printf("\n✗ Medicine with ID %d not found!\n",id);
+                    printf("\n✗ Medicine with ID %lld not found!\n",id);
+                }
+                break;
+            }
+            
+            case 10: {
+                MedicineId id;
+                printf("\nEnter medicine ID to reschedule: ");
+                scanf("%lld", &id);
+                
+                int handle = searchMedicine(&medicineMap, id);
+                if (handle >= 0) {
+                    MedicineText* med = &medicineStore.text[handle];
+                    printf("Current time for %s: %s\n", med->name, med->time);
+                    printf("Enter new time (HH:MM format,e.g.,08:30): ");
+                    scanf("%5s", med->time);
+                    getchar();
+                    int oldMinute = medicineStore.priorities[handle];
+                    medicineStore.priorities[handle] = calculatePriority(med->time);
+                    rescheduleRule(&medicineStore.rules[handle], oldMinute, medicineStore.priorities[handle]);
+                    scheduleNextDose(&reminderQueue, &medicineStore, handle, time(NULL));// O(log n), no rebuild
+                    if (remindersOn) armReminder(&reminders, handle, id, &medicineStore.rules[handle]);
+                    printf("\n✓ %s moved to %s\n", med->name, med->time);
+                } else {
+                    printf("\n✗ Medicine with ID %lld not found!\n",id);
                 }
                 break;
             }
             
+            case 11: {
+                MedicineId id;
+                int days, status;
+                printf("\nEnter medicine ID (0 for all): ");
+                scanf("%lld", &id);
+                printf("Enter number of days (e.g., 30): ");
+                scanf("%d", &days);
+                printf("Status (0 = all, 1 = taken, 2 = missed): ");
+                scanf("%d", &status);
+                getchar();
+                if (days <= 0 || status < 0 || status > 2) {
+                    printf("\n✗ Invalid search!\n");
+                    break;
+                }
+                displayHistoryRange(&history, days, id > 0 ? id : -1, status);
+                break;
+            }
+
+            case 12: {
+                char text[MAX_NAME];
+                int found[20];
+                printf("\nEnter medicine name (end with * to match the start, e.g. Amox*): ");
+                if (!fgets(text, sizeof(text), stdin)) break;
+                text[strcspn(text, "\n")] = 0;
+                size_t length = strlen(text);
+                int mode = length > 0 && text[length - 1] == '*' ? NAME_PREFIX : NAME_ANY_CASE;
+                if (mode == NAME_PREFIX) text[length - 1] = 0;
+                if (mode != NAME_PREFIX && length == 0) {
+                    printf("\n✗ Invalid search!\n");
+                    break;
+                }
+                int count = findMedicinesByName(&medicineNames, &medicineStore, text, mode, found, 20);
+                if (count == 0) {
+                    printf("\n✗ No medicine named %s%s\n", text, mode == NAME_PREFIX ? "..." : "");
+                    break;
+                }
+                printf("\n%-5s %-20s %-10s %-6s\n", "ID", "Name", "Dosage", "Time");
+                for (int i = 0; i < count; i++) {
+                    MedicineText* t = &medicineStore.text[found[i]];
+                    printf("%-5lld %-20s %-10s %-6s\n", medicineStore.ids[found[i]], t->name, t->dosage, t->time);
+                }
+                if (count == 20) printf("(first 20 shown, type more of the name to narrow it down)\n");
+                break;
+            }
+
             case 0:
                 printf("\nThank you for using PillPilot!\n");
                 printf("Stay healthy and remember to take your meds on time!\n");
@@ -524,10 +7954,21 @@ int main() {//declare main data structures
                 printf("Course: Data Structures & Applications\n");
                 printf("Structures Used: HashMap, Priority Queue, Linked List\n\n");
                 printf("Goodbye!\n");
+                freeReminderScheduler(&reminders);// stops the thread
+                saveSnapshot(SNAPSHOT_FILE, &medicineStore, &medicineMap, &reminderQueue);
+                if (historyLogOpen) closeHistoryLog(&historyLog);// flushes anything still pending
+                if (idFileFound >= 0) closeIdAllocator(&idAllocator);
+                dumpMetrics(metricsPath);
+                freeNameIndex(&medicineNames);
+                freeLinkedList(&history);
+                freeHashMap(&medicineMap);
+                freePriorityQueue(&reminderQueue);
+                freeMedicineStore(&medicineStore);
+                closeSnapshot(&snapshot);
                 return 0;
             
             default:
-                printf("\n✗ Invalid choice! Please enter a number from 0-9 and Try again.\n");
+                printf("\n✗ Invalid choice! Please enter a number from 0-12 and Try again.\n");
                 printf("Tip: Read the menu carefully and try again.\n");
                 printf("If the issue persists, restart the program.\n");
         }